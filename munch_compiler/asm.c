@@ -0,0 +1,983 @@
+// x86-64 assembly ===
+
+// --backend=asm generates GNU as assembly for x86-64 System V from the linear IR, so that a
+// program is built without the C compiler. Every IR register that is used gets 8 bytes of the
+// stack frame and every slot gets its own aligned bytes. An instruction loads its operands from
+// the frame into machine registers and stores its result back, so no value lives in a machine
+// register across instructions. In the frame ints and chars are kept as 32 bits with chars sign
+// extended, floats as their 32 bits, and pointers and functions as 64 bits.
+//
+// The labels of a function are prefixed with its name, .L<name>.<block> for its blocks and
+// .L<name>.s<n> for its strings, and every definition switches to its own section. The assembly
+// of a definition does not depend on the rest of the file, so it is generated on the gen
+// workers and cached by --incremental like the C.
+
+#define asmf(fmt, ...) genf("    " fmt "\n", ##__VA_ARGS__)
+
+typedef enum AsmReg {
+    ASM_RAX,
+    ASM_RCX,
+    ASM_RDX,
+    ASM_RSI,
+    ASM_RDI,
+    ASM_R8,
+    ASM_R9,
+    ASM_R10,
+    ASM_R11,
+    ASM_RSP,
+    ASM_RBP,
+    NUM_ASM_REGS
+} AsmReg;
+
+// the names of the 8, 4, 2 and 1 byte parts of each register
+const char* asm_reg_names[NUM_ASM_REGS][4] = {
+    [ASM_RAX] = { "rax", "eax", "ax", "al" },
+    [ASM_RCX] = { "rcx", "ecx", "cx", "cl" },
+    [ASM_RDX] = { "rdx", "edx", "dx", "dl" },
+    [ASM_RSI] = { "rsi", "esi", "si", "sil" },
+    [ASM_RDI] = { "rdi", "edi", "di", "dil" },
+    [ASM_R8] = { "r8", "r8d", "r8w", "r8b" },
+    [ASM_R9] = { "r9", "r9d", "r9w", "r9b" },
+    [ASM_R10] = { "r10", "r10d", "r10w", "r10b" },
+    [ASM_R11] = { "r11", "r11d", "r11w", "r11b" },
+    [ASM_RSP] = { "rsp", "esp", "sp", "spl" },
+    [ASM_RBP] = { "rbp", "ebp", "bp", "bpl" },
+};
+
+#define NUM_ASM_INT_ARGS 6
+#define NUM_ASM_SSE_ARGS 8
+
+AsmReg asm_int_args[NUM_ASM_INT_ARGS] = { ASM_RDI, ASM_RSI, ASM_RDX, ASM_RCX, ASM_R8, ASM_R9 };
+AsmReg asm_int_rets[2] = { ASM_RAX, ASM_RDX };
+
+// copies and zeroing of more bytes use rep movsb and rep stosb
+#define ASM_MAX_UNROLLED 64
+
+const char* asm_reg(AsmReg reg, size_t size) {
+    return asm_reg_names[reg][size == 8 ? 0 : size == 4 ? 1 : size == 2 ? 2 : 3];
+}
+
+char asm_suffix(size_t size) {
+    return size == 8 ? 'q' : size == 4 ? 'l' : size == 2 ? 'w' : 'b';
+}
+
+bool is_asm_quad(Type* type) {
+    return type->type == TYPE_PTR || type->type == TYPE_FUNC;
+}
+
+// the bytes of a value of a scalar type in the frame
+size_t asm_value_size(Type* type) {
+    return is_asm_quad(type) ? 8 : 4;
+}
+
+// Calling convention ===
+
+typedef enum AsmClass {
+    ASM_CLASS_NONE,
+    ASM_CLASS_INT,
+    ASM_CLASS_SSE,
+} AsmClass;
+
+// where a param or a result is passed. a value in registers has an eightbyte in each of regs,
+// an index to asm_int_args or asm_int_rets for an int eightbyte and the xmm number for an sse
+// one. a value in memory is at stack_offset of the args on the stack
+typedef struct AsmLoc {
+    size_t num_eightbytes; // 0 in memory
+    AsmClass classes[2];
+    uint8_t regs[2];
+    size_t stack_offset;
+} AsmLoc;
+
+// arrays are passed by their address
+Type* asm_param_type(Type* type) {
+    return type->type == TYPE_ARRAY ? type_ptr(type->array.base) : type;
+}
+
+void asm_classify_at(Type* type, size_t offset, AsmClass* classes) {
+    switch (type->type) {
+    case TYPE_STRUCT:
+    case TYPE_UNION:
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            asm_classify_at(type->aggregate.fields[i].type, offset + type->aggregate.fields[i].offset, classes);
+        }
+        break;
+    case TYPE_ARRAY:
+        for (size_t i = 0; i < type->array.size; i++) {
+            asm_classify_at(type->array.base, offset + i * type->array.base->size, classes);
+        }
+        break;
+    case TYPE_FLOAT:
+        if (classes[offset / 8] == ASM_CLASS_NONE) {
+            classes[offset / 8] = ASM_CLASS_SSE;
+        }
+        break;
+    default:
+        classes[offset / 8] = ASM_CLASS_INT;
+        break;
+    }
+}
+
+// the number of eightbytes of a value passed in registers, or 0 when it is passed in memory.
+// an aggregate of up to 16 bytes is passed in registers, an eightbyte of only floats in an sse
+// register and any other in an int register
+size_t asm_classify(Type* type, AsmClass* classes) {
+    classes[0] = classes[1] = ASM_CLASS_NONE;
+    if (type->size > 16 || type->size == 0) {
+        return 0;
+    }
+    asm_classify_at(type, 0, classes);
+    size_t num_eightbytes = (type->size + 7) / 8;
+    for (size_t i = 0; i < num_eightbytes; i++) {
+        if (classes[i] == ASM_CLASS_NONE) {
+            classes[i] = ASM_CLASS_INT;
+        }
+    }
+    return num_eightbytes;
+}
+
+// an aggregate goes on the stack as a whole when its registers have run out
+void asm_locate(Type* type, AsmLoc* loc, size_t* num_ints, size_t* num_sses, size_t* stack_size) {
+    size_t num_eightbytes = asm_classify(type, loc->classes);
+    size_t ints = 0, sses = 0;
+    for (size_t i = 0; i < num_eightbytes; i++) {
+        if (loc->classes[i] == ASM_CLASS_INT) {
+            ints++;
+        }
+        else {
+            sses++;
+        }
+    }
+    if (num_eightbytes && *num_ints + ints <= NUM_ASM_INT_ARGS && *num_sses + sses <= NUM_ASM_SSE_ARGS) {
+        loc->num_eightbytes = num_eightbytes;
+        for (size_t i = 0; i < num_eightbytes; i++) {
+            loc->regs[i] = (uint8_t)(loc->classes[i] == ASM_CLASS_INT ? (*num_ints)++ : (*num_sses)++);
+        }
+    }
+    else {
+        loc->num_eightbytes = 0;
+        loc->stack_offset = *stack_size;
+        *stack_size += align_up(type->size, 8);
+    }
+}
+
+// returns the bytes of the params passed on the stack. an aggregate result that is not returned
+// in registers is stored at an address passed in rdi before the params
+size_t asm_locate_call(Type* func_type, AsmLoc* params, AsmLoc* ret) {
+    size_t num_ints = 0, num_sses = 0, stack_size = 0;
+    Type* ret_type = func_type->func.ret;
+    *ret = (AsmLoc) { 0 };
+    if (ret_type != type_void) {
+        size_t ret_ints = 0, ret_sses = 0, ret_stack = 0;
+        asm_locate(ret_type, ret, &ret_ints, &ret_sses, &ret_stack);
+        if (!ret->num_eightbytes && is_ir_aggregate(ret_type)) {
+            num_ints++;
+        }
+    }
+    for (size_t i = 0; i < func_type->func.num_params; i++) {
+        asm_locate(asm_param_type(func_type->func.params[i]), &params[i], &num_ints, &num_sses, &stack_size);
+    }
+    return stack_size;
+}
+
+bool is_asm_ret_in_memory(Type* func_type, AsmLoc* ret) {
+    return is_ir_aggregate(func_type->func.ret) && !ret->num_eightbytes;
+}
+
+// Instructions ===
+
+typedef struct AsmFunc {
+    IrFunc* ir;
+    const char* name;
+    int32_t* reg_offsets;
+    int32_t* slot_offsets;
+    int32_t ret_offset; // of the address an aggregate result is stored at
+    IrInstr** defs; // the only instr that defines each register, or NULL
+    bool* is_value_used; // other than as the function of a call
+    const char** strs;
+} AsmFunc;
+
+THREAD_LOCAL AsmFunc asm_func;
+
+int32_t asm_reg_offset(uint32_t reg) {
+    return asm_func.reg_offsets[reg];
+}
+
+// loads an IR register into a machine register
+void asm_load(AsmReg dst, uint32_t reg) {
+    size_t size = asm_value_size(asm_func.ir->reg_types[reg]);
+    asmf("mov%c %d(%%rbp), %%%s", asm_suffix(size), asm_reg_offset(reg), asm_reg(dst, size));
+}
+
+void asm_store(AsmReg src, uint32_t reg) {
+    size_t size = asm_value_size(asm_func.ir->reg_types[reg]);
+    asmf("mov%c %%%s, %d(%%rbp)", asm_suffix(size), asm_reg(src, size), asm_reg_offset(reg));
+}
+
+// loads the size bytes at base + offset without reading past them
+void asm_load_bytes(AsmReg dst, AsmReg base, int32_t offset, size_t size) {
+    const char* base_name = asm_reg(base, 8);
+    if (size == 8 || size == 4) {
+        asmf("mov%c %d(%%%s), %%%s", asm_suffix(size), offset, base_name, asm_reg(dst, size));
+    }
+    else if (size == 2 || size == 1) {
+        asmf("movz%cl %d(%%%s), %%%s", asm_suffix(size), offset, base_name, asm_reg(dst, 4));
+    }
+    else {
+        asmf("movzbl %d(%%%s), %%%s", offset + (int32_t)size - 1, base_name, asm_reg(dst, 4));
+        for (size_t i = size - 1; i-- > 0;) {
+            asmf("shlq $8, %%%s", asm_reg(dst, 8));
+            asmf("movb %d(%%%s), %%%s", offset + (int32_t)i, base_name, asm_reg(dst, 1));
+        }
+    }
+}
+
+// stores the low size bytes of src at base + offset. src is clobbered for odd sizes
+void asm_store_bytes(AsmReg src, AsmReg base, int32_t offset, size_t size) {
+    const char* base_name = asm_reg(base, 8);
+    if (size == 8 || size == 4 || size == 2 || size == 1) {
+        asmf("mov%c %%%s, %d(%%%s)", asm_suffix(size), asm_reg(src, size), offset, base_name);
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        asmf("movb %%%s, %d(%%%s)", asm_reg(src, 1), offset + (int32_t)i, base_name);
+        if (i + 1 < size) {
+            asmf("shrq $8, %%%s", asm_reg(src, 8));
+        }
+    }
+}
+
+void asm_load_sse(int xmm, AsmReg base, int32_t offset, size_t size) {
+    asmf("%s %d(%%%s), %%xmm%d", size == 8 ? "movsd" : "movss", offset, asm_reg(base, 8), xmm);
+}
+
+void asm_store_sse(int xmm, AsmReg base, int32_t offset, size_t size) {
+    asmf("%s %%xmm%d, %d(%%%s)", size == 8 ? "movsd" : "movss", xmm, offset, asm_reg(base, 8));
+}
+
+// rax is used, and rsi, rdi and rcx for large copies
+void asm_copy(AsmReg dst, int32_t dst_offset, AsmReg src, int32_t src_offset, size_t size) {
+    if (size > ASM_MAX_UNROLLED) {
+        asmf("leaq %d(%%%s), %%rsi", src_offset, asm_reg(src, 8));
+        asmf("leaq %d(%%%s), %%rdi", dst_offset, asm_reg(dst, 8));
+        asmf("movq $%zu, %%rcx", size);
+        asmf("rep movsb");
+        return;
+    }
+    for (size_t i = 0; i < size;) {
+        size_t n = size - i >= 8 ? 8 : size - i >= 4 ? 4 : size - i >= 2 ? 2 : 1;
+        asmf("mov%c %d(%%%s), %%%s", asm_suffix(n), src_offset + (int32_t)i, asm_reg(src, 8), asm_reg(ASM_RAX, n));
+        asmf("mov%c %%%s, %d(%%%s)", asm_suffix(n), asm_reg(ASM_RAX, n), dst_offset + (int32_t)i, asm_reg(dst, 8));
+        i += n;
+    }
+}
+
+// the address is in r11. rax, rdi and rcx are used for large sizes
+void asm_zero(size_t size) {
+    if (size > ASM_MAX_UNROLLED) {
+        asmf("movq %%r11, %%rdi");
+        asmf("xorl %%eax, %%eax");
+        asmf("movq $%zu, %%rcx", size);
+        asmf("rep stosb");
+        return;
+    }
+    for (size_t i = 0; i < size;) {
+        size_t n = size - i >= 8 ? 8 : size - i >= 4 ? 4 : size - i >= 2 ? 2 : 1;
+        asmf("mov%c $0, %zu(%%r11)", asm_suffix(n), i);
+        i += n;
+    }
+}
+
+void asm_label(uint32_t block) {
+    genf(".L%s.%u:\n", asm_func.name, block);
+}
+
+void asm_jump(const char* op, uint32_t block) {
+    asmf("%s .L%s.%u", op, asm_func.name, block);
+}
+
+const char* asm_int_cmp(TokenType op) {
+    switch ((int)op) {
+    case '<':
+        return "setl";
+    case '>':
+        return "setg";
+    case TOKEN_LTEQ:
+        return "setle";
+    case TOKEN_GTEQ:
+        return "setge";
+    case TOKEN_EQ:
+        return "sete";
+    case TOKEN_NEQ:
+        return "setne";
+    default:
+        return NULL;
+    }
+}
+
+void asm_binary_float(IrInstr* instr) {
+    switch (instr->token) {
+    case '+':
+    case '-':
+    case '*':
+    case '/': {
+        const char* op = instr->token == '+' ? "addss" : instr->token == '-' ? "subss" : instr->token == '*' ? "mulss" : "divss";
+        asmf("movss %d(%%rbp), %%xmm0", asm_reg_offset(instr->a));
+        asmf("%s %d(%%rbp), %%xmm0", op, asm_reg_offset(instr->b));
+        asmf("movss %%xmm0, %d(%%rbp)", asm_reg_offset(instr->dst));
+        return;
+    }
+    case '<':
+    case TOKEN_LTEQ:
+        // a < b is b > a, which is false for NaNs like in C
+        asmf("movss %d(%%rbp), %%xmm0", asm_reg_offset(instr->b));
+        asmf("ucomiss %d(%%rbp), %%xmm0", asm_reg_offset(instr->a));
+        asmf("%s %%al", instr->token == '<' ? "seta" : "setae");
+        break;
+    default:
+        asmf("movss %d(%%rbp), %%xmm0", asm_reg_offset(instr->a));
+        asmf("ucomiss %d(%%rbp), %%xmm0", asm_reg_offset(instr->b));
+        if (instr->token == '>') {
+            asmf("seta %%al");
+        }
+        else if (instr->token == TOKEN_GTEQ) {
+            asmf("setae %%al");
+        }
+        else if (instr->token == TOKEN_EQ) {
+            asmf("sete %%al");
+            asmf("setnp %%cl");
+            asmf("andb %%cl, %%al");
+        }
+        else {
+            assert(instr->token == TOKEN_NEQ);
+            asmf("setne %%al");
+            asmf("setp %%cl");
+            asmf("orb %%cl, %%al");
+        }
+        break;
+    }
+    asmf("movzbl %%al, %%eax");
+    asmf("movl %%eax, %d(%%rbp)", asm_reg_offset(instr->dst));
+}
+
+void asm_binary(IrInstr* instr) {
+    Type* type = asm_func.ir->reg_types[instr->a];
+    if (type == type_float) {
+        asm_binary_float(instr);
+        return;
+    }
+    size_t size = asm_value_size(type);
+    int32_t b = asm_reg_offset(instr->b);
+    asm_load(ASM_RAX, instr->a);
+    const char* cmp = asm_int_cmp(instr->token);
+    if (cmp) {
+        asmf("cmp%c %d(%%rbp), %%%s", asm_suffix(size), b, asm_reg(ASM_RAX, size));
+        asmf("%s %%al", cmp);
+        asmf("movzbl %%al, %%eax");
+        asmf("movl %%eax, %d(%%rbp)", asm_reg_offset(instr->dst));
+        return;
+    }
+    switch (instr->token) {
+    case '+':
+        asmf("addl %d(%%rbp), %%eax", b);
+        break;
+    case '-':
+        asmf("subl %d(%%rbp), %%eax", b);
+        break;
+    case '*':
+        asmf("imull %d(%%rbp), %%eax", b);
+        break;
+    case '&':
+        asmf("andl %d(%%rbp), %%eax", b);
+        break;
+    case '|':
+        asmf("orl %d(%%rbp), %%eax", b);
+        break;
+    case '^':
+        asmf("xorl %d(%%rbp), %%eax", b);
+        break;
+    case '/':
+    case '%':
+        asmf("cltd");
+        asmf("idivl %d(%%rbp)", b);
+        if (instr->token == '%') {
+            asmf("movl %%edx, %%eax");
+        }
+        break;
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        asmf("movl %d(%%rbp), %%ecx", b);
+        asmf("%s %%cl, %%eax", instr->token == TOKEN_LSHIFT ? "sall" : "sarl");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    asm_store(ASM_RAX, instr->dst);
+}
+
+void asm_unary(IrInstr* instr) {
+    asm_load(ASM_RAX, instr->a);
+    switch (instr->token) {
+    case '-':
+        if (instr->type == type_float) {
+            asmf("xorl $0x80000000, %%eax");
+        }
+        else {
+            asmf("negl %%eax");
+        }
+        break;
+    case '!':
+        asmf("testl %%eax, %%eax");
+        asmf("sete %%al");
+        asmf("movzbl %%al, %%eax");
+        break;
+    case '~':
+        asmf("notl %%eax");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    asm_store(ASM_RAX, instr->dst);
+}
+
+void asm_cast(IrInstr* instr) {
+    Type* from = asm_func.ir->reg_types[instr->a];
+    Type* to = instr->type;
+    int32_t a = asm_reg_offset(instr->a);
+    if (to == type_float) {
+        if (from == type_float) {
+            asm_load(ASM_RAX, instr->a);
+        }
+        else {
+            asmf("cvtsi2ssl %d(%%rbp), %%xmm0", a);
+            asmf("movd %%xmm0, %%eax");
+        }
+    }
+    else if (from == type_float) {
+        asmf("cvttss2si %d(%%rbp), %%eax", a);
+    }
+    else if (is_asm_quad(to) && !is_asm_quad(from)) {
+        // an int converts to a pointer sign extended
+        asmf("movslq %d(%%rbp), %%rax", a);
+    }
+    else {
+        asm_load(ASM_RAX, instr->a);
+    }
+    if (to == type_char) {
+        asmf("movsbl %%al, %%eax");
+    }
+    asm_store(ASM_RAX, instr->dst);
+}
+
+// an aggregate arg or result is handled by its address, which the register holds
+void asm_call(IrInstr* instr) {
+    Type* func_type = instr->type;
+    size_t num_params = func_type->func.num_params;
+    AsmLoc* params = xmalloc(max(num_params, 1) * sizeof(AsmLoc));
+    AsmLoc ret;
+    size_t stack_size = align_up(asm_locate_call(func_type, params, &ret), 16);
+    if (stack_size) {
+        asmf("subq $%zu, %%rsp", stack_size);
+    }
+    // the args on the stack come first because large copies use the arg registers
+    for (size_t i = 0; i < num_params; i++) {
+        if (params[i].num_eightbytes) {
+            continue;
+        }
+        Type* type = asm_param_type(func_type->func.params[i]);
+        if (is_ir_aggregate(type)) {
+            asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->args[i]));
+            asm_copy(ASM_RSP, (int32_t)params[i].stack_offset, ASM_R11, 0, type->size);
+        }
+        else {
+            asm_load(ASM_RAX, instr->args[i]);
+            asmf("movq %%rax, %zu(%%rsp)", params[i].stack_offset);
+        }
+    }
+    for (size_t i = 0; i < num_params; i++) {
+        AsmLoc* loc = &params[i];
+        if (!loc->num_eightbytes) {
+            continue;
+        }
+        Type* type = asm_param_type(func_type->func.params[i]);
+        int32_t arg = asm_reg_offset(instr->args[i]);
+        if (is_ir_aggregate(type)) {
+            asmf("movq %d(%%rbp), %%r11", arg);
+            for (size_t k = 0; k < loc->num_eightbytes; k++) {
+                size_t size = min(8, type->size - 8 * k);
+                if (loc->classes[k] == ASM_CLASS_INT) {
+                    asm_load_bytes(asm_int_args[loc->regs[k]], ASM_R11, 8 * (int32_t)k, size);
+                }
+                else {
+                    asm_load_sse(loc->regs[k], ASM_R11, 8 * (int32_t)k, size);
+                }
+            }
+        }
+        else if (type == type_float) {
+            asmf("movss %d(%%rbp), %%xmm%d", arg, loc->regs[0]);
+        }
+        else {
+            asm_load(asm_int_args[loc->regs[0]], instr->args[i]);
+        }
+    }
+    if (is_asm_ret_in_memory(func_type, &ret)) {
+        asmf("movq %d(%%rbp), %%rdi", asm_reg_offset(instr->b));
+    }
+    IrInstr* def = asm_func.defs[instr->a];
+    if (def && def->op == IR_FUNC) {
+        asmf("call %s", def->name);
+    }
+    else {
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->a));
+        asmf("call *%%r11");
+    }
+    if (stack_size) {
+        asmf("addq $%zu, %%rsp", stack_size);
+    }
+    Type* ret_type = func_type->func.ret;
+    if (instr->dst) {
+        if (ret_type == type_float) {
+            asmf("movss %%xmm0, %d(%%rbp)", asm_reg_offset(instr->dst));
+        }
+        else {
+            if (ret_type == type_char) {
+                // only al is returned
+                asmf("movsbl %%al, %%eax");
+            }
+            asm_store(ASM_RAX, instr->dst);
+        }
+    }
+    else if (instr->b && ret.num_eightbytes) {
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->b));
+        for (size_t k = 0; k < ret.num_eightbytes; k++) {
+            size_t size = min(8, ret_type->size - 8 * k);
+            if (ret.classes[k] == ASM_CLASS_INT) {
+                asm_store_bytes(asm_int_rets[ret.regs[k]], ASM_R11, 8 * (int32_t)k, size);
+            }
+            else {
+                asm_store_sse(ret.regs[k], ASM_R11, 8 * (int32_t)k, size);
+            }
+        }
+    }
+    free(params);
+}
+
+void asm_ret(IrInstr* instr) {
+    Type* func_type = asm_func.ir->entity->type;
+    Type* ret_type = func_type->func.ret;
+    if (instr->a && is_ir_aggregate(ret_type)) {
+        AsmLoc ret;
+        size_t ints = 0, sses = 0, stack_size = 0;
+        asm_locate(ret_type, &ret, &ints, &sses, &stack_size);
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->a));
+        if (!ret.num_eightbytes) {
+            asmf("movq %d(%%rbp), %%r10", asm_func.ret_offset);
+            asm_copy(ASM_R10, 0, ASM_R11, 0, ret_type->size);
+            asmf("movq %d(%%rbp), %%rax", asm_func.ret_offset);
+        }
+        for (size_t k = 0; k < ret.num_eightbytes; k++) {
+            size_t size = min(8, ret_type->size - 8 * k);
+            if (ret.classes[k] == ASM_CLASS_INT) {
+                asm_load_bytes(asm_int_rets[ret.regs[k]], ASM_R11, 8 * (int32_t)k, size);
+            }
+            else {
+                asm_load_sse(ret.regs[k], ASM_R11, 8 * (int32_t)k, size);
+            }
+        }
+    }
+    else if (instr->a && ret_type == type_float) {
+        asmf("movss %d(%%rbp), %%xmm0", asm_reg_offset(instr->a));
+    }
+    else if (instr->a) {
+        asm_load(ASM_RAX, instr->a);
+    }
+    asmf("leave");
+    asmf("ret");
+}
+
+void asm_instr(uint32_t block, IrInstr* instr) {
+    uint32_t next = block + 1;
+    Type* type = instr->type;
+    switch (instr->op) {
+    case IR_NOP:
+        break;
+    case IR_INT:
+        if (is_asm_quad(type) && (instr->imm < INT32_MIN || instr->imm > INT32_MAX)) {
+            asmf("movabsq $%" PRId64 ", %%rax", instr->imm);
+            asm_store(ASM_RAX, instr->dst);
+        }
+        else {
+            int32_t imm = type == type_char ? (int8_t)instr->imm : (int32_t)instr->imm;
+            asmf("mov%c $%d, %d(%%rbp)", asm_suffix(asm_value_size(type)), imm, asm_reg_offset(instr->dst));
+        }
+        break;
+    case IR_FLOAT: {
+        float f = (float)instr->fimm;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        asmf("movl $0x%08x, %d(%%rbp)", bits, asm_reg_offset(instr->dst));
+        break;
+    }
+    case IR_STR:
+        asmf("leaq .L%s.s%zu(%%rip), %%rax", asm_func.name, buf_len(asm_func.strs));
+        buf_push(asm_func.strs, instr->name);
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_LOCAL:
+        asmf("leaq %d(%%rbp), %%rax", asm_func.slot_offsets[instr->imm]);
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_FUNC:
+        if (!asm_func.is_value_used[instr->dst]) {
+            // only called, and asm_call calls it by name
+            break;
+        }
+        asmf("leaq %s(%%rip), %%rax", instr->name);
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_GLOBAL:
+        asmf("leaq %s(%%rip), %%rax", instr->name);
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_MOV:
+        asmf("movq %d(%%rbp), %%rax", asm_reg_offset(instr->a));
+        asmf("movq %%rax, %d(%%rbp)", asm_reg_offset(instr->dst));
+        break;
+    case IR_LOAD:
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->a));
+        if (type == type_char) {
+            asmf("movsbl (%%r11), %%eax");
+        }
+        else {
+            asmf("mov%c (%%r11), %%%s", asm_suffix(type->size), asm_reg(ASM_RAX, type->size));
+        }
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_STORE:
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->a));
+        asm_load(ASM_RAX, instr->b);
+        asmf("mov%c %%%s, (%%r11)", asm_suffix(type->size), asm_reg(ASM_RAX, type->size));
+        break;
+    case IR_COPY:
+        asmf("movq %d(%%rbp), %%r10", asm_reg_offset(instr->a));
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->b));
+        asm_copy(ASM_R10, 0, ASM_R11, 0, type->size);
+        break;
+    case IR_ZERO:
+        asmf("movq %d(%%rbp), %%r11", asm_reg_offset(instr->a));
+        asm_zero(type->size);
+        break;
+    case IR_UNARY:
+        asm_unary(instr);
+        break;
+    case IR_BINARY:
+        asm_binary(instr);
+        break;
+    case IR_CAST:
+        asm_cast(instr);
+        break;
+    case IR_OFFSET:
+        asmf("movq %d(%%rbp), %%rax", asm_reg_offset(instr->a));
+        asmf("addq $%" PRId64 ", %%rax", instr->imm);
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_INDEX:
+        asmf("movq %d(%%rbp), %%rax", asm_reg_offset(instr->a));
+        asmf("movslq %d(%%rbp), %%rcx", asm_reg_offset(instr->b));
+        if (instr->imm == 1 || instr->imm == 2 || instr->imm == 4 || instr->imm == 8) {
+            asmf("leaq (%%rax,%%rcx,%" PRId64 "), %%rax", instr->imm);
+        }
+        else {
+            asmf("imulq $%" PRId64 ", %%rcx, %%rcx", instr->imm);
+            asmf("addq %%rcx, %%rax");
+        }
+        asm_store(ASM_RAX, instr->dst);
+        break;
+    case IR_CALL:
+        asm_call(instr);
+        break;
+    case IR_JUMP:
+        if (instr->target[0] != next) {
+            asm_jump("jmp", instr->target[0]);
+        }
+        break;
+    case IR_BRANCH: {
+        size_t size = asm_value_size(asm_func.ir->reg_types[instr->a]);
+        asmf("cmp%c $0, %d(%%rbp)", asm_suffix(size), asm_reg_offset(instr->a));
+        if (instr->target[1] == next) {
+            asm_jump("jne", instr->target[0]);
+        }
+        else if (instr->target[0] == next) {
+            asm_jump("je", instr->target[1]);
+        }
+        else {
+            asm_jump("jne", instr->target[0]);
+            asm_jump("jmp", instr->target[1]);
+        }
+        break;
+    }
+    case IR_RET:
+        asm_ret(instr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// the params arrive in registers or above the return address and are stored to their slots
+void asm_params(IrFunc* func) {
+    Type* func_type = func->entity->type;
+    AsmLoc* params = xmalloc(max(func->num_params, 1) * sizeof(AsmLoc));
+    AsmLoc ret;
+    asm_locate_call(func_type, params, &ret);
+    if (is_asm_ret_in_memory(func_type, &ret)) {
+        asmf("movq %%rdi, %d(%%rbp)", asm_func.ret_offset);
+    }
+    for (size_t i = 0; i < func->num_params; i++) {
+        AsmLoc* loc = &params[i];
+        Type* type = asm_param_type(func_type->func.params[i]);
+        int32_t slot = asm_func.slot_offsets[i];
+        for (size_t k = 0; k < loc->num_eightbytes; k++) {
+            size_t size = min(8, type->size - 8 * k);
+            if (loc->classes[k] == ASM_CLASS_INT) {
+                asm_store_bytes(asm_int_args[loc->regs[k]], ASM_RBP, slot + 8 * (int32_t)k, size);
+            }
+            else {
+                asm_store_sse(loc->regs[k], ASM_RBP, slot + 8 * (int32_t)k, size);
+            }
+        }
+    }
+    // the copies from the stack may use the arg registers
+    for (size_t i = 0; i < func->num_params; i++) {
+        if (!params[i].num_eightbytes) {
+            Type* type = asm_param_type(func_type->func.params[i]);
+            asm_copy(ASM_RBP, asm_func.slot_offsets[i], ASM_RBP, 16 + (int32_t)params[i].stack_offset, type->size);
+        }
+    }
+    free(params);
+}
+
+// octal escapes keep the bytes the same whatever as makes of the other escapes
+void asm_str(const char* str) {
+    genf("    .string \"");
+    for (const char* it = str; *it; it++) {
+        unsigned char c = (unsigned char)*it;
+        if (isprint(c) && c != '"' && c != '\\') {
+            genf("%c", c);
+        }
+        else {
+            genf("\\%03o", c);
+        }
+    }
+    genf("\"\n");
+}
+
+// the frame holds the slots, the address of an aggregate result and the registers that are used
+void asm_frame(IrFunc* func, size_t* frame_size) {
+    size_t size = 0;
+    asm_func.slot_offsets = xmalloc(max(func->num_slots, 1) * sizeof(int32_t));
+    for (size_t i = 0; i < func->num_slots; i++) {
+        Type* type = func->slots[i].type;
+        size = align_up(size + type->size, max(type->align, 1));
+        asm_func.slot_offsets[i] = -(int32_t)size;
+    }
+    size = align_up(size, 8) + 8;
+    asm_func.ret_offset = -(int32_t)size;
+    asm_func.reg_offsets = xcalloc(func->num_regs, sizeof(int32_t));
+    asm_func.defs = xcalloc(func->num_regs, sizeof(IrInstr*));
+    asm_func.is_value_used = xcalloc(func->num_regs, sizeof(bool));
+    bool* is_defined = xcalloc(func->num_regs, sizeof(bool));
+    for (size_t i = 0; i < func->num_instrs; i++) {
+        IrInstr* instr = &func->instrs[i];
+        if (instr->op == IR_NOP) {
+            continue;
+        }
+        uint32_t regs[3] = { instr->dst, instr->a, instr->b };
+        for (size_t k = 0; k < 3 + ir_num_args(instr); k++) {
+            uint32_t reg = k < 3 ? regs[k] : instr->args[k - 3];
+            if (reg && !asm_func.reg_offsets[reg]) {
+                size += 8;
+                asm_func.reg_offsets[reg] = -(int32_t)size;
+            }
+            asm_func.is_value_used[reg] |= k > 0 && !(k == 1 && instr->op == IR_CALL);
+        }
+        if (instr->dst) {
+            asm_func.defs[instr->dst] = is_defined[instr->dst] ? NULL : instr;
+            is_defined[instr->dst] = true;
+        }
+    }
+    free(is_defined);
+    *frame_size = align_up(size, 16);
+}
+
+void asm_def_func(Entity* entity) {
+    IrFunc* func = lower_func(entity);
+    asm_func = (AsmFunc) { .ir = func, .name = entity->name };
+    size_t frame_size;
+    asm_frame(func, &frame_size);
+    genf("    .text\n");
+    genf("    .globl %s\n", entity->name);
+    genf("    .type %s, @function\n", entity->name);
+    genf("%s:\n", entity->name);
+    asmf("pushq %%rbp");
+    asmf("movq %%rsp, %%rbp");
+    if (frame_size) {
+        asmf("subq $%zu, %%rsp", frame_size);
+    }
+    asm_params(func);
+    for (uint32_t b = 0; b < func->num_blocks; b++) {
+        asm_label(b);
+        for (uint32_t i = func->blocks[b].start; i < func->blocks[b].end; i++) {
+            asm_instr(b, &func->instrs[i]);
+        }
+    }
+    genf("    .size %s, .-%s\n", entity->name, entity->name);
+    if (asm_func.strs) {
+        genf("    .section .rodata\n");
+        for (size_t i = 0; i < buf_len(asm_func.strs); i++) {
+            genf(".L%s.s%zu:\n", entity->name, i);
+            asm_str(asm_func.strs[i]);
+        }
+    }
+    buf_free(asm_func.strs);
+    free(asm_func.defs);
+    free(asm_func.is_value_used);
+    free(asm_func.reg_offsets);
+    free(asm_func.slot_offsets);
+    asm_func = (AsmFunc) { 0 };
+    ir_free_func();
+}
+
+// Data ===
+
+// zeros are merged into one .zero directive
+size_t asm_zeros = 0;
+
+void asm_flush_zeros(void) {
+    if (asm_zeros) {
+        genf("    .zero %zu\n", asm_zeros);
+        asm_zeros = 0;
+    }
+}
+
+void asm_val(Val val, Type* type);
+
+// items are laid out as in gen_val_aggregate, and the last one given of a union is kept
+void asm_val_aggregate(Val val, Type* type) {
+    if (type->type == TYPE_ARRAY) {
+        for (size_t i = 0; i < type->array.size; i++) {
+            asm_val(val.items[i], type->array.base);
+        }
+        return;
+    }
+    size_t pos = 0;
+    if (type->type == TYPE_UNION) {
+        for (size_t i = type->aggregate.num_fields; i-- > 0;) {
+            if (val.items[i].kind != VAL_NONE) {
+                asm_val(val.items[i], type->aggregate.fields[i].type);
+                pos = type->aggregate.fields[i].type->size;
+                break;
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            TypeField field = type->aggregate.fields[i];
+            asm_zeros += field.offset - pos;
+            asm_val(val.items[i], field.type);
+            pos = field.offset + field.type->size;
+        }
+    }
+    asm_zeros += type->size - pos;
+}
+
+void asm_val(Val val, Type* type) {
+    if (val.kind == VAL_NONE) {
+        asm_zeros += type->size;
+        return;
+    }
+    if (val.kind == VAL_AGGREGATE) {
+        asm_val_aggregate(val, type);
+        return;
+    }
+    asm_flush_zeros();
+    int64_t i = val.kind == VAL_FLOAT ? (int64_t)val.f : val.kind == VAL_NULL ? 0 : val.i;
+    switch (type->type) {
+    case TYPE_CHAR:
+        genf("    .byte %d\n", (int8_t)i);
+        break;
+    case TYPE_FLOAT: {
+        float f = val.kind == VAL_FLOAT ? (float)val.f : (float)i;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        genf("    .long 0x%08x\n", bits);
+        break;
+    }
+    case TYPE_PTR:
+    case TYPE_FUNC:
+        genf("    .quad %" PRId64 "\n", i);
+        break;
+    default:
+        genf("    .long %d\n", (int32_t)i);
+        break;
+    }
+}
+
+// vars are defined in .data or .bss and consts in .rodata, with the symbol global like in C
+void asm_def_data(Entity* entity) {
+    Type* type = entity->type;
+    Expr* expr = entity->decl->type == DECL_CONST ? entity->decl->const_decl.expr : entity->decl->var_decl.expr;
+    bool is_str = entity->val.kind == VAL_NONE && expr && expr->type == EXPR_STR;
+    if (entity->e_type == ENTITY_CONST && entity->val.kind == VAL_NONE && !is_str) {
+        error_at("GEN ERROR", entity->info->loc.src_name, entity->info->loc.line_num, "the asm backend cannot define the const %s", entity->name);
+        exit_with_diags();
+    }
+    if (entity->e_type != ENTITY_CONST) {
+        genf("    %s\n", expr ? ".data" : ".bss");
+    }
+    else {
+        // the address of a string is relocated when a PIE is loaded, so it is not in .rodata
+        genf("    .section %s\n", is_str ? ".data.rel.ro,\"aw\"" : ".rodata");
+    }
+    genf("    .globl %s\n", entity->name);
+    genf("    .type %s, @object\n", entity->name);
+    genf("    .size %s, %zu\n", entity->name, type->size);
+    genf("    .balign %zu\n", max(type->align, 1));
+    genf("%s:\n", entity->name);
+    if (is_str) {
+        genf("    .quad .L%s.s0\n", entity->name);
+        genf(".L%s.s0:\n", entity->name);
+        asm_str(expr->str_expr.str_val);
+        return;
+    }
+    if (expr) {
+        asm_val(entity->val, type);
+    }
+    else {
+        asm_zeros += type->size;
+    }
+    asm_flush_zeros();
+}
+
+void asm_decl_def(Entity* entity) {
+    if (entity->e_type == ENTITY_ENUM_CONST || !entity->decl) {
+        return;
+    }
+    switch (entity->decl->type) {
+    case DECL_CONST:
+    case DECL_VAR:
+        asm_def_data(entity);
+        genf("\n");
+        break;
+    case DECL_FUNC:
+        asm_def_func(entity);
+        genf("\n");
+        break;
+    default:
+        break;
+    }
+}
+
+#undef asmf
@@ -21,6 +21,15 @@ void* ast_dup(const void* ast, size_t size) {
 
 #define _ast_dup(x) (ast_dup(x, num_##x * sizeof(*x)))
 
+// exprs and stmnts nested deeper than this are rejected with an error instead of
+// overflowing the C stack. left associative chains of binary exprs are walked
+// iteratively and do not count towards the limit
+size_t max_nesting_depth = 1 << 10;
+
+// stack for walking left spines of binary exprs, one per thread. users only touch the
+// part above the length they found on entry and restore it before returning
+THREAD_LOCAL Expr** expr_stack = NULL;
+
 typedef struct SrcLoc {
     const char* src_name;
     size_t line_num;
@@ -65,7 +74,6 @@ typedef struct PtrTypeSpec {
 typedef struct TypeSpec {
     TypeSpecType type;
     Type* resolved_type;
-    SrcLoc loc;
     union {
         NameTypeSpec name;
         FuncTypeSpec func;
@@ -80,31 +88,6 @@ TypeSpec* typespec_alloc(TypeSpecType type) {
     TypeSpec* typespec = arena_alloc(&ast_arena, sizeof(TypeSpec));
     memset(typespec, 0, sizeof(TypeSpec));
     typespec->type = type;
-    typespec->loc = (SrcLoc) { src_path, line_num };
-    return typespec;
-}
-
-TypeSpec* typespec_name(const char* name) {
-    TypeSpec* typespec = typespec_alloc(TYPESPEC_NAME);
-    typespec->name = (NameTypeSpec) { .name=name };
-    return typespec;
-}
-
-TypeSpec* typespec_func(TypeSpec* ret_type, size_t num_params, TypeSpec** params) {
-    TypeSpec* typespec = typespec_alloc(TYPESPEC_FUNC);
-    typespec->func = (FuncTypeSpec) { .ret_type=ret_type, .num_params=num_params, .params=_ast_dup(params) };
-    return typespec;
-}
-
-TypeSpec* typespec_array(TypeSpec* base, Expr* size) {
-    TypeSpec* typespec = typespec_alloc(TYPESPEC_ARRAY);
-    typespec->array = (ArrayTypeSpec) {.base=base, .size=size};
-    return typespec;
-}
-
-TypeSpec* typespec_ptr(TypeSpec* base) {
-    TypeSpec* typespec = typespec_alloc(TYPESPEC_PTR);
-    typespec->ptr = (PtrTypeSpec) {.base=base};
     return typespec;
 }
 
@@ -150,6 +133,7 @@ typedef struct AggregateItem {
     const char* name;
     TypeSpec* type;
     Expr* expr;
+    SrcLoc loc;
 } AggregateItem;
 
 typedef struct AggregateDecl {
@@ -160,13 +144,17 @@ typedef struct AggregateDecl {
 typedef struct FuncParam {
     const char* name;
     TypeSpec* type;
+    SrcLoc loc;
 } FuncParam;
 
 typedef struct FuncDecl {
     size_t num_params;
     FuncParam* params;
     TypeSpec* ret_type;
+    SrcLoc ret_loc;
     BlockStmnt block;
+    const char* lazy_body; // start of the skipped body until it is parsed on demand
+    size_t lazy_line_num;
 } FuncDecl;
 
 // --------------------------------------------------------
@@ -175,6 +163,7 @@ struct Decl {
     DeclType type;
     const char* name;
     SrcLoc loc;
+    uint64_t src_hash; // of the source text of a top level decl
     union {
         EnumDecl enum_decl;
         AggregateDecl aggregate_decl;
@@ -361,11 +350,32 @@ typedef struct SizeofExpr {
 
 // --------------------------------------------------------
 
+typedef enum ValKind {
+    VAL_NONE, // not known at compile time
+    VAL_INT,
+    VAL_CHAR,
+    VAL_FLOAT,
+    VAL_NULL,
+    VAL_AGGREGATE
+} ValKind;
+
+typedef struct Val Val;
+
+// a value computed at compile time. an aggregate has an item for each field or array element
+// and the items left out of its compound expression are VAL_NONE, which stands for zero
+struct Val {
+    ValKind kind;
+    union {
+        int64_t i;
+        double f;
+        Val* items;
+    };
+};
+
 struct Expr {
     ExprType type;
     Type* resolved_type;
-    bool is_folded;
-    int64_t folded_value;
+    Val folded_val;
     SrcLoc loc;
     union {
         TernaryExpr ternary_expr;
@@ -508,6 +518,121 @@ Expr* expr_sizeof_expr(Expr* s_expr) {
 
 // ========================================================
 
+// TypeSpec interning ===================================
+
+// Structurally identical typespecs are hash consed so that each distinct spelling
+// is resolved only once. A shared typespec has no location, its uses keep their own.
+// Array typespecs are only shared when their size is an int literal.
+
+typedef struct InternTypeSpec {
+    TypeSpec* typespec;
+    struct InternTypeSpec* next;
+} InternTypeSpec;
+
+Map interned_typespecs;
+TypeSpec** ordered_typespecs = NULL; // in the order they were first parsed
+size_t typespec_intern_hits = 0;
+
+uint64_t typespec_hash(const TypeSpec* typespec) {
+    uint64_t hash = 14695981039346656037ull;
+    hash ^= typespec->type;
+    hash *= 1099511628211;
+    switch (typespec->type) {
+    case TYPESPEC_NAME:
+        hash ^= ptr_hash((void*)typespec->name.name);
+        hash *= 1099511628211;
+        break;
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < typespec->func.num_params; i++) {
+            hash ^= ptr_hash(typespec->func.params[i]);
+            hash *= 1099511628211;
+        }
+        hash ^= ptr_hash(typespec->func.ret_type);
+        hash *= 1099511628211;
+        break;
+    case TYPESPEC_ARRAY:
+        hash ^= ptr_hash(typespec->array.base);
+        hash *= 1099511628211;
+        hash ^= ptr_hash((void*)typespec->array.size->int_expr.int_val);
+        hash *= 1099511628211;
+        break;
+    case TYPESPEC_PTR:
+        hash ^= ptr_hash(typespec->ptr.base);
+        hash *= 1099511628211;
+        break;
+    default:
+        assert(0);
+    }
+    return hash | 1;
+}
+
+bool typespec_equals(const TypeSpec* a, const TypeSpec* b) {
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+    case TYPESPEC_NAME:
+        return a->name.name == b->name.name;
+    case TYPESPEC_FUNC:
+        return a->func.ret_type == b->func.ret_type && a->func.num_params == b->func.num_params
+            && memcmp(a->func.params, b->func.params, a->func.num_params * sizeof(TypeSpec*)) == 0;
+    case TYPESPEC_ARRAY:
+        return a->array.base == b->array.base && a->array.size->int_expr.int_val == b->array.size->int_expr.int_val;
+    case TYPESPEC_PTR:
+        return a->ptr.base == b->ptr.base;
+    default:
+        assert(0);
+        return false;
+    }
+}
+
+TypeSpec* typespec_intern(const TypeSpec* key) {
+    uint64_t hash = typespec_hash(key);
+    InternTypeSpec* intern = map_get_hashed(&interned_typespecs, (void*)hash, hash);
+    for (InternTypeSpec* it = intern; it; it = it->next) {
+        if (typespec_equals(it->typespec, key)) {
+            typespec_intern_hits++;
+            return it->typespec;
+        }
+    }
+    TypeSpec* typespec = ast_dup(key, sizeof(TypeSpec));
+    if (typespec->type == TYPESPEC_FUNC) {
+        typespec->func.params = ast_dup(key->func.params, key->func.num_params * sizeof(TypeSpec*));
+    }
+    InternTypeSpec* new_intern = arena_alloc(&ast_arena, sizeof(InternTypeSpec));
+    new_intern->typespec = typespec;
+    new_intern->next = intern;
+    map_put_hashed(&interned_typespecs, (void*)hash, new_intern, hash);
+    buf_push(ordered_typespecs, typespec);
+    return typespec;
+}
+
+TypeSpec* typespec_name(const char* name) {
+    return typespec_intern(&(TypeSpec) { .type = TYPESPEC_NAME, .name = { name } });
+}
+
+TypeSpec* typespec_func(TypeSpec* ret_type, size_t num_params, TypeSpec** params) {
+    return typespec_intern(&(TypeSpec) { 
+        .type = TYPESPEC_FUNC, 
+        .func = { .ret_type = ret_type, .num_params = num_params, .params = params } 
+    });
+}
+
+TypeSpec* typespec_array(TypeSpec* base, Expr* size) {
+    if (size->type == EXPR_INT) {
+        return typespec_intern(&(TypeSpec) { .type = TYPESPEC_ARRAY, .array = { base, size } });
+    }
+    TypeSpec* typespec = typespec_alloc(TYPESPEC_ARRAY);
+    typespec->array = (ArrayTypeSpec) {.base=base, .size=size};
+    return typespec;
+}
+
+TypeSpec* typespec_ptr(TypeSpec* base) {
+    return typespec_intern(&(TypeSpec) { .type = TYPESPEC_PTR, .ptr = { base } });
+}
+
+// ========================================================
+
 // Statements =============================================
 
 typedef enum StmntType {
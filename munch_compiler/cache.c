@@ -0,0 +1,222 @@
+// Incremental builds ===
+
+// An incremental build keeps the hash of the source of each global declaration, the globals it
+// referenced and the C generated for it in a cache file next to the output. A declaration is
+// clean when its hash is unchanged and everything it referenced is clean. Clean function bodies
+// are not parsed, resolved nor generated again, and the cached C of every clean entity is reused.
+// Global signatures, types and consts are always resolved since dirty code may depend on them.
+
+#define CACHE_MAGIC "munch-cache 1"
+
+// the cached C of a function depends on the backend that generated it
+char* cache_header(void) {
+    return strf("%s %s\n", CACHE_MAGIC, backend_names[gen_backend]);
+}
+
+const char* cache_path = NULL;
+Map cached_entities; // name -> CachedEntity
+size_t num_reused_entities = 0;
+
+const char* read_cache_name(const char** it) {
+    const char* start = *it;
+    while (**it && **it != ' ' && **it != '\n') {
+        (*it)++;
+    }
+    return start == *it ? NULL : str_intern_range(start, *it);
+}
+
+bool read_cache_uint(const char** it, int base, uint64_t* val) {
+    char* end;
+    *val = strtoull(*it, &end, base);
+    if (end == *it) {
+        return false;
+    }
+    *it = end;
+    return true;
+}
+
+bool skip_cache_char(const char** it, char c) {
+    if (**it != c) {
+        return false;
+    }
+    (*it)++;
+    return true;
+}
+
+// a missing or malformed cache only means a full build
+bool read_cache(const char* path) {
+    char* src = read_file(path);
+    char* header = cache_header();
+    if (!src || strncmp(src, header, strlen(header)) != 0) {
+        return false;
+    }
+    const char* it = src + strlen(header);
+    const char* end = it + strlen(it);
+    const char* entity_kwrd = "entity ";
+    while (*it) {
+        if (strncmp(it, entity_kwrd, strlen(entity_kwrd)) != 0) {
+            return false;
+        }
+        it += strlen(entity_kwrd);
+        CachedEntity* cached = xcalloc(1, sizeof(CachedEntity));
+        uint64_t num_deps, forward_len, def_len;
+        if (!(cached->name = read_cache_name(&it)) || !skip_cache_char(&it, ' ')
+            || !read_cache_uint(&it, 16, &cached->src_hash) || !skip_cache_char(&it, ' ')
+            || !read_cache_uint(&it, 10, &num_deps) || !skip_cache_char(&it, ' ')
+            || !read_cache_uint(&it, 10, &forward_len) || !skip_cache_char(&it, ' ')
+            || !read_cache_uint(&it, 10, &def_len) || !skip_cache_char(&it, '\n')) {
+            return false;
+        }
+        for (uint64_t i = 0; i < num_deps; i++) {
+            uint64_t kinds;
+            const char* name;
+            if (!read_cache_uint(&it, 10, &kinds) || !skip_cache_char(&it, ' ')
+                || !(name = read_cache_name(&it)) || !skip_cache_char(&it, '\n')) {
+                return false;
+            }
+            buf_push(cached->deps, ((CachedDep) { name, (int)kinds }));
+        }
+        if ((uint64_t)(end - it) < forward_len + def_len + 1) {
+            return false;
+        }
+        cached->forward = it;
+        cached->forward_len = forward_len;
+        cached->def = it + forward_len;
+        cached->def_len = def_len;
+        it += forward_len + def_len;
+        if (!skip_cache_char(&it, '\n')) {
+            return false;
+        }
+        map_put(&cached_entities, (void*)cached->name, cached);
+    }
+    return true;
+}
+
+void mark_dirty(Entity*** dirty, Entity* entity) {
+    entity->info->cached = NULL;
+    buf_push(*dirty, entity);
+}
+
+// entities with an unchanged hash start out clean. dirtiness then spreads to everything that
+// referenced a dirty or a removed global in the last build
+void mark_clean_entities(void) {
+    Entity** dirty = NULL;
+    Map dependents = { 0 }; // entity -> Entity** of clean candidates that referenced it
+    for (size_t i = 0; i < buf_len(global_entity_list); i++) {
+        Entity* entity = global_entity_list[i];
+        if (!entity->decl) {
+            continue;
+        }
+        CachedEntity* cached = map_get(&cached_entities, (void*)entity->name);
+        if (!cached || cached->src_hash != entity->info->src_hash) {
+            buf_push(dirty, entity);
+            continue;
+        }
+        entity->info->cached = cached;
+    }
+    for (size_t i = 0; i < buf_len(global_entity_list); i++) {
+        Entity* entity = global_entity_list[i];
+        if (!entity->info->cached) {
+            continue;
+        }
+        for (size_t k = 0; k < buf_len(entity->info->cached->deps); k++) {
+            Entity* dep = get_entity(entity->info->cached->deps[k].name);
+            if (!dep) {
+                mark_dirty(&dirty, entity);
+                break;
+            }
+            Entity** users = map_get(&dependents, dep);
+            buf_push(users, entity);
+            map_put(&dependents, dep, users);
+        }
+    }
+    for (size_t i = 0; i < buf_len(dirty); i++) {
+        Entity** users = map_get(&dependents, dirty[i]);
+        for (size_t k = 0; k < buf_len(users); k++) {
+            if (users[k]->info->cached) {
+                mark_dirty(&dirty, users[k]);
+            }
+        }
+    }
+    for (KeyValPair* it = dependents.pairs; it != dependents.pairs + dependents.cap; it++) {
+        if (it->key) {
+            Entity** users = it->val;
+            buf_free(users);
+        }
+    }
+    free(dependents.pairs);
+    buf_free(dirty);
+    // clean bodies are not resolved again, so the usage they recorded last time is replayed
+    num_reused_entities = 0;
+    for (size_t i = 0; i < buf_len(global_entity_list); i++) {
+        Entity* entity = global_entity_list[i];
+        if (!entity->info->cached) {
+            continue;
+        }
+        num_reused_entities++;
+        for (size_t k = 0; k < buf_len(entity->info->cached->deps); k++) {
+            CachedDep dep = entity->info->cached->deps[k];
+            Entity* dep_entity = get_entity(dep.name);
+            if (dep.kinds & DEP_USE) {
+                dep_entity->is_used = true;
+            }
+            if (dep.kinds & DEP_SET) {
+                dep_entity->is_set = true;
+            }
+        }
+    }
+}
+
+void load_cache(void) {
+    if (cache_path && read_cache(cache_path)) {
+        mark_clean_entities();
+    }
+}
+
+void write_cache_deps(char** buf, Entity* entity) {
+    if (entity->info->cached) {
+        CachedDep* deps = entity->info->cached->deps;
+        buf_printf(*buf, " %zu", buf_len(deps));
+        buf_printf(*buf, " %zu %zu\n", entity->info->forward_end - entity->info->forward_start, entity->info->def_end - entity->info->def_start);
+        for (size_t i = 0; i < buf_len(deps); i++) {
+            buf_printf(*buf, "%d %s\n", deps[i].kinds, deps[i].name);
+        }
+        return;
+    }
+    // merges repeated references to the same global
+    Map index = { 0 };
+    EntityDep* deps = NULL;
+    for (size_t i = 0; i < buf_len(entity->info->deps); i++) {
+        EntityDep dep = entity->info->deps[i];
+        size_t k = (size_t)map_get(&index, dep.entity);
+        if (k) {
+            deps[k - 1].kinds |= dep.kinds;
+        }
+        else {
+            buf_push(deps, dep);
+            map_put(&index, dep.entity, (void*)buf_len(deps));
+        }
+    }
+    buf_printf(*buf, " %zu", buf_len(deps));
+    buf_printf(*buf, " %zu %zu\n", entity->info->forward_end - entity->info->forward_start, entity->info->def_end - entity->info->def_start);
+    for (size_t i = 0; i < buf_len(deps); i++) {
+        buf_printf(*buf, "%d %s\n", deps[i].kinds, deps[i].entity->name);
+    }
+    buf_free(deps);
+    free(index.pairs);
+}
+
+bool write_cache(const char* path) {
+    char* buf = NULL;
+    buf_printf(buf, "%s", cache_header());
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        Entity* entity = ordered_entities[i];
+        buf_printf(buf, "entity %s %" PRIx64, entity->name, entity->info->src_hash);
+        write_cache_deps(&buf, entity);
+        buf_printf(buf, "%.*s", (int)(entity->info->forward_end - entity->info->forward_start), gen_buf + entity->info->forward_start);
+        buf_printf(buf, "%.*s\n", (int)(entity->info->def_end - entity->info->def_start), gen_buf + entity->info->def_start);
+    }
+    bool status = write_file(path, buf, buf_len(buf));
+    buf_free(buf);
+    return status;
+}
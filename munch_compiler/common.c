@@ -2,7 +2,6 @@ void* xmalloc(size_t size) {
     void* p = malloc(size);
     if (!p) {
         perror("xmalloc fail!");
-        getchar();
         exit(2001);
     }
     return p;
@@ -12,7 +11,6 @@ void* xcalloc(size_t nitems, size_t size) {
     void* p = calloc(nitems, size);
     if (!p) {
         perror("xcalloc fail!");
-        getchar();
         exit(2002);
     }
     return p;
@@ -22,43 +20,11 @@ void* xrealloc(void* block, size_t size) {
     void* p = realloc(block, size);
     if (!p) {
         perror("xrealloc fail");
-        getchar();
         exit(2003);
     }
     return p;
 }
 
-void fatal(const char* fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    printf("FATAL: ");
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
-    getchar();
-    exit(1);
-}
-
-void warning(const char* fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    printf("WARNING: ");
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
-}
-
-void basic_syntax_error(const char* fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    printf("SYNTAX ERROR: ");
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
-    getchar();
-    exit(1);
-}
-
 char* read_file(const char* path) {
     FILE* fp = fopen(path, "rb");
     if (!fp) {
@@ -78,37 +44,121 @@ char* read_file(const char* path) {
     return buf;
 }
 
-bool write_file(const char* path, const char* buf, size_t len) {
-    FILE* fp = fopen(path, "w");
+#define FILE_CMP_CHUNK_SIZE (1 << 16)
+
+// reads the file the same way write_file writes it
+bool file_equals(const char* path, const char* buf, size_t len) {
+    FILE* fp = fopen(path, "r");
     if (!fp) {
         return false;
     }
-    if (fwrite(buf, len, 1, fp) != 1) {
+#if !defined(_WIN32)
+    // text and binary streams are the same here, so a size mismatch is found without reading
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) != (long)len) {
         fclose(fp);
         return false;
     }
+    rewind(fp);
+#endif
+    char* chunk = xmalloc(FILE_CMP_CHUNK_SIZE);
+    bool equal = true;
+    for (size_t pos = 0; equal && pos < len;) {
+        size_t n = fread(chunk, 1, FILE_CMP_CHUNK_SIZE, fp);
+        equal = n && n <= len - pos && memcmp(chunk, buf + pos, n) == 0;
+        pos += n;
+    }
+    equal = equal && fgetc(fp) == EOF;
+    free(chunk);
     fclose(fp);
-    return true;
+    return equal;
 }
 
-char* change_ext(const char* path, const char* new_ext) {
-    char* buf = NULL;
+// an unchanged file is left alone, so its mtime does not trigger rebuilds of what depends on it.
+// otherwise the contents go to a temporary file that is renamed over the old one, so a reader
+// never sees a half written file
+bool write_file(const char* path, const char* buf, size_t len) {
+    if (file_equals(path, buf, len)) {
+        return true;
+    }
     size_t path_len = strlen(path);
-    size_t new_ext_len = strlen(new_ext);
-    long idx = -1;
-    for (size_t i = path_len; i > 0; i--) {
+    char* tmp_path = xmalloc(path_len + 5);
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    FILE* fp = fopen(tmp_path, "w");
+    if (!fp) {
+        free(tmp_path);
+        return false;
+    }
+    bool status = len == 0 || fwrite(buf, len, 1, fp) == 1;
+    status = fclose(fp) == 0 && status;
+#if defined(_WIN32)
+    // rename does not replace an existing file here
+    if (status) {
+        remove(path);
+    }
+#endif
+    status = status && rename(tmp_path, path) == 0;
+    if (!status) {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return status;
+}
+
+#undef FILE_CMP_CHUNK_SIZE
+
+// seconds since an arbitrary point
+double time_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a command whose stdin is written through the returned stream
+FILE* open_command(const char* cmd) {
+#if defined(_WIN32)
+    return _popen(cmd, "w");
+#else
+    // a command that exits early must not kill the writer
+    signal(SIGPIPE, SIG_IGN);
+    return popen(cmd, "w");
+#endif
+}
+
+// waits for the command and returns its exit status
+int close_command(FILE* fp) {
+#if defined(_WIN32)
+    return _pclose(fp);
+#else
+    int status = pclose(fp);
+    if (status == -1) {
+        return 1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#endif
+}
+
+// the length of path without the extension of its file name and the dot before it
+size_t path_stem_len(const char* path) {
+    size_t path_len = strlen(path);
+    for (size_t i = path_len; i > 0 && path[i - 1] != '/' && path[i - 1] != '\\'; i--) {
         if (path[i - 1] == '.') {
-            idx = i;
-            break;
+            return i - 1;
         }
     }
-    if (idx == -1) {
-        return NULL;
-    }
-    buf = xmalloc(idx + new_ext_len + 1);
-    memcpy(buf, path, path_len);
-    memcpy(buf + idx, new_ext, new_ext_len);
-    buf[idx + new_ext_len] = 0;
+    return path_len;
+}
+
+// a path without an extension gets new_ext appended
+char* change_ext(const char* path, const char* new_ext) {
+    size_t stem_len = path_stem_len(path);
+    size_t new_ext_len = strlen(new_ext);
+    char* buf = xmalloc(stem_len + new_ext_len + 2);
+    memcpy(buf, path, stem_len);
+    buf[stem_len] = '.';
+    memcpy(buf + stem_len + 1, new_ext, new_ext_len);
+    buf[stem_len + new_ext_len + 1] = 0;
     return buf;
 }
 
@@ -124,6 +174,10 @@ typedef struct BufHdr {
 #define max(x, y) ((x) > (y) ? (x) : (y))
 #endif
 
+#ifndef min
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#endif
+
 #define _buf_hdr(b) ((BufHdr*)((char*)(b) -  offsetof(BufHdr, buf)))
 #define buf_len(b) ((b) ? _buf_hdr(b)->len : 0)
 #define buf_cap(b) ((b) ? _buf_hdr(b)->cap : 0)
@@ -134,6 +188,7 @@ typedef struct BufHdr {
 #define buf_push(b, e) (_buf_fit(b, 1), (b)[buf_len(b)] = (e), _buf_hdr(b)->len++)
 #define buf_end(b) (b + buf_len(b))
 #define buf_free(b) ((b) ? (free(_buf_hdr(b)), (b) = NULL) : 0)
+#define buf_clear(b) ((b) ? _buf_hdr(b)->len = 0 : 0)
 
 void* _buf_grow(const void* buf, size_t new_len, size_t elem_size) {
     assert(buf_cap(buf) <= (SIZE_MAX - 1) / 2);
@@ -190,6 +245,208 @@ char* _buf_printf(char* buf, const char* fmt, ...) {
         (buf) = _buf_printf((buf), fmt, ##__VA_ARGS__); \
     } while(0) \
 
+// Threads ===
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// worker threads use pthreads. elsewhere parallel_for runs everything on the calling thread
+#if defined(_WIN32)
+#define HAS_THREADS 0
+#else
+#define HAS_THREADS 1
+#endif
+
+#if HAS_THREADS
+typedef pthread_mutex_t Mutex;
+#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define atomic_add(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#define atomic_set(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+// for a pointer to data that is filled before it is published
+#define atomic_get_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_publish_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+typedef int Mutex;
+#define MUTEX_INIT 0
+#define mutex_lock(m) ((void)(m))
+#define mutex_unlock(m) ((void)(m))
+#define atomic_add(p, n) ((*(p) += (n)) - (n))
+#define atomic_set(p, v) (*(p) = (v))
+#define atomic_get_ptr(p) (*(p))
+#define atomic_publish_ptr(p, v) (*(p) = (v))
+#endif
+
+size_t num_jobs = 1;
+
+size_t default_num_jobs(void) {
+#if HAS_THREADS
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#else
+    return 1;
+#endif
+}
+
+// number of threads parallel_for uses for num_items items
+size_t parallel_threads(size_t num_items) {
+    size_t n = num_jobs < num_items ? num_jobs : num_items;
+    return HAS_THREADS && n > 1 ? n : 1;
+}
+
+typedef struct WorkQueue {
+    void(*work)(size_t worker, size_t item);
+    size_t num_items;
+    size_t next_item;
+    size_t next_worker;
+} WorkQueue;
+
+#if HAS_THREADS
+void* work_queue_thread(void* arg) {
+    WorkQueue* queue = arg;
+    size_t worker = atomic_add(&queue->next_worker, 1);
+    for (size_t item = atomic_add(&queue->next_item, 1); item < queue->num_items; item = atomic_add(&queue->next_item, 1)) {
+        queue->work(worker, item);
+    }
+    return NULL;
+}
+#endif
+
+// calls work on every item from parallel_threads(num_items) threads. items are handed out in
+// order, and work must only write to its own item and to thread local state
+void parallel_for(size_t num_items, void(*work)(size_t worker, size_t item)) {
+    WorkQueue queue = { work, num_items, 0, 0 };
+    size_t num_threads = parallel_threads(num_items);
+#if HAS_THREADS
+    if (num_threads > 1) {
+        pthread_t* threads = xmalloc(num_threads * sizeof(pthread_t));
+        for (size_t i = 0; i < num_threads; i++) {
+            if (pthread_create(threads + i, NULL, work_queue_thread, &queue)) {
+                perror("pthread_create fail");
+                exit(2004);
+            }
+        }
+        for (size_t i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < num_items; i++) {
+        work(0, i);
+    }
+}
+
+// Diagnostics ===
+
+typedef struct Diag {
+    const char* kind;
+    const char* src_name;
+    size_t line_num;
+    char* msg;
+} Diag;
+
+// each thread collects its own diagnostics. see take_diags and merge_diags
+THREAD_LOCAL Diag* diags = NULL;
+THREAD_LOCAL size_t num_errors = 0;
+size_t max_errors = 20; // 0 means no limit
+bool defer_error_limit = false;
+
+void vpush_diag(const char* kind, const char* src_name, size_t line_num, const char* fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy) + 1;
+    va_end(copy);
+    char* msg = xmalloc(len * sizeof(char));
+    vsnprintf(msg, len, fmt, args);
+    buf_push(diags, ((Diag) { kind, src_name, line_num, msg }));
+}
+
+void report_diags(void) {
+    for (size_t i = 0; i < buf_len(diags); i++) {
+        Diag* diag = diags + i;
+        if (diag->src_name) {
+            printf("%s(%s:%zu) %s\n", diag->kind, diag->src_name, diag->line_num, diag->msg);
+        }
+        else {
+            printf("%s: %s\n", diag->kind, diag->msg);
+        }
+        free(diag->msg);
+    }
+    if (diags) {
+        _buf_hdr(diags)->len = 0;
+    }
+}
+
+void exit_with_diags(void) {
+    report_diags();
+    printf("Compilation failed with %zu error(s)\n", num_errors);
+    exit(1);
+}
+
+void verror_at(const char* kind, const char* src_name, size_t line_num, const char* fmt, va_list args) {
+    vpush_diag(kind, src_name ? src_name : "", line_num, fmt, args);
+    num_errors++;
+    if (max_errors && num_errors >= max_errors && !defer_error_limit) {
+        buf_push(diags, ((Diag) { "FATAL", NULL, 0, strf("Too many errors. Stopping after %zu", num_errors) }));
+        exit_with_diags();
+    }
+}
+
+// records an error and bails out once the error limit is reached
+void error_at(const char* kind, const char* src_name, size_t line_num, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    verror_at(kind, src_name, line_num, fmt, args);
+    va_end(args);
+}
+
+typedef struct DiagSet {
+    Diag* diags;
+    size_t num_errors;
+} DiagSet;
+
+// moves the diagnostics of the calling thread out so that they can be merged in a fixed order
+DiagSet take_diags(void) {
+    DiagSet set = { diags, num_errors };
+    diags = NULL;
+    num_errors = 0;
+    return set;
+}
+
+void merge_diags(DiagSet set) {
+    for (size_t i = 0; i < buf_len(set.diags); i++) {
+        buf_push(diags, set.diags[i]);
+    }
+    buf_free(set.diags);
+    num_errors += set.num_errors;
+    if (max_errors && num_errors >= max_errors && !defer_error_limit) {
+        buf_push(diags, ((Diag) { "FATAL", NULL, 0, strf("Too many errors. Stopping after %zu", num_errors) }));
+        exit_with_diags();
+    }
+}
+
+void warning_at(const char* src_name, size_t line_num, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vpush_diag("WARNING", src_name ? src_name : "", line_num, fmt, args);
+    va_end(args);
+}
+
+void fatal(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vpush_diag("FATAL", NULL, 0, fmt, args);
+    va_end(args);
+    num_errors++;
+    exit_with_diags();
+}
+
 #define _STR(x) #x
 #define STR(x) _STR(x)
 #define TODO(x) message(":warning:TODO: " #x)
@@ -276,26 +533,6 @@ void* map_get(Map* map, void* key) {
     return map_get_hashed(map, key, ptr_hash(key));
 }
 
-void* map_get_key_list(Map* map, void** keys, size_t num_keys, void* opt_key) {
-    uint64_t hash = 14695981039346656037ull;
-    for (size_t i = 0; i < num_keys; i++) {
-        hash ^= ptr_hash(keys[i]);
-        hash *= 1099511628211;
-    }
-    hash ^= ptr_hash(opt_key);
-    hash *= 1099511628211;
-    return map_get(map, (void*)hash);
-}
-
-void* map_get_ptr_uint(Map* map, void* key, size_t num) {
-    uint64_t hash = 14695981039346656037ull;
-    hash ^= ptr_hash(key);
-    hash *= 1099511628211;
-    hash ^= ptr_hash((void*)num);
-    hash *= 1099511628211;
-    return map_get_hashed(map, (void*)hash, hash);
-}
-
 size_t map_collisions = 0;
 size_t max_probing = 0;
 size_t map_put_n = 0;
@@ -342,26 +579,6 @@ void map_put(Map* map, void* key, void* val) {
     map_put_hashed(map, key, val, ptr_hash(key));
 }
 
-void map_put_key_list(Map* map, void** keys, size_t num_keys, void* opt_key, void* val) {
-    uint64_t hash = 14695981039346656037ull;
-    for (size_t i = 0; i < num_keys; i++) {
-        hash ^= ptr_hash(keys[i]);
-        hash *= 1099511628211;
-    }
-    hash ^= ptr_hash(opt_key);
-    hash *= 1099511628211;
-    map_put_hashed(map, (void*)hash, val, hash);
-}
-
-void map_put_ptr_uint(Map* map, void* key, size_t num, void* val) {
-    uint64_t hash = 14695981039346656037ull;
-    hash ^= ptr_hash(key);
-    hash *= 1099511628211;
-    hash ^= ptr_hash((void*)num);
-    hash *= 1099511628211;
-    map_put_hashed(map, (void*)hash, val, hash);
-}
-
 uint64_t str_hash(const char* str, size_t len) {
     // fnv-1a
     uint64_t hash = 14695981039346656037ull;
@@ -375,13 +592,18 @@ uint64_t str_hash(const char* str, size_t len) {
 typedef struct InternStr {
     size_t len;
     struct InternStr* next;
+    size_t index;
+    void* binding; // innermost declaration of the name, maintained by the resolver
     char str[];
 } InternStr;
 
+#define intern_hdr(s) ((InternStr*)((char*)(s) - offsetof(InternStr, str)))
+
 //InternStr* interns;
 Map intern_map = { 0 };
 Arena str_arena;
 size_t collisions = 0;
+size_t num_interns = 0;
 
 char* str_intern_range(const char* start, const char* end) {
     size_t len = end - start;
@@ -397,6 +619,8 @@ char* str_intern_range(const char* start, const char* end) {
     new_intern->str[len] = 0;
     new_intern->len = len;
     new_intern->next = intern;
+    new_intern->index = num_interns++;
+    new_intern->binding = NULL;
     if (intern) collisions++;
     map_put_hashed(&intern_map, (void*)hash, new_intern, hash);
     return new_intern->str;
@@ -0,0 +1,1253 @@
+// ELF objects ===
+
+// --backend=obj encodes the assembly of --backend=asm into x86-64 machine code in memory and
+// writes it as a relocatable ELF64 object for the system linker, so neither the C compiler nor
+// the assembler runs. The assembly is still generated as text, so the incremental cache and the
+// parallel generation of function definitions work the same for both backends.
+//
+// Only the part of GNU as syntax that asm.c generates is understood: the section, symbol and
+// data directives it uses and its instructions in AT&T syntax. Jumps to the blocks of a function
+// are resolved here. Calls and the addresses of globals and strings are left to the linker as
+// relocations.
+
+bool write_obj = false; // --backend=obj
+
+enum {
+    ELF_SHT_PROGBITS = 1,
+    ELF_SHT_SYMTAB = 2,
+    ELF_SHT_STRTAB = 3,
+    ELF_SHT_RELA = 4,
+    ELF_SHT_NOBITS = 8,
+};
+
+enum {
+    ELF_SHF_WRITE = 0x1,
+    ELF_SHF_ALLOC = 0x2,
+    ELF_SHF_EXECINSTR = 0x4,
+    ELF_SHF_INFO_LINK = 0x40,
+};
+
+enum {
+    ELF_STT_NOTYPE = 0,
+    ELF_STT_OBJECT = 1,
+    ELF_STT_FUNC = 2,
+    ELF_STT_SECTION = 3,
+};
+
+enum {
+    ELF_R_X86_64_64 = 1,
+    ELF_R_X86_64_PC32 = 2,
+    ELF_R_X86_64_PLT32 = 4,
+};
+
+typedef struct ElfHeader {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} ElfHeader;
+
+typedef struct ElfSectionHeader {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} ElfSectionHeader;
+
+typedef struct ElfSym {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} ElfSym;
+
+typedef struct ElfRela {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+} ElfRela;
+
+typedef struct ElfSection {
+    const char* name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t align;
+    char* data; // stays empty for .bss
+    uint64_t size;
+    ElfRela* relas;
+    uint32_t index; // of the section header
+    uint32_t sym_index; // of the section symbol
+} ElfSection;
+
+typedef struct ElfSymbol {
+    const char* name; // interned
+    ElfSection* section; // NULL while undefined
+    uint64_t offset;
+    uint64_t size;
+    uint8_t type;
+    bool is_global;
+    uint32_t index;
+} ElfSymbol;
+
+// a field that holds the address of a symbol or the distance to it. patched when the symbol is a
+// local label of the same section, relocated otherwise
+typedef struct ElfFixup {
+    ElfSection* section;
+    uint64_t offset;
+    ElfSymbol* symbol;
+    uint32_t type;
+    int64_t addend;
+} ElfFixup;
+
+typedef struct ElfAsm {
+    ElfSection** sections;
+    ElfSection* section;
+    Map symbols; // interned name -> ElfSymbol*
+    ElfSymbol** symbol_list;
+    ElfFixup* fixups;
+    size_t line_num;
+} ElfAsm;
+
+ElfAsm elf;
+
+// the assembly comes from asm.c, so an error here is a bug in munch
+void elf_error(const char* fmt, ...) {
+    char msg[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    fatal("ASM ERROR at line %zu of the generated assembly: %s", elf.line_num, msg);
+}
+
+// Encoding ===
+
+typedef enum ElfOperandKind {
+    ELF_OPERAND_NONE,
+    ELF_OPERAND_REG,
+    ELF_OPERAND_IMM,
+    ELF_OPERAND_MEM,
+    ELF_OPERAND_SYM, // a jump or call target
+    ELF_OPERAND_INDIRECT, // *%reg
+} ElfOperandKind;
+
+typedef struct ElfOperand {
+    ElfOperandKind kind;
+    int reg; // REG, INDIRECT
+    size_t size; // of REG, 16 for xmm
+    int64_t imm;
+    int base; // MEM, -1 for %rip
+    int index; // MEM, -1 for none
+    int scale;
+    int32_t disp;
+    ElfSymbol* symbol; // MEM relative to %rip, SYM
+} ElfOperand;
+
+typedef struct ElfReg {
+    const char* name;
+    int reg;
+    size_t size;
+} ElfReg;
+
+ElfReg elf_regs[] = {
+    {"rax", 0, 8}, {"rcx", 1, 8}, {"rdx", 2, 8}, {"rbx", 3, 8}, {"rsp", 4, 8}, {"rbp", 5, 8}, {"rsi", 6, 8}, {"rdi", 7, 8},
+    {"r8", 8, 8}, {"r9", 9, 8}, {"r10", 10, 8}, {"r11", 11, 8}, {"r12", 12, 8}, {"r13", 13, 8}, {"r14", 14, 8}, {"r15", 15, 8},
+    {"eax", 0, 4}, {"ecx", 1, 4}, {"edx", 2, 4}, {"ebx", 3, 4}, {"esp", 4, 4}, {"ebp", 5, 4}, {"esi", 6, 4}, {"edi", 7, 4},
+    {"r8d", 8, 4}, {"r9d", 9, 4}, {"r10d", 10, 4}, {"r11d", 11, 4}, {"r12d", 12, 4}, {"r13d", 13, 4}, {"r14d", 14, 4}, {"r15d", 15, 4},
+    {"ax", 0, 2}, {"cx", 1, 2}, {"dx", 2, 2}, {"bx", 3, 2}, {"sp", 4, 2}, {"bp", 5, 2}, {"si", 6, 2}, {"di", 7, 2},
+    {"r8w", 8, 2}, {"r9w", 9, 2}, {"r10w", 10, 2}, {"r11w", 11, 2}, {"r12w", 12, 2}, {"r13w", 13, 2}, {"r14w", 14, 2}, {"r15w", 15, 2},
+    {"al", 0, 1}, {"cl", 1, 1}, {"dl", 2, 1}, {"bl", 3, 1}, {"spl", 4, 1}, {"bpl", 5, 1}, {"sil", 6, 1}, {"dil", 7, 1},
+    {"r8b", 8, 1}, {"r9b", 9, 1}, {"r10b", 10, 1}, {"r11b", 11, 1}, {"r12b", 12, 1}, {"r13b", 13, 1}, {"r14b", 14, 1}, {"r15b", 15, 1},
+    {"xmm0", 0, 16}, {"xmm1", 1, 16}, {"xmm2", 2, 16}, {"xmm3", 3, 16}, {"xmm4", 4, 16}, {"xmm5", 5, 16}, {"xmm6", 6, 16}, {"xmm7", 7, 16},
+    {"rip", -1, 0}, // only valid as a base
+};
+
+Map elf_reg_map; // interned name -> ElfReg*
+
+// an instruction with a modrm byte. reg is the register or opcode extension of its reg field and
+// rm the operand of its r/m field, NULL for an instruction with neither
+typedef struct ElfEncoding {
+    uint8_t prefix; // 0x66, 0xf2, 0xf3 or 0
+    bool rex_w;
+    uint8_t opcode[3];
+    size_t opcode_len;
+    int reg;
+    ElfOperand* rm;
+    int64_t imm;
+    size_t imm_size;
+    bool force_rex; // %spl, %bpl, %sil and %dil need a rex prefix
+} ElfEncoding;
+
+void elf_bytes(const void* bytes, size_t size) {
+    ElfSection* section = elf.section;
+    if (section->type == ELF_SHT_NOBITS) {
+        for (size_t i = 0; i < size; i++) {
+            if (((const uint8_t*)bytes)[i]) {
+                elf_error("Data in %s", section->name);
+            }
+        }
+    }
+    else {
+        _buf_fit(section->data, size);
+        memcpy(section->data + buf_len(section->data), bytes, size);
+        _buf_hdr(section->data)->len += size;
+    }
+    section->size += size;
+}
+
+void elf_byte(uint8_t byte) {
+    elf_bytes(&byte, 1);
+}
+
+void elf_int(int64_t val, size_t size) {
+    uint8_t bytes[8];
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = (uint8_t)((uint64_t)val >> (8 * i));
+    }
+    elf_bytes(bytes, size);
+}
+
+void elf_fixup(ElfSymbol* symbol, uint32_t type, int64_t addend) {
+    buf_push(elf.fixups, ((ElfFixup) { elf.section, elf.section->size, symbol, type, addend }));
+}
+
+bool is_elf_byte_rex_reg(ElfOperand* operand) {
+    return operand->kind == ELF_OPERAND_REG && operand->size == 1 && operand->reg >= 4 && operand->reg < 8;
+}
+
+bool fits_int8(int64_t val) {
+    return val >= INT8_MIN && val <= INT8_MAX;
+}
+
+void elf_encode(ElfEncoding* enc) {
+    ElfOperand* rm = enc->rm;
+    if (enc->prefix) {
+        elf_byte(enc->prefix);
+    }
+    uint8_t rex = 0x40 | (enc->rex_w << 3) | ((enc->reg >= 8) << 2);
+    if (rm && rm->kind == ELF_OPERAND_MEM) {
+        rex |= ((rm->index >= 8) << 1) | (rm->base >= 8);
+    }
+    else if (rm) {
+        rex |= rm->reg >= 8;
+    }
+    if (rex != 0x40 || enc->force_rex || (rm && is_elf_byte_rex_reg(rm))) {
+        elf_byte(rex);
+    }
+    elf_bytes(enc->opcode, enc->opcode_len);
+    size_t fixup = SIZE_MAX;
+    if (!rm) {
+    }
+    else if (rm->kind != ELF_OPERAND_MEM) {
+        elf_byte(0xc0 | ((enc->reg & 7) << 3) | (rm->reg & 7));
+    }
+    else if (rm->base < 0) {
+        elf_byte(0x05 | ((enc->reg & 7) << 3));
+        fixup = buf_len(elf.fixups);
+        elf_fixup(rm->symbol, ELF_R_X86_64_PC32, 0);
+        elf_int(0, 4);
+    }
+    else {
+        // %rsp and %r12 as a base need a sib byte, %rbp and %r13 a displacement
+        bool has_sib = rm->index >= 0 || (rm->base & 7) == 4;
+        int mod = rm->disp == 0 && (rm->base & 7) != 5 ? 0 : fits_int8(rm->disp) ? 1 : 2;
+        elf_byte((mod << 6) | ((enc->reg & 7) << 3) | (has_sib ? 4 : rm->base & 7));
+        if (has_sib) {
+            int scale = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+            elf_byte((scale << 6) | (((rm->index >= 0 ? rm->index : 4) & 7) << 3) | (rm->base & 7));
+        }
+        if (mod) {
+            elf_int(rm->disp, mod == 1 ? 1 : 4);
+        }
+    }
+    if (enc->imm_size) {
+        elf_int(enc->imm, enc->imm_size);
+    }
+    if (fixup != SIZE_MAX) {
+        // the cpu adds the displacement to the address of the next instruction
+        elf.fixups[fixup].addend = (int64_t)elf.fixups[fixup].offset - (int64_t)elf.section->size + rm->disp;
+    }
+}
+
+void elf_encode_op(uint8_t prefix, bool rex_w, uint8_t opcode, int reg, ElfOperand* rm) {
+    elf_encode(&(ElfEncoding) { .prefix = prefix, .rex_w = rex_w, .opcode = {opcode}, .opcode_len = 1, .reg = reg, .rm = rm });
+}
+
+void elf_encode_op2(uint8_t prefix, bool rex_w, uint8_t opcode, int reg, ElfOperand* rm) {
+    elf_encode(&(ElfEncoding) { .prefix = prefix, .rex_w = rex_w, .opcode = {0x0f, opcode}, .opcode_len = 2, .reg = reg, .rm = rm });
+}
+
+// Instructions ===
+
+typedef enum ElfInstrKind {
+    ELF_INSTR_ALU,
+    ELF_INSTR_MOV,
+    ELF_INSTR_MOVABS,
+    ELF_INSTR_LEA,
+    ELF_INSTR_MOVX, // movzbl, movzwl, movsbl, movslq
+    ELF_INSTR_IMUL,
+    ELF_INSTR_GROUP3, // not, neg, idiv
+    ELF_INSTR_SHIFT,
+    ELF_INSTR_TEST,
+    ELF_INSTR_SETCC,
+    ELF_INSTR_JCC,
+    ELF_INSTR_JMP,
+    ELF_INSTR_CALL,
+    ELF_INSTR_PUSH,
+    ELF_INSTR_FIXED,
+    ELF_INSTR_REP,
+    ELF_INSTR_SSE_MOV, // movss, movsd
+    ELF_INSTR_SSE, // xmm <- r/m
+    ELF_INSTR_SSE_TO_GPR, // cvttss2si
+    ELF_INSTR_MOVD,
+} ElfInstrKind;
+
+typedef struct ElfMnemonic {
+    const char* name;
+    ElfInstrKind kind;
+    size_t size;
+    uint8_t prefix;
+    uint8_t opcode; // or the opcode extension of ALU, GROUP3 and SHIFT, or the condition code
+} ElfMnemonic;
+
+ElfMnemonic* elf_mnemonics;
+Map elf_mnemonic_map; // interned name -> index + 1 in elf_mnemonics
+
+const char* elf_alu_names[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+
+const char* elf_cc_names[] = {"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g"};
+
+const char elf_suffixes[] = "bwlq";
+
+void elf_add_mnemonic(ElfMnemonic mnemonic) {
+    mnemonic.name = str_intern(mnemonic.name);
+    buf_push(elf_mnemonics, mnemonic);
+    map_put(&elf_mnemonic_map, (void*)mnemonic.name, (void*)(uintptr_t)buf_len(elf_mnemonics));
+}
+
+void elf_add_sized(const char* name, ElfInstrKind kind, const char* suffixes, uint8_t opcode) {
+    for (const char* it = suffixes; *it; it++) {
+        size_t size = (size_t)1 << (strchr(elf_suffixes, *it) - elf_suffixes);
+        char* sized = strf("%s%c", name, *it);
+        elf_add_mnemonic((ElfMnemonic) { sized, kind, size, 0, opcode });
+        free(sized);
+    }
+}
+
+void init_elf_tables(void) {
+    if (elf_mnemonics) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(elf_regs) / sizeof(*elf_regs); i++) {
+        map_put(&elf_reg_map, (void*)str_intern(elf_regs[i].name), &elf_regs[i]);
+    }
+    for (uint8_t i = 0; i < sizeof(elf_alu_names) / sizeof(*elf_alu_names); i++) {
+        elf_add_sized(elf_alu_names[i], ELF_INSTR_ALU, "bwlq", i);
+    }
+    for (uint8_t i = 0; i < sizeof(elf_cc_names) / sizeof(*elf_cc_names); i++) {
+        char* name = strf("set%s", elf_cc_names[i]);
+        elf_add_mnemonic((ElfMnemonic) { name, ELF_INSTR_SETCC, 1, 0, i });
+        free(name);
+        name = strf("j%s", elf_cc_names[i]);
+        elf_add_mnemonic((ElfMnemonic) { name, ELF_INSTR_JCC, 0, 0, i });
+        free(name);
+    }
+    elf_add_sized("mov", ELF_INSTR_MOV, "bwlq", 0);
+    elf_add_sized("lea", ELF_INSTR_LEA, "lq", 0);
+    elf_add_sized("imul", ELF_INSTR_IMUL, "lq", 0);
+    elf_add_sized("not", ELF_INSTR_GROUP3, "bwlq", 2);
+    elf_add_sized("neg", ELF_INSTR_GROUP3, "bwlq", 3);
+    elf_add_sized("idiv", ELF_INSTR_GROUP3, "lq", 7);
+    elf_add_sized("shl", ELF_INSTR_SHIFT, "lq", 4);
+    elf_add_sized("sal", ELF_INSTR_SHIFT, "lq", 4);
+    elf_add_sized("shr", ELF_INSTR_SHIFT, "lq", 5);
+    elf_add_sized("sar", ELF_INSTR_SHIFT, "lq", 7);
+    elf_add_sized("test", ELF_INSTR_TEST, "bwlq", 0);
+    elf_add_sized("push", ELF_INSTR_PUSH, "q", 0);
+    elf_add_mnemonic((ElfMnemonic) { "movabsq", ELF_INSTR_MOVABS, 8, 0, 0 });
+    elf_add_mnemonic((ElfMnemonic) { "movzbl", ELF_INSTR_MOVX, 4, 0, 0xb6 });
+    elf_add_mnemonic((ElfMnemonic) { "movzwl", ELF_INSTR_MOVX, 4, 0, 0xb7 });
+    elf_add_mnemonic((ElfMnemonic) { "movsbl", ELF_INSTR_MOVX, 4, 0, 0xbe });
+    elf_add_mnemonic((ElfMnemonic) { "movslq", ELF_INSTR_MOVX, 8, 0, 0x63 });
+    elf_add_mnemonic((ElfMnemonic) { "jmp", ELF_INSTR_JMP, 0, 0, 0xe9 });
+    elf_add_mnemonic((ElfMnemonic) { "call", ELF_INSTR_CALL, 0, 0, 0xe8 });
+    elf_add_mnemonic((ElfMnemonic) { "leave", ELF_INSTR_FIXED, 0, 0, 0xc9 });
+    elf_add_mnemonic((ElfMnemonic) { "ret", ELF_INSTR_FIXED, 0, 0, 0xc3 });
+    elf_add_mnemonic((ElfMnemonic) { "cltd", ELF_INSTR_FIXED, 0, 0, 0x99 });
+    elf_add_mnemonic((ElfMnemonic) { "rep", ELF_INSTR_REP, 0, 0xf3, 0 });
+    elf_add_mnemonic((ElfMnemonic) { "movss", ELF_INSTR_SSE_MOV, 4, 0xf3, 0x10 });
+    elf_add_mnemonic((ElfMnemonic) { "movsd", ELF_INSTR_SSE_MOV, 8, 0xf2, 0x10 });
+    elf_add_mnemonic((ElfMnemonic) { "addss", ELF_INSTR_SSE, 4, 0xf3, 0x58 });
+    elf_add_mnemonic((ElfMnemonic) { "mulss", ELF_INSTR_SSE, 4, 0xf3, 0x59 });
+    elf_add_mnemonic((ElfMnemonic) { "subss", ELF_INSTR_SSE, 4, 0xf3, 0x5c });
+    elf_add_mnemonic((ElfMnemonic) { "divss", ELF_INSTR_SSE, 4, 0xf3, 0x5e });
+    elf_add_mnemonic((ElfMnemonic) { "ucomiss", ELF_INSTR_SSE, 4, 0, 0x2e });
+    elf_add_mnemonic((ElfMnemonic) { "cvtsi2ssl", ELF_INSTR_SSE, 4, 0xf3, 0x2a });
+    elf_add_mnemonic((ElfMnemonic) { "cvttss2si", ELF_INSTR_SSE_TO_GPR, 4, 0xf3, 0x2c });
+    elf_add_mnemonic((ElfMnemonic) { "movd", ELF_INSTR_MOVD, 4, 0x66, 0x7e });
+}
+
+void elf_expect_operands(ElfMnemonic* mnemonic, size_t num_operands, size_t expected) {
+    if (num_operands != expected) {
+        elf_error("%s takes %zu operand(s), not %zu", mnemonic->name, expected, num_operands);
+    }
+}
+
+void elf_expect_reg(ElfMnemonic* mnemonic, ElfOperand* operand) {
+    if (operand->kind != ELF_OPERAND_REG || operand->size == 16) {
+        elf_error("%s needs a general purpose register", mnemonic->name);
+    }
+}
+
+void elf_expect_xmm(ElfMnemonic* mnemonic, ElfOperand* operand) {
+    if (operand->kind != ELF_OPERAND_REG || operand->size != 16) {
+        elf_error("%s needs an xmm register", mnemonic->name);
+    }
+}
+
+void elf_expect_rm(ElfMnemonic* mnemonic, ElfOperand* operand) {
+    if (operand->kind != ELF_OPERAND_MEM && operand->kind != ELF_OPERAND_REG) {
+        elf_error("%s needs a register or memory operand", mnemonic->name);
+    }
+}
+
+// a jump back to a label of the section that is close enough takes an 8 bit displacement. the
+// distance to a label further on is not known yet, so jumps forward take 32 bits
+bool is_elf_short_jump(ElfSymbol* symbol) {
+    return symbol->section == elf.section && !symbol->is_global && fits_int8((int64_t)symbol->offset - (int64_t)(elf.section->size + 2));
+}
+
+void elf_rel32(ElfSymbol* symbol, uint32_t type) {
+    elf_fixup(symbol, type, -4);
+    elf_int(0, 4);
+}
+
+void elf_instr(ElfMnemonic* mnemonic, ElfOperand* ops, size_t num_ops) {
+    size_t size = mnemonic->size;
+    uint8_t size_prefix = size == 2 ? 0x66 : 0;
+    bool rex_w = size == 8;
+    ElfOperand* src = &ops[0];
+    ElfOperand* dst = &ops[num_ops - 1];
+    switch (mnemonic->kind) {
+    case ELF_INSTR_ALU:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_rm(mnemonic, dst);
+        if (src->kind == ELF_OPERAND_IMM) {
+            bool is_imm8 = size == 1 || fits_int8(src->imm);
+            elf_encode(&(ElfEncoding) {
+                .prefix = size_prefix, .rex_w = rex_w, .opcode = {size == 1 ? 0x80 : is_imm8 ? 0x83 : 0x81}, .opcode_len = 1,
+                .reg = mnemonic->opcode, .rm = dst, .imm = src->imm, .imm_size = is_imm8 ? 1 : min(size, 4),
+            });
+        }
+        else if (src->kind == ELF_OPERAND_REG) {
+            elf_encode(&(ElfEncoding) {
+                .prefix = size_prefix, .rex_w = rex_w, .opcode = {(mnemonic->opcode << 3) | (size != 1)}, .opcode_len = 1,
+                .reg = src->reg, .rm = dst, .force_rex = is_elf_byte_rex_reg(src),
+            });
+        }
+        else {
+            elf_expect_reg(mnemonic, dst);
+            elf_encode_op(size_prefix, rex_w, (mnemonic->opcode << 3) | (size == 1 ? 2 : 3), dst->reg, src);
+        }
+        break;
+    case ELF_INSTR_MOV:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_rm(mnemonic, dst);
+        if (src->kind == ELF_OPERAND_IMM) {
+            if (size == 8 && (src->imm < INT32_MIN || src->imm > INT32_MAX)) {
+                elf_error("movq takes a 32 bit immediate, use movabsq");
+            }
+            elf_encode(&(ElfEncoding) {
+                .prefix = size_prefix, .rex_w = rex_w, .opcode = {size == 1 ? 0xc6 : 0xc7}, .opcode_len = 1,
+                .reg = 0, .rm = dst, .imm = src->imm, .imm_size = min(size, 4),
+            });
+        }
+        else if (src->kind == ELF_OPERAND_REG) {
+            elf_encode(&(ElfEncoding) {
+                .prefix = size_prefix, .rex_w = rex_w, .opcode = {size == 1 ? 0x88 : 0x89}, .opcode_len = 1,
+                .reg = src->reg, .rm = dst, .force_rex = is_elf_byte_rex_reg(src),
+            });
+        }
+        else {
+            elf_expect_reg(mnemonic, dst);
+            elf_encode(&(ElfEncoding) {
+                .prefix = size_prefix, .rex_w = rex_w, .opcode = {size == 1 ? 0x8a : 0x8b}, .opcode_len = 1,
+                .reg = dst->reg, .rm = src, .force_rex = is_elf_byte_rex_reg(dst),
+            });
+        }
+        break;
+    case ELF_INSTR_MOVABS:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_reg(mnemonic, dst);
+        if (src->kind != ELF_OPERAND_IMM) {
+            elf_error("movabsq needs an immediate");
+        }
+        elf_byte(0x48 | (dst->reg >= 8));
+        elf_byte(0xb8 | (dst->reg & 7));
+        elf_int(src->imm, 8);
+        break;
+    case ELF_INSTR_LEA:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_reg(mnemonic, dst);
+        if (src->kind != ELF_OPERAND_MEM) {
+            elf_error("lea needs a memory operand");
+        }
+        elf_encode_op(0, rex_w, 0x8d, dst->reg, src);
+        break;
+    case ELF_INSTR_MOVX:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_rm(mnemonic, src);
+        elf_expect_reg(mnemonic, dst);
+        if (mnemonic->opcode == 0x63) {
+            elf_encode_op(0, true, 0x63, dst->reg, src);
+        }
+        else {
+            elf_encode(&(ElfEncoding) { .rex_w = rex_w, .opcode = {0x0f, mnemonic->opcode}, .opcode_len = 2, .reg = dst->reg, .rm = src });
+        }
+        break;
+    case ELF_INSTR_IMUL:
+        elf_expect_reg(mnemonic, dst);
+        if (num_ops == 3) {
+            if (src->kind != ELF_OPERAND_IMM) {
+                elf_error("imul needs an immediate as the first of three operands");
+            }
+            elf_expect_rm(mnemonic, &ops[1]);
+            bool is_imm8 = fits_int8(src->imm);
+            elf_encode(&(ElfEncoding) {
+                .rex_w = rex_w, .opcode = {is_imm8 ? 0x6b : 0x69}, .opcode_len = 1,
+                .reg = dst->reg, .rm = &ops[1], .imm = src->imm, .imm_size = is_imm8 ? 1 : 4,
+            });
+        }
+        else {
+            elf_expect_operands(mnemonic, num_ops, 2);
+            elf_expect_rm(mnemonic, src);
+            elf_encode_op2(0, rex_w, 0xaf, dst->reg, src);
+        }
+        break;
+    case ELF_INSTR_GROUP3:
+        elf_expect_operands(mnemonic, num_ops, 1);
+        elf_expect_rm(mnemonic, dst);
+        elf_encode_op(size_prefix, rex_w, size == 1 ? 0xf6 : 0xf7, mnemonic->opcode, dst);
+        break;
+    case ELF_INSTR_SHIFT:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_rm(mnemonic, dst);
+        if (src->kind == ELF_OPERAND_IMM) {
+            elf_encode(&(ElfEncoding) {
+                .rex_w = rex_w, .opcode = {0xc1}, .opcode_len = 1, .reg = mnemonic->opcode, .rm = dst, .imm = src->imm, .imm_size = 1,
+            });
+        }
+        else if (src->kind == ELF_OPERAND_REG && src->reg == 1 && src->size == 1) {
+            elf_encode_op(0, rex_w, 0xd3, mnemonic->opcode, dst);
+        }
+        else {
+            elf_error("%s shifts by an immediate or %%cl", mnemonic->name);
+        }
+        break;
+    case ELF_INSTR_TEST:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_reg(mnemonic, src);
+        elf_expect_rm(mnemonic, dst);
+        elf_encode(&(ElfEncoding) {
+            .prefix = size_prefix, .rex_w = rex_w, .opcode = {size == 1 ? 0x84 : 0x85}, .opcode_len = 1,
+            .reg = src->reg, .rm = dst, .force_rex = is_elf_byte_rex_reg(src),
+        });
+        break;
+    case ELF_INSTR_SETCC:
+        elf_expect_operands(mnemonic, num_ops, 1);
+        elf_expect_rm(mnemonic, dst);
+        elf_encode_op2(0, false, 0x90 | mnemonic->opcode, 0, dst);
+        break;
+    case ELF_INSTR_JCC:
+    case ELF_INSTR_JMP:
+        elf_expect_operands(mnemonic, num_ops, 1);
+        if (src->kind != ELF_OPERAND_SYM) {
+            elf_error("%s needs a label", mnemonic->name);
+        }
+        if (is_elf_short_jump(src->symbol)) {
+            elf_byte(mnemonic->kind == ELF_INSTR_JCC ? 0x70 | mnemonic->opcode : 0xeb);
+            elf_int((int64_t)src->symbol->offset - (int64_t)(elf.section->size + 1), 1);
+            break;
+        }
+        if (mnemonic->kind == ELF_INSTR_JCC) {
+            elf_byte(0x0f);
+            elf_byte(0x80 | mnemonic->opcode);
+        }
+        else {
+            elf_byte(0xe9);
+        }
+        elf_rel32(src->symbol, ELF_R_X86_64_PC32);
+        break;
+    case ELF_INSTR_CALL:
+        elf_expect_operands(mnemonic, num_ops, 1);
+        if (src->kind == ELF_OPERAND_SYM) {
+            elf_byte(0xe8);
+            elf_rel32(src->symbol, ELF_R_X86_64_PLT32);
+        }
+        else if (src->kind == ELF_OPERAND_INDIRECT) {
+            ElfOperand reg = { .kind = ELF_OPERAND_REG, .reg = src->reg, .size = 8 };
+            elf_encode_op(0, false, 0xff, 2, &reg);
+        }
+        else {
+            elf_error("call needs a symbol or *%%reg");
+        }
+        break;
+    case ELF_INSTR_PUSH:
+        elf_expect_operands(mnemonic, num_ops, 1);
+        elf_expect_reg(mnemonic, src);
+        if (src->reg >= 8) {
+            elf_byte(0x41);
+        }
+        elf_byte(0x50 | (src->reg & 7));
+        break;
+    case ELF_INSTR_FIXED:
+        elf_expect_operands(mnemonic, num_ops, 0);
+        elf_byte(mnemonic->opcode);
+        break;
+    case ELF_INSTR_SSE_MOV:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        if (dst->kind == ELF_OPERAND_REG && dst->size == 16) {
+            elf_expect_rm(mnemonic, src);
+            elf_encode_op2(mnemonic->prefix, false, mnemonic->opcode, dst->reg, src);
+        }
+        else {
+            elf_expect_xmm(mnemonic, src);
+            elf_encode_op2(mnemonic->prefix, false, mnemonic->opcode + 1, src->reg, dst);
+        }
+        break;
+    case ELF_INSTR_SSE:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_rm(mnemonic, src);
+        elf_expect_xmm(mnemonic, dst);
+        elf_encode_op2(mnemonic->prefix, false, mnemonic->opcode, dst->reg, src);
+        break;
+    case ELF_INSTR_SSE_TO_GPR:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_rm(mnemonic, src);
+        elf_expect_reg(mnemonic, dst);
+        elf_encode_op2(mnemonic->prefix, dst->size == 8, mnemonic->opcode, dst->reg, src);
+        break;
+    case ELF_INSTR_MOVD:
+        elf_expect_operands(mnemonic, num_ops, 2);
+        elf_expect_xmm(mnemonic, src);
+        elf_expect_rm(mnemonic, dst);
+        elf_encode_op2(mnemonic->prefix, false, mnemonic->opcode, src->reg, dst);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// Parsing ===
+
+typedef struct ElfLine {
+    const char* it;
+    const char* end;
+} ElfLine;
+
+void elf_skip_spaces(ElfLine* line) {
+    while (line->it < line->end && (*line->it == ' ' || *line->it == '\t' || *line->it == '\r')) {
+        line->it++;
+    }
+}
+
+bool is_elf_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+const char* elf_parse_name(ElfLine* line) {
+    elf_skip_spaces(line);
+    const char* start = line->it;
+    while (line->it < line->end && is_elf_name_char(*line->it)) {
+        line->it++;
+    }
+    if (start == line->it) {
+        elf_error("Expected a name at '%.*s'", (int)(line->end - start), start);
+    }
+    return str_intern_range(start, line->it);
+}
+
+bool elf_match(ElfLine* line, char c) {
+    elf_skip_spaces(line);
+    if (line->it < line->end && *line->it == c) {
+        line->it++;
+        return true;
+    }
+    return false;
+}
+
+void elf_expect(ElfLine* line, char c) {
+    if (!elf_match(line, c)) {
+        elf_error("Expected '%c' at '%.*s'", c, (int)(line->end - line->it), line->it);
+    }
+}
+
+bool is_elf_int_start(ElfLine* line) {
+    elf_skip_spaces(line);
+    return line->it < line->end && (isdigit((unsigned char)*line->it) || *line->it == '-');
+}
+
+int64_t elf_parse_int(ElfLine* line) {
+    elf_skip_spaces(line);
+    bool negative = elf_match(line, '-');
+    int base = 10;
+    if (line->end - line->it > 2 && line->it[0] == '0' && (line->it[1] == 'x' || line->it[1] == 'X')) {
+        base = 16;
+        line->it += 2;
+    }
+    uint64_t val = 0;
+    const char* start = line->it;
+    for (; line->it < line->end; line->it++) {
+        char c = (char)tolower((unsigned char)*line->it);
+        int digit = isdigit((unsigned char)c) ? c - '0' : base == 16 && c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) {
+            break;
+        }
+        val = val * base + digit;
+    }
+    if (start == line->it) {
+        elf_error("Expected a number at '%.*s'", (int)(line->end - start), start);
+    }
+    return negative ? -(int64_t)val : (int64_t)val;
+}
+
+ElfSymbol* elf_symbol(const char* name) {
+    ElfSymbol* symbol = map_get(&elf.symbols, (void*)name);
+    if (!symbol) {
+        symbol = xcalloc(1, sizeof(ElfSymbol));
+        symbol->name = name;
+        map_put(&elf.symbols, (void*)name, symbol);
+        buf_push(elf.symbol_list, symbol);
+    }
+    return symbol;
+}
+
+int elf_parse_reg(ElfLine* line, size_t* size) {
+    elf_expect(line, '%');
+    const char* name = elf_parse_name(line);
+    ElfReg* reg = map_get(&elf_reg_map, (void*)name);
+    if (!reg) {
+        elf_error("Unknown register %%%s", name);
+    }
+    *size = reg->size;
+    return reg->reg;
+}
+
+ElfOperand elf_parse_operand(ElfLine* line) {
+    ElfOperand operand = {0};
+    elf_skip_spaces(line);
+    if (line->it == line->end) {
+        elf_error("Expected an operand");
+    }
+    char c = *line->it;
+    if (c == '$') {
+        line->it++;
+        operand.kind = ELF_OPERAND_IMM;
+        operand.imm = elf_parse_int(line);
+    }
+    else if (c == '%') {
+        operand.kind = ELF_OPERAND_REG;
+        operand.reg = elf_parse_reg(line, &operand.size);
+    }
+    else if (c == '*') {
+        line->it++;
+        operand.kind = ELF_OPERAND_INDIRECT;
+        operand.reg = elf_parse_reg(line, &operand.size);
+    }
+    else {
+        if (is_elf_int_start(line)) {
+            operand.disp = (int32_t)elf_parse_int(line);
+        }
+        else if (*line->it != '(') {
+            operand.symbol = elf_symbol(elf_parse_name(line));
+        }
+        if (!elf_match(line, '(')) {
+            if (!operand.symbol) {
+                elf_error("Absolute addresses are not supported");
+            }
+            operand.kind = ELF_OPERAND_SYM;
+            return operand;
+        }
+        operand.kind = ELF_OPERAND_MEM;
+        operand.index = -1;
+        operand.scale = 1;
+        size_t size;
+        operand.base = elf_parse_reg(line, &size);
+        if (operand.base < 0 && !operand.symbol) {
+            elf_error("%%rip needs a symbol");
+        }
+        if (elf_match(line, ',')) {
+            operand.index = elf_parse_reg(line, &size);
+            if (operand.base < 0 || operand.index < 0 || operand.index == 4) {
+                elf_error("Invalid index");
+            }
+            if (elf_match(line, ',')) {
+                operand.scale = (int)elf_parse_int(line);
+            }
+        }
+        elf_expect(line, ')');
+    }
+    return operand;
+}
+
+void elf_define_label(const char* name) {
+    ElfSymbol* symbol = elf_symbol(name);
+    if (symbol->section) {
+        elf_error("%s is defined twice", name);
+    }
+    symbol->section = elf.section;
+    symbol->offset = elf.section->size;
+}
+
+ElfSection* elf_section(const char* name) {
+    for (size_t i = 0; i < buf_len(elf.sections); i++) {
+        if (elf.sections[i]->name == name) {
+            return elf.sections[i];
+        }
+    }
+    ElfSection* section = xcalloc(1, sizeof(ElfSection));
+    section->name = name;
+    section->type = ELF_SHT_PROGBITS;
+    section->align = 1;
+    if (name == str_intern(".text")) {
+        section->flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR;
+    }
+    else if (name == str_intern(".bss")) {
+        section->type = ELF_SHT_NOBITS;
+        section->flags = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    }
+    else if (name == str_intern(".rodata")) {
+        section->flags = ELF_SHF_ALLOC;
+    }
+    else if (strncmp(name, ".note", 5) != 0) {
+        section->flags = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    }
+    buf_push(elf.sections, section);
+    return section;
+}
+
+void elf_parse_string(ElfLine* line) {
+    elf_expect(line, '"');
+    while (line->it < line->end && *line->it != '"') {
+        char c = *line->it++;
+        if (c == '\\' && line->it < line->end) {
+            c = *line->it++;
+            if (c >= '0' && c <= '7') {
+                int val = c - '0';
+                for (int i = 0; i < 2 && line->it < line->end && *line->it >= '0' && *line->it <= '7'; i++) {
+                    val = val * 8 + *line->it++ - '0';
+                }
+                c = (char)val;
+            }
+            else if (c == 'n') {
+                c = '\n';
+            }
+            else if (c == 't') {
+                c = '\t';
+            }
+        }
+        elf_byte((uint8_t)c);
+    }
+    elf_expect(line, '"');
+}
+
+void elf_directive(const char* name, ElfLine* line) {
+    if (name == str_intern(".text") || name == str_intern(".data") || name == str_intern(".bss")) {
+        elf.section = elf_section(name);
+    }
+    else if (name == str_intern(".section")) {
+        // section names like .note.GNU-stack are not symbol names
+        elf_skip_spaces(line);
+        const char* start = line->it;
+        while (line->it < line->end && *line->it != ',' && !isspace((unsigned char)*line->it)) {
+            line->it++;
+        }
+        ElfSection* section = elf_section(str_intern_range(start, line->it));
+        if (elf_match(line, ',')) {
+            // the flags replace the defaults of the name
+            elf_expect(line, '"');
+            section->flags = 0;
+            while (line->it < line->end && *line->it != '"') {
+                char flag = *line->it++;
+                section->flags |= flag == 'a' ? ELF_SHF_ALLOC : flag == 'w' ? ELF_SHF_WRITE : flag == 'x' ? ELF_SHF_EXECINSTR : 0;
+            }
+            elf_expect(line, '"');
+            if (elf_match(line, ',')) {
+                elf_expect(line, '@');
+                const char* type = elf_parse_name(line);
+                section->type = type == str_intern("nobits") ? ELF_SHT_NOBITS : ELF_SHT_PROGBITS;
+            }
+        }
+        elf.section = section;
+    }
+    else if (name == str_intern(".globl")) {
+        elf_symbol(elf_parse_name(line))->is_global = true;
+    }
+    else if (name == str_intern(".type")) {
+        ElfSymbol* symbol = elf_symbol(elf_parse_name(line));
+        elf_expect(line, ',');
+        elf_expect(line, '@');
+        const char* type = elf_parse_name(line);
+        symbol->type = type == str_intern("function") ? ELF_STT_FUNC : type == str_intern("object") ? ELF_STT_OBJECT : ELF_STT_NOTYPE;
+    }
+    else if (name == str_intern(".size")) {
+        ElfSymbol* symbol = elf_symbol(elf_parse_name(line));
+        elf_expect(line, ',');
+        if (elf_match(line, '.')) {
+            // .-symbol
+            elf_expect(line, '-');
+            if (elf_parse_name(line) != symbol->name || symbol->section != elf.section) {
+                elf_error(".size of %s must be a number or .-%s", symbol->name, symbol->name);
+            }
+            symbol->size = elf.section->size - symbol->offset;
+        }
+        else {
+            symbol->size = elf_parse_int(line);
+        }
+    }
+    else if (name == str_intern(".balign")) {
+        uint64_t align = elf_parse_int(line);
+        if (!align || (align & (align - 1))) {
+            elf_error(".balign %" PRIu64 " is not a power of 2", align);
+        }
+        elf.section->align = max(elf.section->align, align);
+        while (elf.section->size & (align - 1)) {
+            elf_byte(elf.section->flags & ELF_SHF_EXECINSTR ? 0x90 : 0);
+        }
+    }
+    else if (name == str_intern(".zero")) {
+        uint64_t size = elf_parse_int(line);
+        if (elf.section->type == ELF_SHT_NOBITS) {
+            elf.section->size += size;
+        }
+        else {
+            for (uint64_t i = 0; i < size; i++) {
+                elf_byte(0);
+            }
+        }
+    }
+    else if (name == str_intern(".byte")) {
+        elf_int(elf_parse_int(line), 1);
+    }
+    else if (name == str_intern(".long")) {
+        elf_int(elf_parse_int(line), 4);
+    }
+    else if (name == str_intern(".quad")) {
+        if (is_elf_int_start(line)) {
+            elf_int(elf_parse_int(line), 8);
+        }
+        else {
+            elf_fixup(elf_symbol(elf_parse_name(line)), ELF_R_X86_64_64, 0);
+            elf_int(0, 8);
+        }
+    }
+    else if (name == str_intern(".string")) {
+        elf_parse_string(line);
+        elf_byte(0);
+    }
+    else {
+        elf_error("Unknown directive %s", name);
+    }
+}
+
+void elf_parse_line(ElfLine* line) {
+    elf_skip_spaces(line);
+    if (line->it == line->end || *line->it == '#') {
+        return;
+    }
+    const char* name = elf_parse_name(line);
+    if (elf_match(line, ':')) {
+        elf_define_label(name);
+        return;
+    }
+    if (name[0] == '.') {
+        elf_directive(name, line);
+    }
+    else {
+        if (!elf.section) {
+            elf_error("Instruction outside of a section");
+        }
+        uintptr_t index = (uintptr_t)map_get(&elf_mnemonic_map, (void*)name);
+        if (!index) {
+            elf_error("Unknown instruction %s", name);
+        }
+        ElfMnemonic* mnemonic = &elf_mnemonics[index - 1];
+        if (mnemonic->kind == ELF_INSTR_REP) {
+            const char* string_op = elf_parse_name(line);
+            elf_byte(mnemonic->prefix);
+            if (string_op == str_intern("movsb")) {
+                elf_byte(0xa4);
+            }
+            else if (string_op == str_intern("stosb")) {
+                elf_byte(0xaa);
+            }
+            else {
+                elf_error("Unknown string instruction %s", string_op);
+            }
+        }
+        else {
+            ElfOperand ops[3];
+            size_t num_ops = 0;
+            elf_skip_spaces(line);
+            while (line->it < line->end && *line->it != '#') {
+                if (num_ops == 3) {
+                    elf_error("Too many operands");
+                }
+                ops[num_ops++] = elf_parse_operand(line);
+                if (!elf_match(line, ',')) {
+                    break;
+                }
+            }
+            elf_instr(mnemonic, ops, num_ops);
+        }
+    }
+    elf_skip_spaces(line);
+    if (line->it != line->end && *line->it != '#') {
+        elf_error("Unexpected '%.*s'", (int)(line->end - line->it), line->it);
+    }
+}
+
+// Writing ===
+
+void elf_patch(ElfFixup* fixup, int64_t val) {
+    uint64_t bits = (uint64_t)val;
+    size_t size = fixup->type == ELF_R_X86_64_64 ? 8 : 4;
+    for (size_t i = 0; i < size; i++) {
+        fixup->section->data[fixup->offset + i] = (char)(bits >> (8 * i));
+    }
+}
+
+// local labels are addressed relative to their section, as as does. the other symbols stay
+// visible to the linker
+bool is_elf_local(ElfSymbol* symbol) {
+    return symbol->section && !symbol->is_global;
+}
+
+void elf_resolve_fixups(void) {
+    for (size_t i = 0; i < buf_len(elf.fixups); i++) {
+        ElfFixup* fixup = &elf.fixups[i];
+        ElfSymbol* symbol = fixup->symbol;
+        if (is_elf_local(symbol) && symbol->section == fixup->section && fixup->type != ELF_R_X86_64_64) {
+            elf_patch(fixup, (int64_t)symbol->offset + fixup->addend - (int64_t)fixup->offset);
+            continue;
+        }
+        uint32_t type = fixup->type;
+        uint32_t sym_index = symbol->index;
+        int64_t addend = fixup->addend;
+        if (is_elf_local(symbol)) {
+            sym_index = symbol->section->sym_index;
+            addend += symbol->offset;
+            if (type == ELF_R_X86_64_PLT32) {
+                type = ELF_R_X86_64_PC32;
+            }
+        }
+        buf_push(fixup->section->relas, ((ElfRela) { fixup->offset, ((uint64_t)sym_index << 32) | type, addend }));
+    }
+}
+
+void elf_align_buf(char** buf, size_t align) {
+    while (buf_len(*buf) & (align - 1)) {
+        buf_push(*buf, 0);
+    }
+}
+
+size_t elf_append(char** buf, const void* data, size_t size, size_t align) {
+    elf_align_buf(buf, align);
+    size_t offset = buf_len(*buf);
+    _buf_fit(*buf, size);
+    if (size) {
+        memcpy(*buf + offset, data, size);
+    }
+    _buf_hdr(*buf)->len += size;
+    return offset;
+}
+
+uint32_t elf_str(char** strtab, const char* str) {
+    uint32_t offset = (uint32_t)buf_len(*strtab);
+    size_t len = strlen(str) + 1;
+    _buf_fit(*strtab, len);
+    memcpy(*strtab + offset, str, len);
+    _buf_hdr(*strtab)->len += len;
+    return offset;
+}
+
+// the object is laid out as the elf header, the contents of the sections, the relocations, the
+// symbol and string tables, and the section headers
+char* elf_write(void) {
+    size_t num_sections = buf_len(elf.sections);
+    char* strtab = NULL;
+    char* shstrtab = NULL;
+    ElfSym* syms = NULL;
+    buf_push(strtab, 0);
+    buf_push(shstrtab, 0);
+    buf_push(syms, ((ElfSym) {0}));
+    // section headers: null, sections, relocations of sections that have them, .symtab, .strtab,
+    // .shstrtab
+    uint32_t num_headers = 1 + (uint32_t)num_sections;
+    for (size_t i = 0; i < num_sections; i++) {
+        ElfSection* section = elf.sections[i];
+        section->index = 1 + (uint32_t)i;
+        section->sym_index = (uint32_t)buf_len(syms);
+        buf_push(syms, ((ElfSym) { 0, ELF_STT_SECTION, 0, (uint16_t)section->index, 0, 0 }));
+    }
+    // local symbols come before the global ones. labels starting with .L are left out
+    uint32_t first_global = 0;
+    for (int global = 0; global < 2; global++) {
+        first_global = global ? (uint32_t)buf_len(syms) : 0;
+        for (size_t i = 0; i < buf_len(elf.symbol_list); i++) {
+            ElfSymbol* symbol = elf.symbol_list[i];
+            bool is_label = strncmp(symbol->name, ".L", 2) == 0;
+            if (is_label && !symbol->section) {
+                elf_error("%s is not defined", symbol->name);
+            }
+            if (is_elf_local(symbol) == global || is_label) {
+                continue;
+            }
+            symbol->index = (uint32_t)buf_len(syms);
+            buf_push(syms, ((ElfSym) {
+                elf_str(&strtab, symbol->name), (uint8_t)((global << 4) | symbol->type), 0,
+                (uint16_t)(symbol->section ? symbol->section->index : 0), symbol->offset, symbol->size,
+            }));
+        }
+    }
+    elf_resolve_fixups();
+    char* out = NULL;
+    ElfHeader header = {0};
+    elf_append(&out, &header, sizeof(header), 1);
+    ElfSectionHeader* headers = NULL;
+    buf_push(headers, ((ElfSectionHeader) {0}));
+    for (size_t i = 0; i < num_sections; i++) {
+        ElfSection* section = elf.sections[i];
+        ElfSectionHeader sh = {0};
+        sh.name = elf_str(&shstrtab, section->name);
+        sh.type = section->type;
+        sh.flags = section->flags;
+        sh.offset = elf_append(&out, section->data, buf_len(section->data), section->align);
+        sh.size = section->size;
+        sh.addralign = section->align;
+        buf_push(headers, sh);
+    }
+    uint32_t symtab_index = num_headers;
+    for (size_t i = 0; i < num_sections; i++) {
+        if (buf_len(elf.sections[i]->relas)) {
+            symtab_index++;
+        }
+    }
+    for (size_t i = 0; i < num_sections; i++) {
+        ElfSection* section = elf.sections[i];
+        if (!buf_len(section->relas)) {
+            continue;
+        }
+        char* name = strf(".rela%s", section->name);
+        ElfSectionHeader sh = {0};
+        sh.name = elf_str(&shstrtab, name);
+        sh.type = ELF_SHT_RELA;
+        sh.flags = ELF_SHF_INFO_LINK;
+        sh.offset = elf_append(&out, section->relas, buf_size(section->relas), 8);
+        sh.size = buf_size(section->relas);
+        sh.link = symtab_index;
+        sh.info = section->index;
+        sh.addralign = 8;
+        sh.entsize = sizeof(ElfRela);
+        buf_push(headers, sh);
+        free(name);
+    }
+    ElfSectionHeader symtab = {0};
+    symtab.name = elf_str(&shstrtab, ".symtab");
+    symtab.type = ELF_SHT_SYMTAB;
+    symtab.offset = elf_append(&out, syms, buf_size(syms), 8);
+    symtab.size = buf_size(syms);
+    symtab.link = symtab_index + 1;
+    symtab.info = first_global; // the index of the first global symbol
+    symtab.addralign = 8;
+    symtab.entsize = sizeof(ElfSym);
+    buf_push(headers, symtab);
+    ElfSectionHeader strtab_header = {0};
+    strtab_header.name = elf_str(&shstrtab, ".strtab");
+    strtab_header.type = ELF_SHT_STRTAB;
+    strtab_header.offset = elf_append(&out, strtab, buf_len(strtab), 1);
+    strtab_header.size = buf_len(strtab);
+    strtab_header.addralign = 1;
+    buf_push(headers, strtab_header);
+    ElfSectionHeader shstrtab_header = {0};
+    shstrtab_header.name = elf_str(&shstrtab, ".shstrtab");
+    shstrtab_header.type = ELF_SHT_STRTAB;
+    shstrtab_header.offset = elf_append(&out, shstrtab, buf_len(shstrtab), 1);
+    shstrtab_header.size = buf_len(shstrtab);
+    shstrtab_header.addralign = 1;
+    buf_push(headers, shstrtab_header);
+
+    header = (ElfHeader) {
+        .ident = {0x7f, 'E', 'L', 'F', 2, 1, 1}, // 64 bit, little endian, version 1
+        .type = 1, // relocatable
+        .machine = 62, // x86-64
+        .version = 1,
+        .shoff = elf_append(&out, headers, buf_size(headers), 8),
+        .ehsize = sizeof(ElfHeader),
+        .shentsize = sizeof(ElfSectionHeader),
+        .shnum = (uint16_t)buf_len(headers),
+        .shstrndx = (uint16_t)(buf_len(headers) - 1),
+    };
+    memcpy(out, &header, sizeof(header));
+    buf_free(headers);
+    buf_free(syms);
+    buf_free(strtab);
+    buf_free(shstrtab);
+    return out;
+}
+
+void free_elf(void) {
+    for (size_t i = 0; i < buf_len(elf.sections); i++) {
+        buf_free(elf.sections[i]->data);
+        buf_free(elf.sections[i]->relas);
+        free(elf.sections[i]);
+    }
+    buf_free(elf.sections);
+    for (size_t i = 0; i < buf_len(elf.symbol_list); i++) {
+        free(elf.symbol_list[i]);
+    }
+    buf_free(elf.symbol_list);
+    free(elf.symbols.pairs);
+    buf_free(elf.fixups);
+    elf = (ElfAsm) {0};
+}
+
+// assembles the assembly in buf and writes it as an object file
+bool write_elf_obj(const char* path, const char* buf, size_t len) {
+    init_elf_tables();
+    const char* end = buf + len;
+    for (const char* it = buf; it < end;) {
+        const char* line_end = memchr(it, '\n', end - it);
+        if (!line_end) {
+            line_end = end;
+        }
+        elf.line_num++;
+        ElfLine line = { it, line_end };
+        elf_parse_line(&line);
+        it = line_end + 1;
+    }
+    char* out = elf_write();
+    bool status = write_file(path, out, buf_len(out));
+    buf_free(out);
+    free_elf();
+    return status;
+}
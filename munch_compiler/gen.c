@@ -1,11 +1,27 @@
-char* gen_buf = NULL;
+// the C of function definitions is generated from the resolved tree, or from the linear IR with
+// --backend=ir. --backend=asm generates assembly instead of C
+typedef enum Backend {
+    BACKEND_C,
+    BACKEND_IR,
+    BACKEND_ASM, // x86-64 assembly instead of C, see asm.c
+} Backend;
+
+Backend gen_backend = BACKEND_C;
+const char* backend_names[] = {
+    [BACKEND_C] = "c",
+    [BACKEND_IR] = "ir",
+    [BACKEND_ASM] = "asm",
+};
+
+// function definitions are generated on worker threads, each into its own gen_buf
+THREAD_LOCAL char* gen_buf = NULL;
 
 #define genf(fmt, ...) \
     do { \
         buf_printf(gen_buf, (fmt), ##__VA_ARGS__); \
     } while(0)
 
-int gen_indent;
+THREAD_LOCAL int gen_indent;
 #define ___ "                                                                                       "
 
 void gen_new_line(void) {
@@ -43,37 +59,67 @@ char* cdecl_name(Type* type) {
     }
 }
 
-char* type_to_cdecl(Type* type, const char* name) {
+// the C declaration of a name of the type is "<base> <prefix><name><suffix>"
+struct TypeCDecl {
+    const char* base;
+    const char* prefix;
+    const char* suffix;
+    const char* nameless; // the type alone, as in casts and sizeof
+};
+
+// rendered once per type. types are interned, so every use of a type shares the rendering.
+// two gen workers may render the same type at once, and either result is kept
+TypeCDecl* type_cdecl(Type* type) {
+    TypeCDecl* cdecl = atomic_get_ptr(&type->cdecl);
+    if (cdecl) {
+        return cdecl;
+    }
+    cdecl = xmalloc(sizeof(TypeCDecl));
     switch (type->type) {
     case TYPE_INT:
-        return strf(*name == 0 ? "int" : "int %s", name);
     case TYPE_VOID:
-        return strf(*name == 0 ? "void" : "void %s", name);
     case TYPE_CHAR:
-        return strf(*name == 0 ? "char" : "char %s", name);
     case TYPE_FLOAT:
-        return strf(*name == 0 ? "float" : "float %s", name);
-    case TYPE_PTR:
-        return type_to_cdecl(type->ptr.base, strf("*%s", name));
-    case TYPE_ARRAY:
-        return type_to_cdecl(type->array.base, strf("%s[%d]", name, type->array.size));
+    case TYPE_STRUCT:
+    case TYPE_UNION:
+        *cdecl = (TypeCDecl) { cdecl_name(type), "", "" };
+        break;
+    case TYPE_PTR: {
+        TypeCDecl* base = type_cdecl(type->ptr.base);
+        *cdecl = (TypeCDecl) { base->base, strf("%s*", base->prefix), base->suffix };
+        break;
+    }
+    case TYPE_ARRAY: {
+        TypeCDecl* base = type_cdecl(type->array.base);
+        *cdecl = (TypeCDecl) { base->base, base->prefix, strf("[%zu]%s", type->array.size, base->suffix) };
+        break;
+    }
     case TYPE_FUNC: {
-        char* buf = NULL;
-        buf_printf(buf, "(*%s)(", name);
+        TypeCDecl* ret = type_cdecl(type->func.ret);
+        char* params = NULL;
         for (size_t i = 0; i < type->func.num_params; i++) {
-            buf_printf(buf, strf("%s%s", type_to_cdecl(type->func.params[i], ""), i == type->func.num_params - 1 ? "" : ", "));
+            buf_printf(params, "%s%s", type_cdecl(type->func.params[i])->nameless, i == type->func.num_params - 1 ? "" : ", ");
         }
-        buf_printf(buf, ")");
-        return type_to_cdecl(type->func.ret, buf);
+        *cdecl = (TypeCDecl) { ret->base, strf("%s(*", ret->prefix), strf(")(%s)%s", params ? params : "", ret->suffix) };
+        buf_free(params);
+        break;
     }
-    case TYPE_STRUCT:
-    case TYPE_UNION:
-        return strf(*name == 0 ? "%s" : "%s %s", type->entity->name, name);
     case TYPE_ENUM:
     default:
         assert(0);
         return 0;
     }
+    cdecl->nameless = *cdecl->prefix || *cdecl->suffix ? strf("%s %s%s", cdecl->base, cdecl->prefix, cdecl->suffix) : cdecl->base;
+    atomic_publish_ptr(&type->cdecl, cdecl);
+    return cdecl;
+}
+
+char* type_to_cdecl(Type* type, const char* name) {
+    TypeCDecl* cdecl = type_cdecl(type);
+    if (*name == 0) {
+        return (char*)cdecl->nameless;
+    }
+    return strf("%s %s%s%s", cdecl->base, cdecl->prefix, name, cdecl->suffix);
 }
 
 char* gen_func_head(Decl* decl) {
@@ -95,7 +141,8 @@ char* gen_func_head(Decl* decl) {
 
 void gen_forward_decl(Entity* entity) {
     Decl* decl = entity->decl;
-    if (!decl) {
+    // assembly declares a symbol where it is defined
+    if (!decl || gen_backend == BACKEND_ASM) {
         return;
     }
     switch (decl->type) {
@@ -116,9 +163,34 @@ void gen_forward_decl(Entity* entity) {
     }
 }
 
+// set by munch build. the C is written to it as soon as it is generated, so that the C compiler
+// reads the declarations while the function bodies are still being generated
+FILE* gen_stream = NULL;
+size_t gen_streamed = 0;
+
+void gen_flush(void) {
+    if (gen_stream) {
+        fwrite(gen_buf + gen_streamed, 1, buf_len(gen_buf) - gen_streamed, gen_stream);
+        gen_streamed = buf_len(gen_buf);
+    }
+}
+
+void gen_cached(const char* str, size_t len) {
+    buf_printf(gen_buf, "%.*s", (int)len, str);
+}
+
+// the byte range of gen_buf produced for each entity is kept for incremental builds
 void gen_decls_forward(void) {
     for (size_t i = 0; i < buf_len(ordered_entities); i++) {
-        gen_forward_decl(ordered_entities[i]);
+        Entity* entity = ordered_entities[i];
+        entity->info->forward_start = buf_len(gen_buf);
+        if (entity->info->cached) {
+            gen_cached(entity->info->cached->forward, entity->info->cached->forward_len);
+        }
+        else {
+            gen_forward_decl(entity);
+        }
+        entity->info->forward_end = buf_len(gen_buf);
     }
 }
 
@@ -175,45 +247,121 @@ char* gen_op(TokenType op) {
     }
 }
 
-char* gen_expr_ff(Expr* expr, bool force_fold);
-char* gen_expr_core(Expr* expr, bool type_expected, bool force_fold);
+char* gen_expr(Expr* expr);
+char* gen_expr_core(Expr* expr, bool type_expected);
 void gen_stmnt(Stmnt* stmnt);
 
-char* gen_expr_ternary(Expr* expr, bool force_fold) {
-    return strf("(%s) ? (%s) : (%s)", gen_expr_ff(expr->ternary_expr.cond, force_fold), gen_expr_ff(expr->ternary_expr.left, force_fold), gen_expr_ff(expr->ternary_expr.right, force_fold));
+char* gen_expr_ternary(Expr* expr) {
+    return strf("(%s) ? (%s) : (%s)", gen_expr(expr->ternary_expr.cond), gen_expr(expr->ternary_expr.left), gen_expr(expr->ternary_expr.right));
 }
 
-char* gen_expr_binary(Expr* expr, bool force_fold) {
-    return strf("(%s) %s (%s)", gen_expr_ff(expr->binary_expr.left, force_fold), gen_op(expr->binary_expr.op), gen_expr_ff(expr->binary_expr.right, force_fold));
+// folded scalars are generated as literals. float literals are kept as they were written
+bool is_gen_folded(Expr* expr) {
+    ValKind kind = expr->folded_val.kind;
+    return kind == VAL_INT || kind == VAL_CHAR || (kind == VAL_FLOAT && expr->type != EXPR_FLOAT);
 }
 
-char* gen_expr_pre_unary(Expr* expr, bool force_fold) {
-    return strf("%s(%s)", gen_op(expr->pre_unary_expr.op), gen_expr_ff(expr->pre_unary_expr.expr, force_fold));
+char* gen_val(Val val, Type* type);
+
+// items are positional until the first one left out, and designated after it
+char* gen_val_aggregate(Val val, Type* type) {
+    bool is_array = type->type == TYPE_ARRAY;
+    size_t num_items = is_array ? type->array.size : type->aggregate.num_fields;
+    bool is_positional = true;
+    bool is_empty = true;
+    char* buf = NULL;
+    buf_printf(buf, "{");
+    for (size_t i = 0; i < num_items; i++) {
+        Val item = val.items[i];
+        if (item.kind == VAL_NONE) {
+            is_positional = false;
+            continue;
+        }
+        buf_printf(buf, is_empty ? "" : ", ");
+        if (!is_positional && is_array) {
+            buf_printf(buf, "[%zu] = ", i);
+        }
+        else if (!is_positional) {
+            buf_printf(buf, ".%s = ", type->aggregate.fields[i].name);
+        }
+        buf_printf(buf, "%s", gen_val(item, is_array ? type->array.base : type->aggregate.fields[i].type));
+        is_empty = false;
+    }
+    buf_printf(buf, is_empty ? "0}" : "}");
+    return buf;
 }
 
-char* gen_expr_post_unary(Expr* expr, bool force_fold) {
-    return strf("(%s)%s", gen_expr_ff(expr->post_unary_expr.expr, force_fold), gen_op(expr->post_unary_expr.op));
+char* gen_val(Val val, Type* type) {
+    switch (val.kind) {
+    case VAL_INT:
+        // -2147483648 would be the negation of a long literal
+        return val.i == INT32_MIN ? strf("(%" PRId64 " - 1)", val.i + 1) : strf("%" PRId64, val.i);
+    case VAL_CHAR:
+        return strf("(char)%" PRId64, val.i);
+    case VAL_FLOAT: {
+        char* str = strf("%.9g", val.f);
+        // keeps the literal a float
+        return strpbrk(str, ".e") ? str : strf("%s.0", str);
+    }
+    case VAL_NULL:
+        return strf("0");
+    case VAL_AGGREGATE:
+        return gen_val_aggregate(val, type);
+    default:
+        assert(0);
+        return NULL;
+    }
 }
 
-char* gen_expr_call(Expr* expr, bool force_fold) {
+char* gen_expr_binary(Expr* expr) {
+    // (((a) + (b)) + (c)) is built left to right with an explicit stack of the
+    // left spine so that long operator chains do not recurse once per operator
+    size_t base = buf_len(expr_stack);
+    Expr* left_expr = expr;
+    while (left_expr->type == EXPR_BINARY && !is_gen_folded(left_expr)) {
+        buf_push(expr_stack, left_expr);
+        left_expr = left_expr->binary_expr.left;
+    }
     char* buf = NULL;
-    buf_printf(buf, "(%s)(", gen_expr_ff(expr->call_expr.expr, force_fold));
+    for (size_t i = base; i < buf_len(expr_stack); i++) {
+        buf_printf(buf, "(");
+    }
+    buf_printf(buf, "%s", gen_expr(left_expr));
+    for (size_t i = buf_len(expr_stack); i-- > base;) {
+        Expr* binary_expr = expr_stack[i];
+        buf_printf(buf, ") %s (%s)", gen_op(binary_expr->binary_expr.op), gen_expr(binary_expr->binary_expr.right));
+    }
+    _buf_hdr(expr_stack)->len = base;
+    return buf;
+}
+
+char* gen_expr_pre_unary(Expr* expr) {
+    return strf("%s(%s)", gen_op(expr->pre_unary_expr.op), gen_expr(expr->pre_unary_expr.expr));
+}
+
+char* gen_expr_post_unary(Expr* expr) {
+    return strf("(%s)%s", gen_expr(expr->post_unary_expr.expr), gen_op(expr->post_unary_expr.op));
+}
+
+char* gen_expr_call(Expr* expr) {
+    char* buf = NULL;
+    buf_printf(buf, "(%s)(", gen_expr(expr->call_expr.expr));
     for (size_t i = 0; i < expr->call_expr.num_args; i++) {
-        buf_printf(buf, i == expr->call_expr.num_args - 1 ? "%s" : "%s, ", gen_expr_ff(expr->call_expr.args[i], force_fold));
+        buf_printf(buf, i == expr->call_expr.num_args - 1 ? "%s" : "%s, ", gen_expr(expr->call_expr.args[i]));
     }
     buf_printf(buf, ")");
     return buf;
 }
 
-char* gen_expr_int(Expr* expr, bool force_fold) {
+char* gen_expr_int(Expr* expr) {
     return strf("%d", expr->int_expr.int_val);
 }
 
-char* gen_expr_float(Expr* expr, bool force_fold) {
+char* gen_expr_float(Expr* expr) {
     return strf("%f", expr->float_expr.float_val);
 }
 
-char* gen_expr_str(Expr* expr, bool force_fold) {
+char* gen_expr_str(Expr* expr) {
     char* buf = NULL;
     buf_printf(buf, "\"");
     for(size_t i = 0, s = strlen(expr->str_expr.str_val); i < s; i++) {
@@ -227,29 +375,12 @@ char* gen_expr_str(Expr* expr, bool force_fold) {
     return buf;
 }
 
-char* gen_expr_name(Expr* expr, bool force_fold) {
-    if (force_fold) {
-        Decl* decl = get_entity(expr->name_expr.name)->decl;
-        Expr* decl_expr = NULL;
-        if (decl->type == DECL_VAR) {
-            decl_expr = decl->var_decl.expr;
-        }
-        else if (decl->type == DECL_CONST) {
-            decl_expr = decl->const_decl.expr;
-        }
-        else {
-            assert(0);
-        }
-        return gen_expr_ff(decl_expr, true);
-    }
+char* gen_expr_name(Expr* expr) {
     return strf("%s", expr->name_expr.name);
 }
 
-char* gen_expr_compound(Expr* expr, bool type_expected, bool force_fold) {
+char* gen_expr_compound(Expr* expr, bool type_expected) {
     char* buf = NULL;
-    if (force_fold) {
-        type_expected = false;
-    }
     if (type_expected) {
         buf_printf(buf, "(%s) ", type_to_cdecl(expr->resolved_type, ""));
     }
@@ -258,13 +389,13 @@ char* gen_expr_compound(Expr* expr, bool type_expected, bool force_fold) {
         CompoundItem item = expr->compound_expr.compound_items[i];
         switch (item.type) {
         case COMPOUND_DEFAULT:
-            buf_printf(buf, "%s", gen_expr_core(item.value, type_expected, force_fold));
+            buf_printf(buf, "%s", gen_expr_core(item.value, type_expected));
             break;
         case COMPOUND_INDEX:
-            buf_printf(buf, "[%s] = %s", gen_expr_ff(item.index, force_fold), gen_expr_core(item.value, type_expected, force_fold));
+            buf_printf(buf, "[%s] = %s", gen_expr(item.index), gen_expr_core(item.value, type_expected));
             break;
         case COMPOUND_NAME:
-            buf_printf(buf, ".%s = %s", item.name, gen_expr_core(item.value, type_expected, force_fold));
+            buf_printf(buf, ".%s = %s", item.name, gen_expr_core(item.value, type_expected));
             break;
         default:
             assert(0);
@@ -275,73 +406,93 @@ char* gen_expr_compound(Expr* expr, bool type_expected, bool force_fold) {
     return buf;
 }
 
-char* gen_expr_cast(Expr* expr, bool force_fold) {
-    return strf("(%s)(%s)", type_to_cdecl(expr->cast_expr.cast_type->resolved_type, ""), gen_expr_ff(expr->cast_expr.cast_expr, force_fold));
+char* gen_expr_cast(Expr* expr) {
+    return strf("(%s)(%s)", type_to_cdecl(expr->cast_expr.cast_type->resolved_type, ""), gen_expr(expr->cast_expr.cast_expr));
 }
 
-char* gen_expr_index(Expr* expr, bool force_fold) {
-    return strf("(%s)[%s]", gen_expr_ff(expr->index_expr.expr, force_fold), gen_expr_ff(expr->index_expr.index, force_fold));
+char* gen_expr_index(Expr* expr) {
+    return strf("(%s)[%s]", gen_expr(expr->index_expr.expr), gen_expr(expr->index_expr.index));
 }
 
-char* gen_expr_field(Expr* expr, bool force_fold) {
-    return strf("(%s).%s", gen_expr_ff(expr->field_expr.expr, force_fold), expr->field_expr.field);
+char* gen_expr_field(Expr* expr) {
+    return strf("(%s).%s", gen_expr(expr->field_expr.expr), expr->field_expr.field);
 }
 
-char* gen_expr_sizeof_type(Expr* expr, bool force_fold) {
+char* gen_expr_sizeof_type(Expr* expr) {
     return strf("sizeof(%s)", type_to_cdecl(expr->sizeof_expr.type->resolved_type, ""));
 }
 
-char* gen_expr_sizeof_expr(Expr* expr, bool force_fold) {
-    return strf("sizeof(%s)", gen_expr_ff(expr->sizeof_expr.expr, force_fold));
+char* gen_expr_sizeof_expr(Expr* expr) {
+    return strf("sizeof(%s)", gen_expr(expr->sizeof_expr.expr));
+}
+
+THREAD_LOCAL size_t gen_depth = 0;
+THREAD_LOCAL jmp_buf* gen_recover = NULL; // set while a worker generates a function
+
+void enter_gen_nesting(SrcLoc loc) {
+    if (++gen_depth > max_nesting_depth) {
+        error_at("GEN ERROR", loc.src_name, loc.line_num, "Nesting depth exceeds the limit of %zu. Use --max-depth to raise it", max_nesting_depth);
+        if (gen_recover) {
+            longjmp(*gen_recover, 1);
+        }
+        exit_with_diags();
+    }
+}
+
+void leave_gen_nesting(void) {
+    gen_depth--;
 }
 
-char* gen_expr_core(Expr* expr, bool type_expected, bool force_fold) {
-    if (expr->is_folded && expr->resolved_type == type_int) {
-        return strf("%d", expr->folded_value);
+char* gen_expr_core_nested(Expr* expr, bool type_expected) {
+    if (is_gen_folded(expr)) {
+        return gen_val(expr->folded_val, expr->resolved_type);
     }
     switch (expr->type) {
     case EXPR_TERNARY:
-        return gen_expr_ternary(expr, force_fold);
+        return gen_expr_ternary(expr);
     case EXPR_BINARY:
-        return gen_expr_binary(expr, force_fold);
+        return gen_expr_binary(expr);
     case EXPR_PRE_UNARY:
-        return gen_expr_pre_unary(expr, force_fold);
+        return gen_expr_pre_unary(expr);
     case EXPR_POST_UNARY:
-        return gen_expr_post_unary(expr, force_fold);
+        return gen_expr_post_unary(expr);
     case EXPR_CALL: 
-        return gen_expr_call(expr, force_fold);
+        return gen_expr_call(expr);
     case EXPR_INT:
-        return gen_expr_int(expr, force_fold);
+        return gen_expr_int(expr);
     case EXPR_FLOAT:
-        return gen_expr_float(expr, force_fold);
+        return gen_expr_float(expr);
     case EXPR_STR:
-        return gen_expr_str(expr, force_fold);
+        return gen_expr_str(expr);
     case EXPR_NAME:
-        return gen_expr_name(expr, force_fold);
+        return gen_expr_name(expr);
     case EXPR_COMPOUND:
-        return gen_expr_compound(expr, type_expected, force_fold);
+        return gen_expr_compound(expr, type_expected);
     case EXPR_CAST:
-        return gen_expr_cast(expr, force_fold);
+        return gen_expr_cast(expr);
     case EXPR_INDEX:
-        return gen_expr_index(expr, force_fold);
+        return gen_expr_index(expr);
     case EXPR_FIELD:
-        return gen_expr_field(expr, force_fold);
+        return gen_expr_field(expr);
     case EXPR_SIZEOF_TYPE:
-        return gen_expr_sizeof_type(expr, force_fold);
+        return gen_expr_sizeof_type(expr);
     case EXPR_SIZEOF_EXPR:
-        return gen_expr_sizeof_expr(expr, force_fold);
+        return gen_expr_sizeof_expr(expr);
     default:
         assert(0);
         return NULL;
     }
 }
 
-char* gen_expr_ff(Expr* expr, bool force_fold) {
-    return gen_expr_core(expr, true, force_fold);
+char* gen_expr_core(Expr* expr, bool type_expected) {
+    enter_gen_nesting(expr->loc);
+    char* str = gen_expr_core_nested(expr, type_expected);
+    leave_gen_nesting();
+    return str;
 }
 
 char* gen_expr(Expr* expr) {
-    return gen_expr_core(expr, true, false);
+    return gen_expr_core(expr, true);
 }
 
 void gen_stmnt_block(BlockStmnt block) {
@@ -363,9 +514,11 @@ void gen_decl_def(Entity* entity);
 void gen_stmnt_decl(Stmnt* stmnt) {
     assert(stmnt->decl_stmnt.decl->type == DECL_VAR);
     Decl* decl = stmnt->decl_stmnt.decl;
-    genf("%s", type_to_cdecl(decl->var_decl.expr->resolved_type, decl->name));
+    Type* type = decl->var_decl.type ? decl->var_decl.type->resolved_type : decl->var_decl.expr->resolved_type;
+    genf("%s", type_to_cdecl(type, decl->name));
     if (decl->var_decl.expr) {
-        genf(" = %s", gen_expr(decl->var_decl.expr));
+        // an array cannot be initialized from a compound literal, only from braces
+        genf(" = %s", gen_expr_core(decl->var_decl.expr, false));
     }
 }
 
@@ -436,7 +589,7 @@ void gen_stmnt_assign(Stmnt* stmnt) {
 }
 
 void gen_stmnt_init(Stmnt* stmnt) {
-    genf("%s = %s", type_to_cdecl(stmnt->init_stmnt.right->resolved_type, stmnt->init_stmnt.left->name_expr.name), gen_expr(stmnt->init_stmnt.right));
+    genf("%s = %s", type_to_cdecl(stmnt->init_stmnt.right->resolved_type, stmnt->init_stmnt.left->name_expr.name), gen_expr_core(stmnt->init_stmnt.right, false));
 }
 
 void gen_stmnt_break(Stmnt* stmnt) {
@@ -455,6 +608,7 @@ void gen_stmnt(Stmnt* stmnt) {
     if (!stmnt) {
         return;
     }
+    enter_gen_nesting(stmnt->loc);
     switch (stmnt->type) {
     case STMNT_DECL:
         gen_stmnt_decl(stmnt);
@@ -499,6 +653,7 @@ void gen_stmnt(Stmnt* stmnt) {
         assert(0);
         break;
     }
+    leave_gen_nesting();
 }
 
 void gen_decl_def_aggregate(Entity* entity) {
@@ -515,8 +670,8 @@ void gen_decl_def_aggregate(Entity* entity) {
 }
 
 void gen_decl_def_const(Entity* entity) {
-    if (entity->type == type_int) {
-        genf("const %s = %d;", type_to_cdecl(entity->type, entity->name), entity->value);
+    if (entity->val.kind != VAL_NONE) {
+        genf("const %s = %s;", type_to_cdecl(entity->type, entity->name), gen_val(entity->val, entity->type));
     }
     else {
         genf("const %s = %s;", type_to_cdecl(entity->type, entity->name), gen_expr(entity->decl->const_decl.expr));
@@ -526,23 +681,253 @@ void gen_decl_def_const(Entity* entity) {
 void gen_decl_def_var(Entity* entity) {
     Decl* decl = entity->decl;
     if (decl->var_decl.expr) {
-        genf("%s = %s;", type_to_cdecl(entity->type, entity->name), gen_expr_core(decl->var_decl.expr, false, true));
+        // the initializer was folded once by the resolver, so referenced globals are not expanded again
+        genf("%s = %s;", type_to_cdecl(entity->type, entity->name), gen_val(entity->val, entity->type));
     }
     else {
         genf("%s;", type_to_cdecl(entity->type, entity->name));
     }
 }
 
+// C from the IR ===
+
+// with --backend=ir function definitions are generated from the linear IR instead of the
+// resolved tree. Registers are declared as _r<n> and slots as _s<n> at the top of the function,
+// and the blocks that are jumped to are labeled _b<n>.
+
+// type_to_cdecl cannot spell a pointer to an array, so a register of that type is a char*
+char* gen_ir_cdecl(Type* type, const char* name) {
+    if (type->type == TYPE_PTR && type->ptr.base->type == TYPE_ARRAY) {
+        return strf(*name ? "char* %s" : "char*", name);
+    }
+    return type_to_cdecl(type, name);
+}
+
+void gen_ir_str(const char* str) {
+    genf("\"");
+    for (const char* it = str; *it; it++) {
+        unsigned char c = (unsigned char)*it;
+        if (esc_char_to_str[c]) {
+            genf("%s", esc_char_to_str[c]);
+        }
+        else if (isprint(c)) {
+            genf("%c", c);
+        }
+        else {
+            genf("\\%03o", c);
+        }
+    }
+    genf("\"");
+}
+
+void gen_ir_args(IrInstr* instr) {
+    Type* func_type = instr->type;
+    genf("_r%u(", instr->a);
+    for (size_t k = 0; k < func_type->func.num_params; k++) {
+        Type* param = func_type->func.params[k];
+        genf(k ? ", " : "");
+        if (param->type == TYPE_STRUCT || param->type == TYPE_UNION) {
+            genf("*_r%u", instr->args[k]);
+        }
+        else if (param->type == TYPE_ARRAY) {
+            genf("(%s)_r%u", type_to_cdecl(type_ptr(param->array.base), ""), instr->args[k]);
+        }
+        else {
+            genf("_r%u", instr->args[k]);
+        }
+    }
+    genf(")");
+}
+
+// a jump to the next block falls through, and so does the return at the end of a function
+// that does not return a value on every path
+void gen_ir_instr(IrFunc* func, uint32_t block, IrInstr* instr) {
+    uint32_t next = block + 1;
+    Type* ret = func->entity->type->func.ret;
+    if ((instr->op == IR_JUMP && instr->target[0] == next) || (instr->op == IR_RET && !instr->a && ret != type_void)) {
+        return;
+    }
+    gen_new_line();
+    if (instr->dst) {
+        genf("_r%u = ", instr->dst);
+    }
+    Type* type = instr->type;
+    switch (instr->op) {
+    case IR_INT:
+        if (type == type_int) {
+            genf("%s", gen_val(val_int(instr->imm), type));
+        }
+        else if (type == type_char) {
+            genf("%s", gen_val(val_char(instr->imm), type));
+        }
+        else {
+            genf("(%s)%" PRId64, gen_ir_cdecl(type, ""), instr->imm);
+        }
+        break;
+    case IR_FLOAT:
+        genf("%s", gen_val(val_float(instr->fimm), type));
+        break;
+    case IR_STR:
+        gen_ir_str(instr->name);
+        break;
+    case IR_LOCAL:
+        genf("(%s)&_s%" PRId64, gen_ir_cdecl(type, ""), instr->imm);
+        break;
+    case IR_GLOBAL:
+        genf("(%s)&%s", gen_ir_cdecl(type, ""), instr->name);
+        break;
+    case IR_FUNC:
+        genf("%s", instr->name);
+        break;
+    case IR_MOV:
+        genf("_r%u", instr->a);
+        break;
+    case IR_LOAD:
+        genf("*_r%u", instr->a);
+        break;
+    case IR_STORE:
+        genf("*_r%u = _r%u", instr->a, instr->b);
+        break;
+    case IR_COPY:
+        if (type->type == TYPE_ARRAY) {
+            genf("for (int _i = 0; _i < %zu; _i++) _r%u[_i] = _r%u[_i]", type->size, instr->a, instr->b);
+        }
+        else {
+            genf("*_r%u = *_r%u", instr->a, instr->b);
+        }
+        break;
+    case IR_ZERO:
+        if (type->type == TYPE_ARRAY) {
+            genf("for (int _i = 0; _i < %zu; _i++) _r%u[_i] = 0", type->size, instr->a);
+        }
+        else {
+            genf("*_r%u = (%s){0}", instr->a, type_to_cdecl(type, ""));
+        }
+        break;
+    case IR_UNARY:
+        genf("%s_r%u", gen_op(instr->token), instr->a);
+        break;
+    case IR_BINARY:
+        genf("_r%u %s _r%u", instr->a, gen_op(instr->token), instr->b);
+        break;
+    case IR_CAST:
+        genf("(%s)_r%u", gen_ir_cdecl(type, ""), instr->a);
+        break;
+    case IR_OFFSET:
+        genf("(%s)((char*)_r%u + %" PRId64 ")", gen_ir_cdecl(type, ""), instr->a, instr->imm);
+        break;
+    case IR_INDEX:
+        genf("(%s)((char*)_r%u + (long long)_r%u * %" PRId64 ")", gen_ir_cdecl(type, ""), instr->a, instr->b, instr->imm);
+        break;
+    case IR_CALL:
+        if (instr->b) {
+            genf("*_r%u = ", instr->b);
+        }
+        gen_ir_args(instr);
+        break;
+    case IR_JUMP:
+        genf("goto _b%u", instr->target[0]);
+        break;
+    case IR_BRANCH:
+        if (instr->target[0] == next) {
+            genf("if (!_r%u) goto _b%u", instr->a, instr->target[1]);
+        }
+        else if (instr->target[1] == next) {
+            genf("if (_r%u) goto _b%u", instr->a, instr->target[0]);
+        }
+        else {
+            genf("if (_r%u) goto _b%u; else goto _b%u", instr->a, instr->target[0], instr->target[1]);
+        }
+        break;
+    case IR_RET:
+        if (!instr->a) {
+            genf("return");
+        }
+        else {
+            genf(is_ir_aggregate(type) ? "return *_r%u" : "return _r%u", instr->a);
+        }
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    genf(";");
+}
+
+void gen_ir_func(IrFunc* func) {
+    Entity* entity = func->entity;
+    genf("%s %s(", type_to_cdecl(entity->type->func.ret, ""), entity->name);
+    for (size_t i = 0; i < func->num_params; i++) {
+        // a decayed array param is declared as the array, like its forward declaration
+        genf(i ? ", %s" : "%s", type_to_cdecl(entity->type->func.params[i], strf("_s%zu", i)));
+    }
+    genf(func->num_params ? ") {" : "void) {");
+    gen_indent++;
+    for (size_t i = func->num_params; i < func->num_slots; i++) {
+        gen_new_line();
+        genf("%s;", type_to_cdecl(func->slots[i].type, strf("_s%zu", i)));
+    }
+    bool* is_used = xcalloc(func->num_regs, sizeof(bool));
+    bool* is_labeled = xcalloc(func->num_blocks, sizeof(bool));
+    for (uint32_t b = 0; b < func->num_blocks; b++) {
+        for (uint32_t i = func->blocks[b].start; i < func->blocks[b].end; i++) {
+            IrInstr* instr = &func->instrs[i];
+            is_used[instr->dst] = is_used[instr->a] = is_used[instr->b] = true;
+            for (size_t k = 0; k < ir_num_args(instr); k++) {
+                is_used[instr->args[k]] = true;
+            }
+            // the targets of the gotos gen_ir_instr writes
+            if (instr->op == IR_BRANCH) {
+                is_labeled[instr->target[0]] |= instr->target[0] != b + 1;
+                is_labeled[instr->target[1]] |= instr->target[1] != b + 1 || instr->target[0] == b + 1;
+            }
+            else if (instr->op == IR_JUMP) {
+                is_labeled[instr->target[0]] |= instr->target[0] != b + 1;
+            }
+        }
+    }
+    for (uint32_t reg = 1; reg < func->num_regs; reg++) {
+        if (is_used[reg]) {
+            gen_new_line();
+            genf("%s;", gen_ir_cdecl(func->reg_types[reg], strf("_r%u", reg)));
+        }
+    }
+    for (uint32_t b = 0; b < func->num_blocks; b++) {
+        if (is_labeled[b]) {
+            gen_new_line();
+            genf("_b%u: ;", b);
+        }
+        for (uint32_t i = func->blocks[b].start; i < func->blocks[b].end; i++) {
+            gen_ir_instr(func, b, &func->instrs[i]);
+        }
+    }
+    free(is_labeled);
+    free(is_used);
+    GEN_UNINDENT;
+    genf("}");
+}
+
 void gen_decl_def_func(Entity* entity) {
+    if (gen_backend == BACKEND_IR) {
+        gen_ir_func(lower_func(entity));
+        ir_free_func();
+        return;
+    }
     genf("%s ", gen_func_head(entity->decl));
     gen_stmnt_block(entity->decl->func_decl.block);
 }
 
 void gen_decl_def_enum_const(Entity* entity) {
-    genf("enum { %s = %d };", entity->name, entity->value);
+    genf("enum { %s = %" PRId64 " };", entity->name, entity->val.i);
 }
 
+void asm_decl_def(Entity* entity);
+
 void gen_decl_def(Entity* entity) {
+    if (gen_backend == BACKEND_ASM) {
+        asm_decl_def(entity);
+        return;
+    }
     if (entity->e_type == ENTITY_ENUM_CONST) {
         gen_decl_def_enum_const(entity);
         genfln("");
@@ -576,28 +961,103 @@ void gen_decl_def(Entity* entity) {
     }
 }
 
+void gen_entity_def_code(Entity* entity) {
+    if (entity->info->cached) {
+        gen_cached(entity->info->cached->def, entity->info->cached->def_len);
+    }
+    else if (entity->e_type != ENTITY_FUNC || !entity->decl->func_decl.lazy_body) {
+        // a func with a lazy body was never demanded, only its forward declaration is generated
+        gen_decl_def(entity);
+    }
+}
+
+void gen_entity_def(Entity* entity) {
+    entity->info->def_start = buf_len(gen_buf);
+    gen_entity_def_code(entity);
+    entity->info->def_end = buf_len(gen_buf);
+}
+
+Entity** gen_func_queue = NULL;
+char** gen_func_bufs = NULL;
+DiagSet* gen_func_diags = NULL;
+
+void gen_func_job(size_t worker, size_t item) {
+    (void)worker;
+    gen_buf = NULL;
+    gen_indent = 0;
+    gen_depth = 0;
+    jmp_buf recover;
+    gen_recover = &recover;
+    if (!setjmp(recover)) {
+        gen_entity_def_code(gen_func_queue[item]);
+    }
+    gen_recover = NULL;
+    gen_func_bufs[item] = gen_buf;
+    gen_func_diags[item] = take_diags();
+}
+
+// function bodies only read the resolved tree, so they are generated on num_jobs threads and
+// appended in the same order as a serial run
+void gen_funcs(void) {
+    size_t num_funcs = buf_len(gen_func_queue);
+    gen_func_bufs = xcalloc(num_funcs, sizeof(char*));
+    gen_func_diags = xcalloc(num_funcs, sizeof(DiagSet));
+    gen_flush();
+    char* out = gen_buf;
+    DiagSet global_diags = take_diags();
+    defer_error_limit = true;
+    parallel_for(num_funcs, gen_func_job);
+    defer_error_limit = false;
+    gen_buf = out;
+    gen_indent = 0;
+    merge_diags(global_diags);
+    for (size_t i = 0; i < num_funcs; i++) {
+        merge_diags(gen_func_diags[i]);
+    }
+    if (num_errors) {
+        exit_with_diags();
+    }
+    for (size_t i = 0; i < num_funcs; i++) {
+        Entity* entity = gen_func_queue[i];
+        entity->info->def_start = buf_len(gen_buf);
+        gen_cached(gen_func_bufs[i], buf_len(gen_func_bufs[i]));
+        entity->info->def_end = buf_len(gen_buf);
+        buf_free(gen_func_bufs[i]);
+        gen_flush();
+    }
+    free(gen_func_bufs);
+    free(gen_func_diags);
+    buf_free(gen_func_queue);
+    gen_func_bufs = NULL;
+    gen_func_diags = NULL;
+}
+
 void gen_decls_def(void) {
-    Entity** func_entities = NULL;
     for (size_t i = 0; i < buf_len(ordered_entities); i++) {
         if (ordered_entities[i]->e_type == ENTITY_FUNC) {
-            buf_push(func_entities, ordered_entities[i]);
+            buf_push(gen_func_queue, ordered_entities[i]);
         }
         else {
-            gen_decl_def(ordered_entities[i]);
+            gen_entity_def(ordered_entities[i]);
         }
     }
-    for (size_t i = 0; i < buf_len(func_entities); i++) {
-        gen_decl_def(func_entities[i]);
-    }
+    gen_funcs();
 }
 
 void gen_all(void) {
     gen_buf = NULL;
-    genfln("// Forward declarations");
+    gen_streamed = 0;
+    const char* comment = gen_backend == BACKEND_ASM ? "#" : "//";
+    genfln("%s Forward declarations", comment);
     gen_decls_forward();
     genfln("");
-    genfln("// Defintions");
+    genfln("%s Defintions", comment);
     gen_decls_def();
+    if (gen_backend == BACKEND_ASM) {
+        // the stack is not executable
+        genfln(".section .note.GNU-stack,\"\",@progbits");
+    }
+    gen_flush();
 }
 
 void gen_buf_to_file(const char* path) {
@@ -0,0 +1,1254 @@
+// Linear IR ===
+
+// Function bodies are lowered from the resolved tree to a typed linear IR: basic blocks of
+// three-address instructions over virtual registers. Locals and params live in stack slots that
+// are only read and written through explicit loads and stores, and values of struct, union and
+// array types are always handled by their address, so a register only ever holds an int, char,
+// float, pointer or function. Blocks are contiguous ranges of the instructions in layout order
+// and each ends with a jump, branch or return.
+//
+// The C backend generates function definitions from it with --backend=ir and --dump-ir writes
+// it as text next to the source.
+
+typedef enum IrOp {
+    IR_NOP,
+    IR_INT,    // dst = imm, also the null pointer
+    IR_FLOAT,  // dst = fimm
+    IR_STR,    // dst = address of the string literal str
+    IR_LOCAL,  // dst = address of slot imm
+    IR_GLOBAL, // dst = address of the global var or const name
+    IR_FUNC,   // dst = the function name
+    IR_MOV,    // dst = a
+    IR_LOAD,   // dst = *a
+    IR_STORE,  // *a = b
+    IR_COPY,   // *a = *b, of the aggregate or array type
+    IR_ZERO,   // *a = 0, of the aggregate or array type
+    IR_UNARY,  // dst = token a
+    IR_BINARY, // dst = a token b
+    IR_CAST,   // dst = (type)a
+    IR_OFFSET, // dst = a + imm bytes
+    IR_INDEX,  // dst = a + b * imm bytes
+    IR_CALL,   // dst = a(args) of the func type. an aggregate result is stored at b instead
+    IR_JUMP,   // goto target[0]
+    IR_BRANCH, // if a goto target[0] else goto target[1]
+    IR_RET,    // return a, the address of an aggregate result, or nothing when a is 0
+    NUM_IR_OPS
+} IrOp;
+
+const char* ir_op_names[NUM_IR_OPS] = {
+    [IR_NOP] = "nop",
+    [IR_INT] = "int",
+    [IR_FLOAT] = "float",
+    [IR_STR] = "str",
+    [IR_LOCAL] = "local",
+    [IR_GLOBAL] = "global",
+    [IR_FUNC] = "func",
+    [IR_MOV] = "mov",
+    [IR_LOAD] = "load",
+    [IR_STORE] = "store",
+    [IR_COPY] = "copy",
+    [IR_ZERO] = "zero",
+    [IR_UNARY] = "unary",
+    [IR_BINARY] = "binary",
+    [IR_CAST] = "cast",
+    [IR_OFFSET] = "offset",
+    [IR_INDEX] = "index",
+    [IR_CALL] = "call",
+    [IR_JUMP] = "jump",
+    [IR_BRANCH] = "branch",
+    [IR_RET] = "ret",
+};
+
+// registers are numbered from 1, and 0 stands for no register
+typedef struct IrInstr {
+    uint8_t op;
+    uint16_t token; // of IR_UNARY and IR_BINARY
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+    Type* type; // of the result, or of the value stored, copied, called or returned
+    union {
+        int64_t imm;
+        double fimm;
+        const char* name; // IR_GLOBAL and IR_FUNC, and the string of IR_STR
+        uint32_t* args; // IR_CALL, one per param of type
+        uint32_t target[2]; // IR_JUMP and IR_BRANCH
+    };
+} IrInstr;
+
+typedef struct IrBlock {
+    uint32_t start;
+    uint32_t end;
+} IrBlock;
+
+typedef struct IrSlot {
+    const char* name; // NULL for temporaries
+    Type* type;
+    bool is_decayed; // an array param, which holds the address of the array
+} IrSlot;
+
+typedef struct IrFunc {
+    Entity* entity;
+    IrInstr* instrs;
+    size_t num_instrs;
+    IrBlock* blocks; // blocks[0] is the entry
+    size_t num_blocks;
+    Type** reg_types; // indexed by register
+    size_t num_regs;
+    IrSlot* slots; // the params come first
+    size_t num_slots;
+    size_t num_params;
+} IrFunc;
+
+bool dump_ir = false;
+
+// a lowered function lives in the arena of its thread until ir_free_func
+THREAD_LOCAL Arena ir_arena;
+
+// locals in scope, innermost last. a lookup scans from the end so that a name finds the
+// local that shadows the others. nothing is shared, so the workers lower functions in parallel
+typedef struct IrLocal {
+    const char* name;
+    uint32_t slot;
+} IrLocal;
+
+typedef struct IrBuilder {
+    IrInstr* instrs;
+    IrBlock* blocks; // in creation order. start is UINT32_MAX until the block is placed
+    uint32_t block; // being filled
+    Type** reg_types;
+    IrSlot* slots;
+    uint32_t* break_targets;
+    uint32_t* continue_targets;
+    IrLocal* locals;
+} IrBuilder;
+
+THREAD_LOCAL IrBuilder ir;
+
+bool is_ir_aggregate(Type* type) {
+    return type->type == TYPE_STRUCT || type->type == TYPE_UNION || type->type == TYPE_ARRAY;
+}
+
+// the type of a register holding an expression of the type
+Type* ir_value_type(Type* type) {
+    return is_ir_aggregate(type) ? type_ptr(type) : type;
+}
+
+// folded scalars are lowered to constants
+bool is_ir_folded(Expr* expr) {
+    ValKind kind = expr->folded_val.kind;
+    return kind == VAL_INT || kind == VAL_CHAR || kind == VAL_FLOAT || kind == VAL_NULL;
+}
+
+uint32_t ir_new_reg(Type* type) {
+    buf_push(ir.reg_types, type);
+    return (uint32_t)buf_len(ir.reg_types) - 1;
+}
+
+uint32_t ir_new_slot(const char* name, Type* type) {
+    buf_push(ir.slots, ((IrSlot) { name, type }));
+    return (uint32_t)buf_len(ir.slots) - 1;
+}
+
+uint32_t ir_new_block(void) {
+    buf_push(ir.blocks, ((IrBlock) { UINT32_MAX, UINT32_MAX }));
+    return (uint32_t)buf_len(ir.blocks) - 1;
+}
+
+bool ir_is_terminated(void) {
+    size_t len = buf_len(ir.instrs);
+    if (len == ir.blocks[ir.block].start) {
+        return false;
+    }
+    IrOp op = ir.instrs[len - 1].op;
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+void ir_jump(uint32_t target);
+
+// the block being filled falls through to the placed one
+void ir_place_block(uint32_t block) {
+    if (!ir_is_terminated()) {
+        ir_jump(block);
+    }
+    uint32_t len = (uint32_t)buf_len(ir.instrs);
+    ir.blocks[ir.block].end = len;
+    ir.blocks[block].start = len;
+    ir.block = block;
+}
+
+// the returned instr is valid until the next one is emitted
+IrInstr* ir_emit(IrOp op, Type* type) {
+    if (ir_is_terminated()) {
+        // code after a jump or return is unreachable and gets a block of its own
+        ir_place_block(ir_new_block());
+    }
+    buf_push(ir.instrs, ((IrInstr) { .op = op, .type = type }));
+    return &ir.instrs[buf_len(ir.instrs) - 1];
+}
+
+uint32_t ir_emit_value(IrOp op, Type* type, uint32_t a, uint32_t b) {
+    uint32_t dst = ir_new_reg(type);
+    IrInstr* instr = ir_emit(op, type);
+    instr->dst = dst;
+    instr->a = a;
+    instr->b = b;
+    return dst;
+}
+
+uint32_t ir_int(Type* type, int64_t imm) {
+    uint32_t dst = ir_emit_value(IR_INT, type, 0, 0);
+    ir.instrs[buf_len(ir.instrs) - 1].imm = imm;
+    return dst;
+}
+
+uint32_t ir_float(double fimm) {
+    uint32_t dst = ir_emit_value(IR_FLOAT, type_float, 0, 0);
+    ir.instrs[buf_len(ir.instrs) - 1].fimm = fimm;
+    return dst;
+}
+
+uint32_t ir_named(IrOp op, Type* type, const char* name) {
+    uint32_t dst = ir_emit_value(op, type, 0, 0);
+    ir.instrs[buf_len(ir.instrs) - 1].name = name;
+    return dst;
+}
+
+uint32_t ir_local(uint32_t slot) {
+    uint32_t dst = ir_emit_value(IR_LOCAL, type_ptr(ir.slots[slot].type), 0, 0);
+    ir.instrs[buf_len(ir.instrs) - 1].imm = slot;
+    return dst;
+}
+
+uint32_t ir_load(uint32_t addr) {
+    return ir_emit_value(IR_LOAD, ir.reg_types[addr]->ptr.base, addr, 0);
+}
+
+void ir_store(uint32_t addr, uint32_t val) {
+    IrInstr* instr = ir_emit(IR_STORE, ir.reg_types[addr]->ptr.base);
+    instr->a = addr;
+    instr->b = val;
+}
+
+void ir_copy(uint32_t dst_addr, uint32_t src_addr) {
+    IrInstr* instr = ir_emit(IR_COPY, ir.reg_types[dst_addr]->ptr.base);
+    instr->a = dst_addr;
+    instr->b = src_addr;
+}
+
+void ir_zero(uint32_t addr) {
+    IrInstr* instr = ir_emit(IR_ZERO, ir.reg_types[addr]->ptr.base);
+    instr->a = addr;
+}
+
+void ir_mov(uint32_t dst, uint32_t src) {
+    IrInstr* instr = ir_emit(IR_MOV, ir.reg_types[dst]);
+    instr->dst = dst;
+    instr->a = src;
+}
+
+uint32_t ir_op(IrOp op, TokenType token, Type* type, uint32_t a, uint32_t b) {
+    uint32_t dst = ir_emit_value(op, type, a, b);
+    ir.instrs[buf_len(ir.instrs) - 1].token = (uint16_t)token;
+    return dst;
+}
+
+uint32_t ir_cast(Type* type, uint32_t a) {
+    return ir.reg_types[a] == type ? a : ir_emit_value(IR_CAST, type, a, 0);
+}
+
+uint32_t ir_offset(uint32_t addr, size_t offset, Type* type) {
+    uint32_t dst = ir_emit_value(IR_OFFSET, type_ptr(type), addr, 0);
+    ir.instrs[buf_len(ir.instrs) - 1].imm = (int64_t)offset;
+    return dst;
+}
+
+uint32_t ir_index(uint32_t addr, uint32_t index, Type* type) {
+    uint32_t dst = ir_emit_value(IR_INDEX, type_ptr(type), addr, index);
+    ir.instrs[buf_len(ir.instrs) - 1].imm = (int64_t)type->size;
+    return dst;
+}
+
+void ir_jump(uint32_t target) {
+    if (ir_is_terminated()) {
+        return;
+    }
+    IrInstr* instr = ir_emit(IR_JUMP, NULL);
+    instr->target[0] = target;
+}
+
+void ir_branch(uint32_t cond, uint32_t then_block, uint32_t else_block) {
+    IrInstr* instr = ir_emit(IR_BRANCH, NULL);
+    instr->a = cond;
+    instr->target[0] = then_block;
+    instr->target[1] = else_block;
+}
+
+void ir_ret(Type* type, uint32_t val) {
+    IrInstr* instr = ir_emit(IR_RET, type);
+    instr->a = val;
+}
+
+void ir_bind_local(const char* name, uint32_t slot) {
+    buf_push(ir.locals, ((IrLocal) { name, slot }));
+}
+
+// slot + 1 of the local bound to name, 0 for a global
+size_t ir_find_local(const char* name) {
+    for (size_t i = buf_len(ir.locals); i > 0; i--) {
+        if (ir.locals[i - 1].name == name) {
+            return ir.locals[i - 1].slot + 1;
+        }
+    }
+    return 0;
+}
+
+void ir_leave_scope(size_t scope) {
+    if (ir.locals) {
+        _buf_hdr(ir.locals)->len = scope;
+    }
+}
+
+// Lowering ===
+
+uint32_t lower_expr(Expr* expr);
+uint32_t lower_addr(Expr* expr);
+void lower_stmnt(Stmnt* stmnt);
+
+uint32_t lower_folded(Expr* expr) {
+    Val val = expr->folded_val;
+    if (val.kind == VAL_FLOAT) {
+        return ir_float(val.f);
+    }
+    return ir_int(expr->resolved_type, val.kind == VAL_NULL ? 0 : val.i);
+}
+
+uint32_t lower_name_addr(Expr* expr) {
+    const char* name = expr->name_expr.name;
+    size_t slot = ir_find_local(name);
+    if (slot) {
+        IrSlot* local = &ir.slots[slot - 1];
+        uint32_t addr = ir_local((uint32_t)slot - 1);
+        if (local->is_decayed) {
+            return ir_cast(type_ptr(expr->resolved_type), ir_load(addr));
+        }
+        return addr;
+    }
+    Entity* entity = get_entity(name);
+    assert(entity && (entity->e_type == ENTITY_VAR || entity->e_type == ENTITY_CONST));
+    return ir_named(IR_GLOBAL, type_ptr(entity->type), entity->name);
+}
+
+uint32_t lower_name(Expr* expr) {
+    const char* name = expr->name_expr.name;
+    if (!ir_find_local(name)) {
+        Entity* entity = get_entity(name);
+        if (entity->e_type == ENTITY_FUNC) {
+            return ir_named(IR_FUNC, entity->type, entity->name);
+        }
+    }
+    uint32_t addr = lower_name_addr(expr);
+    return is_ir_aggregate(expr->resolved_type) ? addr : ir_load(addr);
+}
+
+uint32_t lower_ternary(Expr* expr, bool is_addr) {
+    Expr* cond = expr->ternary_expr.cond;
+    Expr* left = expr->ternary_expr.left;
+    Expr* right = expr->ternary_expr.right;
+    if (cond->folded_val.kind == VAL_INT) {
+        Expr* taken = cond->folded_val.i ? left : right;
+        return is_addr ? lower_addr(taken) : lower_expr(taken);
+    }
+    Type* type = is_addr ? type_ptr(expr->resolved_type) : ir_value_type(expr->resolved_type);
+    uint32_t result = ir_new_reg(type);
+    uint32_t then_block = ir_new_block();
+    uint32_t else_block = ir_new_block();
+    uint32_t end_block = ir_new_block();
+    ir_branch(lower_expr(cond), then_block, else_block);
+    ir_place_block(then_block);
+    ir_mov(result, is_addr ? lower_addr(left) : lower_expr(left));
+    ir_jump(end_block);
+    ir_place_block(else_block);
+    ir_mov(result, is_addr ? lower_addr(right) : lower_expr(right));
+    ir_place_block(end_block);
+    return result;
+}
+
+// the right operand is only evaluated when the left one does not decide the result
+uint32_t lower_logical(TokenType op, uint32_t left, Expr* right) {
+    uint32_t result = ir_new_reg(type_int);
+    ir_mov(result, ir_int(type_int, op == TOKEN_LOG_OR));
+    uint32_t right_block = ir_new_block();
+    uint32_t end_block = ir_new_block();
+    if (op == TOKEN_LOG_AND) {
+        ir_branch(left, right_block, end_block);
+    }
+    else {
+        ir_branch(left, end_block, right_block);
+    }
+    ir_place_block(right_block);
+    ir_mov(result, ir_op(IR_BINARY, TOKEN_NEQ, type_int, lower_expr(right), ir_int(type_int, 0)));
+    ir_place_block(end_block);
+    return result;
+}
+
+uint32_t lower_binary(Expr* expr) {
+    // the left spine is walked with an explicit stack as in gen_expr_binary
+    size_t base = buf_len(expr_stack);
+    Expr* left_expr = expr;
+    while (left_expr->type == EXPR_BINARY && !is_ir_folded(left_expr)) {
+        buf_push(expr_stack, left_expr);
+        left_expr = left_expr->binary_expr.left;
+    }
+    uint32_t left = lower_expr(left_expr);
+    for (size_t i = buf_len(expr_stack); i-- > base;) {
+        Expr* binary_expr = expr_stack[i];
+        TokenType op = binary_expr->binary_expr.op;
+        if (op == TOKEN_LOG_AND || op == TOKEN_LOG_OR) {
+            left = lower_logical(op, left, binary_expr->binary_expr.right);
+        }
+        else {
+            left = ir_op(IR_BINARY, op, binary_expr->resolved_type, left, lower_expr(binary_expr->binary_expr.right));
+        }
+    }
+    _buf_hdr(expr_stack)->len = base;
+    return left;
+}
+
+// returns the value before the increment or decrement when is_post and the one after otherwise
+uint32_t lower_inc_dec(uint32_t addr, TokenType op, bool is_post) {
+    uint32_t old = ir_load(addr);
+    Type* type = ir.reg_types[old];
+    uint32_t val = ir_op(IR_BINARY, op == TOKEN_INC ? '+' : '-', type, old, ir_int(type, 1));
+    ir_store(addr, val);
+    return is_post ? old : val;
+}
+
+uint32_t lower_pre_unary(Expr* expr) {
+    Expr* operand = expr->pre_unary_expr.expr;
+    TokenType op = expr->pre_unary_expr.op;
+    switch ((int)op) {
+    case TOKEN_INC:
+    case TOKEN_DEC:
+        return lower_inc_dec(lower_addr(operand), op, false);
+    case '+':
+        return lower_expr(operand);
+    case '-':
+    case '!':
+    case '~':
+        return ir_op(IR_UNARY, op, expr->resolved_type, lower_expr(operand), 0);
+    case '*': {
+        uint32_t addr = lower_expr(operand);
+        return is_ir_aggregate(expr->resolved_type) ? addr : ir_load(addr);
+    }
+    case '&':
+        return lower_addr(operand);
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+uint32_t lower_call(Expr* expr) {
+    Type* func_type = expr->call_expr.expr->resolved_type;
+    uint32_t func = lower_expr(expr->call_expr.expr);
+    size_t num_args = expr->call_expr.num_args;
+    uint32_t* args = arena_alloc(&ir_arena, max(num_args, 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < num_args; i++) {
+        args[i] = lower_expr(expr->call_expr.args[i]);
+    }
+    Type* ret = func_type->func.ret;
+    uint32_t result = 0;
+    uint32_t result_addr = 0;
+    if (is_ir_aggregate(ret)) {
+        result_addr = ir_local(ir_new_slot(NULL, ret));
+    }
+    else if (ret != type_void) {
+        result = ir_new_reg(ret);
+    }
+    IrInstr* instr = ir_emit(IR_CALL, func_type);
+    instr->dst = result;
+    instr->a = func;
+    instr->b = result_addr;
+    instr->args = args;
+    return result_addr ? result_addr : result;
+}
+
+void lower_init(uint32_t addr, Expr* expr);
+
+// the fields or elements left out are zero
+void lower_compound_into(uint32_t addr, Expr* expr) {
+    Type* type = expr->resolved_type;
+    ir_zero(addr);
+    for (size_t i = 0, k = 0; i < expr->compound_expr.num_compound_items; i++, k++) {
+        CompoundItem item = expr->compound_expr.compound_items[i];
+        if (type->type == TYPE_ARRAY) {
+            if (item.type == COMPOUND_INDEX) {
+                k = (size_t)item.index->folded_val.i;
+            }
+            lower_init(ir_offset(addr, k * type->array.base->size, type->array.base), item.value);
+        }
+        else {
+            if (item.type == COMPOUND_NAME) {
+                k = aggregate_field_index(type, item.name);
+            }
+            TypeField field = type->aggregate.fields[k];
+            lower_init(ir_offset(addr, field.offset, field.type), item.value);
+        }
+    }
+}
+
+// a compound expression is built in place
+void lower_init(uint32_t addr, Expr* expr) {
+    Type* type = expr->resolved_type;
+    if (!is_ir_aggregate(type)) {
+        ir_store(addr, lower_expr(expr));
+    }
+    else if (expr->type == EXPR_COMPOUND) {
+        lower_compound_into(addr, expr);
+    }
+    else {
+        ir_copy(addr, lower_expr(expr));
+    }
+}
+
+uint32_t lower_compound(Expr* expr) {
+    Type* type = expr->resolved_type;
+    if (!is_ir_aggregate(type)) {
+        // a scalar compound converts its only item
+        return ir_cast(type, lower_expr(expr->compound_expr.compound_items[0].value));
+    }
+    uint32_t addr = ir_local(ir_new_slot(NULL, type));
+    lower_compound_into(addr, expr);
+    return addr;
+}
+
+uint32_t lower_expr(Expr* expr) {
+    if (is_ir_folded(expr)) {
+        return lower_folded(expr);
+    }
+    switch (expr->type) {
+    case EXPR_TERNARY:
+        return lower_ternary(expr, false);
+    case EXPR_BINARY:
+        return lower_binary(expr);
+    case EXPR_PRE_UNARY:
+        return lower_pre_unary(expr);
+    case EXPR_POST_UNARY:
+        return lower_inc_dec(lower_addr(expr->post_unary_expr.expr), expr->post_unary_expr.op, true);
+    case EXPR_CALL:
+        return lower_call(expr);
+    case EXPR_STR:
+        return ir_named(IR_STR, expr->resolved_type, expr->str_expr.str_val);
+    case EXPR_NAME:
+        return lower_name(expr);
+    case EXPR_COMPOUND:
+        return lower_compound(expr);
+    case EXPR_CAST:
+        return ir_cast(expr->resolved_type, lower_expr(expr->cast_expr.cast_expr));
+    case EXPR_INDEX:
+    case EXPR_FIELD: {
+        uint32_t addr = lower_addr(expr);
+        return is_ir_aggregate(expr->resolved_type) ? addr : ir_load(addr);
+    }
+    default:
+        // int, float and sizeof exprs are always folded
+        assert(0);
+        return 0;
+    }
+}
+
+uint32_t lower_addr(Expr* expr) {
+    switch (expr->type) {
+    case EXPR_NAME:
+        return lower_name_addr(expr);
+    case EXPR_INDEX: {
+        Expr* base = expr->index_expr.expr;
+        uint32_t addr = base->resolved_type->type == TYPE_ARRAY ? lower_addr(base) : lower_expr(base);
+        return ir_index(addr, lower_expr(expr->index_expr.index), expr->resolved_type);
+    }
+    case EXPR_FIELD: {
+        Expr* base = expr->field_expr.expr;
+        Type* type = base->resolved_type;
+        TypeField field = type->aggregate.fields[aggregate_field_index(type, expr->field_expr.field)];
+        return ir_offset(lower_addr(base), field.offset, field.type);
+    }
+    case EXPR_PRE_UNARY:
+        if (expr->pre_unary_expr.op == '*') {
+            return lower_expr(expr->pre_unary_expr.expr);
+        }
+        if (expr->pre_unary_expr.op == TOKEN_INC || expr->pre_unary_expr.op == TOKEN_DEC) {
+            uint32_t addr = lower_addr(expr->pre_unary_expr.expr);
+            lower_inc_dec(addr, expr->pre_unary_expr.op, false);
+            return addr;
+        }
+        break;
+    case EXPR_TERNARY:
+        return lower_ternary(expr, true);
+    default:
+        break;
+    }
+    // aggregate rvalues are already addresses
+    assert(is_ir_aggregate(expr->resolved_type));
+    return lower_expr(expr);
+}
+
+void lower_branch(Expr* cond, uint32_t then_block, uint32_t else_block) {
+    if (cond->folded_val.kind == VAL_INT) {
+        ir_jump(cond->folded_val.i ? then_block : else_block);
+    }
+    else {
+        ir_branch(lower_expr(cond), then_block, else_block);
+    }
+}
+
+void lower_block(BlockStmnt block) {
+    size_t scope = buf_len(ir.locals);
+    for (size_t i = 0; i < block.num_stmnts; i++) {
+        lower_stmnt(block.stmnts[i]);
+    }
+    ir_leave_scope(scope);
+}
+
+void lower_local(const char* name, Type* type, Expr* init) {
+    uint32_t slot = ir_new_slot(name, type);
+    if (init) {
+        lower_init(ir_local(slot), init);
+    }
+    // the initializer sees the shadowed name, as in the resolver
+    ir_bind_local(name, slot);
+}
+
+void lower_stmnt_ifelse(Stmnt* stmnt) {
+    IfElseIfStmnt* ifelse = &stmnt->ifelseif_stmnt;
+    uint32_t end_block = ir_new_block();
+    for (size_t i = 0; i <= ifelse->num_else_ifs; i++) {
+        Expr* cond = i == 0 ? ifelse->if_cond : ifelse->else_ifs[i - 1].cond;
+        BlockStmnt block = i == 0 ? ifelse->then_block : ifelse->else_ifs[i - 1].block;
+        uint32_t then_block = ir_new_block();
+        uint32_t next_block = ir_new_block();
+        lower_branch(cond, then_block, next_block);
+        ir_place_block(then_block);
+        lower_block(block);
+        ir_jump(end_block);
+        ir_place_block(next_block);
+    }
+    lower_block(ifelse->else_block);
+    ir_place_block(end_block);
+}
+
+// the cases are compared in order. the case blocks follow in source order with the default
+// last, and fall through into each other as in C
+void lower_stmnt_switch(Stmnt* stmnt) {
+    SwitchStmnt* switch_stmnt = &stmnt->switch_stmnt;
+    uint32_t val = lower_expr(switch_stmnt->switch_expr);
+    uint32_t first_case = (uint32_t)buf_len(ir.blocks);
+    for (size_t i = 0; i < switch_stmnt->num_case_blocks; i++) {
+        ir_new_block();
+    }
+    uint32_t default_block = ir_new_block();
+    uint32_t end_block = ir_new_block();
+    for (size_t i = 0; i < switch_stmnt->num_case_blocks; i++) {
+        uint32_t next_block = ir_new_block();
+        uint32_t cond = ir_op(IR_BINARY, TOKEN_EQ, type_int, val, lower_expr(switch_stmnt->case_blocks[i].case_expr));
+        ir_branch(cond, first_case + (uint32_t)i, next_block);
+        ir_place_block(next_block);
+    }
+    ir_jump(default_block);
+    buf_push(ir.break_targets, end_block);
+    for (size_t i = 0; i < switch_stmnt->num_case_blocks; i++) {
+        ir_place_block(first_case + (uint32_t)i);
+        lower_block(switch_stmnt->case_blocks[i].block);
+    }
+    ir_place_block(default_block);
+    lower_block(switch_stmnt->default_block);
+    _buf_hdr(ir.break_targets)->len--;
+    ir_place_block(end_block);
+}
+
+void lower_loop_body(BlockStmnt block, uint32_t break_target, uint32_t continue_target) {
+    buf_push(ir.break_targets, break_target);
+    buf_push(ir.continue_targets, continue_target);
+    lower_block(block);
+    _buf_hdr(ir.break_targets)->len--;
+    _buf_hdr(ir.continue_targets)->len--;
+}
+
+void lower_stmnt_while(Stmnt* stmnt) {
+    uint32_t cond_block = ir_new_block();
+    uint32_t body_block = ir_new_block();
+    uint32_t end_block = ir_new_block();
+    ir_place_block(cond_block);
+    lower_branch(stmnt->while_stmnt.cond, body_block, end_block);
+    ir_place_block(body_block);
+    lower_loop_body(stmnt->while_stmnt.block, end_block, cond_block);
+    ir_jump(cond_block);
+    ir_place_block(end_block);
+}
+
+void lower_stmnt_do_while(Stmnt* stmnt) {
+    uint32_t body_block = ir_new_block();
+    uint32_t cond_block = ir_new_block();
+    uint32_t end_block = ir_new_block();
+    ir_place_block(body_block);
+    lower_loop_body(stmnt->while_stmnt.block, end_block, cond_block);
+    ir_place_block(cond_block);
+    lower_branch(stmnt->while_stmnt.cond, body_block, end_block);
+    ir_place_block(end_block);
+}
+
+void lower_stmnt_for(Stmnt* stmnt) {
+    ForStmnt* for_stmnt = &stmnt->for_stmnt;
+    size_t scope = buf_len(ir.locals);
+    for (size_t i = 0; i < for_stmnt->num_init; i++) {
+        lower_stmnt(for_stmnt->init[i]);
+    }
+    uint32_t cond_block = ir_new_block();
+    uint32_t body_block = ir_new_block();
+    uint32_t update_block = ir_new_block();
+    uint32_t end_block = ir_new_block();
+    ir_place_block(cond_block);
+    if (for_stmnt->cond) {
+        lower_branch(for_stmnt->cond, body_block, end_block);
+    }
+    ir_place_block(body_block);
+    lower_loop_body(for_stmnt->block, end_block, update_block);
+    ir_place_block(update_block);
+    for (size_t i = 0; i < for_stmnt->num_update; i++) {
+        lower_stmnt(for_stmnt->update[i]);
+    }
+    ir_jump(cond_block);
+    ir_place_block(end_block);
+    ir_leave_scope(scope);
+}
+
+TokenType assign_binary_op(TokenType op) {
+    switch (op) {
+    case TOKEN_ADD_ASSIGN:
+        return '+';
+    case TOKEN_SUB_ASSIGN:
+        return '-';
+    case TOKEN_MUL_ASSIGN:
+        return '*';
+    case TOKEN_DIV_ASSIGN:
+        return '/';
+    case TOKEN_MOD_ASSIGN:
+        return '%';
+    case TOKEN_BIT_AND_ASSIGN:
+        return '&';
+    case TOKEN_BIT_OR_ASSIGN:
+        return '|';
+    case TOKEN_BIT_XOR_ASSIGN:
+        return '^';
+    case TOKEN_LSHIFT_ASSIGN:
+        return TOKEN_LSHIFT;
+    case TOKEN_RSHIFT_ASSIGN:
+        return TOKEN_RSHIFT;
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+void lower_stmnt_assign(Stmnt* stmnt) {
+    AssignStmnt* assign = &stmnt->assign_stmnt;
+    uint32_t addr = lower_addr(assign->left);
+    if (assign->op == '=') {
+        if (is_ir_aggregate(assign->left->resolved_type)) {
+            ir_copy(addr, lower_expr(assign->right));
+        }
+        else {
+            ir_store(addr, lower_expr(assign->right));
+        }
+        return;
+    }
+    uint32_t old = ir_load(addr);
+    uint32_t val = ir_op(IR_BINARY, assign_binary_op(assign->op), assign->left->resolved_type, old, lower_expr(assign->right));
+    ir_store(addr, val);
+}
+
+void lower_stmnt(Stmnt* stmnt) {
+    if (!stmnt) {
+        return;
+    }
+    switch (stmnt->type) {
+    case STMNT_DECL: {
+        Decl* decl = stmnt->decl_stmnt.decl;
+        Type* type = decl->var_decl.type ? decl->var_decl.type->resolved_type : decl->var_decl.expr->resolved_type;
+        lower_local(decl->name, type, decl->var_decl.expr);
+        break;
+    }
+    case STMNT_RETURN: {
+        Expr* expr = stmnt->return_stmnt.expr;
+        if (expr) {
+            ir_ret(expr->resolved_type, lower_expr(expr));
+        }
+        else {
+            ir_ret(type_void, 0);
+        }
+        break;
+    }
+    case STMNT_IF_ELSE:
+        lower_stmnt_ifelse(stmnt);
+        break;
+    case STMNT_SWITCH:
+        lower_stmnt_switch(stmnt);
+        break;
+    case STMNT_WHILE:
+        lower_stmnt_while(stmnt);
+        break;
+    case STMNT_DO_WHILE:
+        lower_stmnt_do_while(stmnt);
+        break;
+    case STMNT_FOR:
+        lower_stmnt_for(stmnt);
+        break;
+    case STMNT_ASSIGN:
+        lower_stmnt_assign(stmnt);
+        break;
+    case STMNT_INIT:
+        lower_local(stmnt->init_stmnt.left->name_expr.name, stmnt->init_stmnt.right->resolved_type, stmnt->init_stmnt.right);
+        break;
+    case STMNT_BREAK:
+        if (buf_len(ir.break_targets)) {
+            ir_jump(ir.break_targets[buf_len(ir.break_targets) - 1]);
+        }
+        break;
+    case STMNT_CONTINUE:
+        if (buf_len(ir.continue_targets)) {
+            ir_jump(ir.continue_targets[buf_len(ir.continue_targets) - 1]);
+        }
+        break;
+    case STMNT_BLOCK:
+        lower_block(stmnt->block_stmnt);
+        break;
+    case STMNT_EXPR:
+        lower_expr(stmnt->expr_stmnt.expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// Cleanup passes ===
+
+bool is_ir_pure(IrOp op) {
+    switch (op) {
+    case IR_INT:
+    case IR_FLOAT:
+    case IR_STR:
+    case IR_LOCAL:
+    case IR_GLOBAL:
+    case IR_FUNC:
+    case IR_MOV:
+    case IR_LOAD:
+    case IR_UNARY:
+    case IR_BINARY:
+    case IR_CAST:
+    case IR_OFFSET:
+    case IR_INDEX:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t ir_num_args(IrInstr* instr) {
+    return instr->op == IR_CALL ? instr->type->func.num_params : 0;
+}
+
+// instrs without side effects whose results are never used are dropped, and calls lose
+// their unused results. registers are not in SSA form, so a register is dead once no live
+// instr reads it, and then all of its definitions go
+void ir_remove_dead_code(IrFunc* func) {
+    uint32_t* uses = xcalloc(func->num_regs, sizeof(uint32_t));
+    uint32_t* first_def = xmalloc(func->num_regs * sizeof(uint32_t));
+    uint32_t* next_def = xmalloc(max(func->num_instrs, 1) * sizeof(uint32_t));
+    memset(first_def, 0xff, func->num_regs * sizeof(uint32_t));
+    for (uint32_t i = 0; i < func->num_instrs; i++) {
+        IrInstr* instr = &func->instrs[i];
+        uses[instr->a]++;
+        uses[instr->b]++;
+        for (size_t k = 0; k < ir_num_args(instr); k++) {
+            uses[instr->args[k]]++;
+        }
+        next_def[i] = first_def[instr->dst];
+        first_def[instr->dst] = i;
+    }
+    uint32_t* dead = NULL;
+    for (uint32_t reg = 1; reg < func->num_regs; reg++) {
+        if (!uses[reg]) {
+            buf_push(dead, reg);
+        }
+    }
+    while (buf_len(dead)) {
+        uint32_t reg = dead[--_buf_hdr(dead)->len];
+        for (uint32_t i = first_def[reg]; i != UINT32_MAX; i = next_def[i]) {
+            IrInstr* instr = &func->instrs[i];
+            if (instr->op == IR_CALL) {
+                instr->dst = 0;
+                continue;
+            }
+            if (!is_ir_pure(instr->op)) {
+                continue;
+            }
+            instr->op = IR_NOP;
+            uint32_t operands[2] = { instr->a, instr->b };
+            for (size_t k = 0; k < 2; k++) {
+                if (operands[k] && --uses[operands[k]] == 0) {
+                    buf_push(dead, operands[k]);
+                }
+            }
+        }
+    }
+    // the blocks are compacted over the dropped instrs
+    uint32_t len = 0;
+    for (size_t b = 0; b < func->num_blocks; b++) {
+        IrBlock* block = &func->blocks[b];
+        uint32_t start = len;
+        for (uint32_t i = block->start; i < block->end; i++) {
+            if (func->instrs[i].op != IR_NOP) {
+                func->instrs[len++] = func->instrs[i];
+            }
+        }
+        *block = (IrBlock) { start, len };
+    }
+    func->num_instrs = len;
+    buf_free(dead);
+    free(next_def);
+    free(first_def);
+    free(uses);
+}
+
+// blocks not reachable from the entry are dropped and the rest are numbered in layout order
+IrFunc* ir_finish(Entity* entity, size_t num_params) {
+    if (!ir_is_terminated()) {
+        // falls off the end of the function
+        ir_ret(entity->type->func.ret, 0);
+    }
+    ir.blocks[ir.block].end = (uint32_t)buf_len(ir.instrs);
+    size_t num_blocks = buf_len(ir.blocks);
+    uint32_t* new_index = xmalloc(num_blocks * sizeof(uint32_t));
+    memset(new_index, 0xff, num_blocks * sizeof(uint32_t));
+    uint32_t* stack = NULL;
+    buf_push(stack, 0);
+    new_index[0] = 0;
+    while (buf_len(stack)) {
+        uint32_t block = stack[--_buf_hdr(stack)->len];
+        IrInstr* last = &ir.instrs[ir.blocks[block].end - 1];
+        for (int k = 0; k < (last->op == IR_BRANCH ? 2 : last->op == IR_JUMP ? 1 : 0); k++) {
+            if (new_index[last->target[k]] == UINT32_MAX) {
+                new_index[last->target[k]] = 0;
+                buf_push(stack, last->target[k]);
+            }
+        }
+    }
+    // placed blocks follow each other in the instrs
+    uint32_t* layout = NULL;
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        if (new_index[i] == 0) {
+            buf_push(layout, i);
+        }
+    }
+    for (size_t i = 1; i < buf_len(layout); i++) {
+        uint32_t block = layout[i];
+        size_t j = i;
+        for (; j > 0 && ir.blocks[layout[j - 1]].start > ir.blocks[block].start; j--) {
+            layout[j] = layout[j - 1];
+        }
+        layout[j] = block;
+    }
+    for (size_t i = 0; i < buf_len(layout); i++) {
+        new_index[layout[i]] = (uint32_t)i;
+    }
+    IrFunc* func = arena_alloc(&ir_arena, sizeof(IrFunc));
+    func->entity = entity;
+    func->num_blocks = buf_len(layout);
+    func->blocks = arena_alloc(&ir_arena, func->num_blocks * sizeof(IrBlock));
+    size_t num_instrs = 0;
+    for (size_t i = 0; i < buf_len(layout); i++) {
+        num_instrs += ir.blocks[layout[i]].end - ir.blocks[layout[i]].start;
+    }
+    func->instrs = arena_alloc(&ir_arena, max(num_instrs, 1) * sizeof(IrInstr));
+    func->num_instrs = 0;
+    for (size_t i = 0; i < buf_len(layout); i++) {
+        IrBlock block = ir.blocks[layout[i]];
+        func->blocks[i].start = (uint32_t)func->num_instrs;
+        for (uint32_t k = block.start; k < block.end; k++) {
+            IrInstr instr = ir.instrs[k];
+            if (instr.op == IR_JUMP || instr.op == IR_BRANCH) {
+                instr.target[0] = new_index[instr.target[0]];
+                instr.target[1] = instr.op == IR_BRANCH ? new_index[instr.target[1]] : 0;
+            }
+            func->instrs[func->num_instrs++] = instr;
+        }
+        func->blocks[i].end = (uint32_t)func->num_instrs;
+    }
+    func->num_regs = buf_len(ir.reg_types);
+    func->reg_types = arena_alloc(&ir_arena, func->num_regs * sizeof(Type*));
+    memcpy(func->reg_types, ir.reg_types, func->num_regs * sizeof(Type*));
+    func->num_slots = buf_len(ir.slots);
+    func->slots = arena_alloc(&ir_arena, max(func->num_slots, 1) * sizeof(IrSlot));
+    memcpy(func->slots, ir.slots, func->num_slots * sizeof(IrSlot));
+    func->num_params = num_params;
+    buf_free(layout);
+    buf_free(stack);
+    free(new_index);
+    ir_remove_dead_code(func);
+    return func;
+}
+
+void ir_begin(void) {
+    // the builder buffers are reused by the next function of the thread
+    buf_clear(ir.instrs);
+    buf_clear(ir.blocks);
+    buf_clear(ir.reg_types);
+    buf_clear(ir.slots);
+    buf_clear(ir.break_targets);
+    buf_clear(ir.continue_targets);
+    ir_leave_scope(0);
+    buf_push(ir.reg_types, NULL);
+    ir.block = ir_new_block();
+    ir.blocks[ir.block].start = 0;
+}
+
+IrFunc* lower_func(Entity* entity) {
+    assert(entity->e_type == ENTITY_FUNC);
+    ir_begin();
+    FuncDecl* func_decl = &entity->decl->func_decl;
+    for (size_t i = 0; i < func_decl->num_params; i++) {
+        Type* type = entity->type->func.params[i];
+        uint32_t slot = ir_new_slot(func_decl->params[i].name, type->type == TYPE_ARRAY ? type_ptr(type->array.base) : type);
+        ir.slots[slot].is_decayed = type->type == TYPE_ARRAY;
+        ir_bind_local(func_decl->params[i].name, slot);
+    }
+    lower_block(func_decl->block);
+    IrFunc* func = ir_finish(entity, func_decl->num_params);
+    ir_leave_scope(0);
+    return func;
+}
+
+void ir_free_func(void) {
+    arena_free(&ir_arena);
+    ir_arena = (Arena) { 0 };
+}
+
+// Text dump ===
+
+// types are written in munch syntax
+void ir_print_type(char** buf, Type* type) {
+    switch (type->type) {
+    case TYPE_VOID:
+        buf_printf(*buf, "void");
+        break;
+    case TYPE_INT:
+        buf_printf(*buf, "int");
+        break;
+    case TYPE_CHAR:
+        buf_printf(*buf, "char");
+        break;
+    case TYPE_FLOAT:
+        buf_printf(*buf, "float");
+        break;
+    case TYPE_PTR:
+        ir_print_type(buf, type->ptr.base);
+        buf_printf(*buf, "*");
+        break;
+    case TYPE_ARRAY:
+        ir_print_type(buf, type->array.base);
+        buf_printf(*buf, "[%zu]", type->array.size);
+        break;
+    case TYPE_FUNC:
+        buf_printf(*buf, "func(");
+        for (size_t i = 0; i < type->func.num_params; i++) {
+            buf_printf(*buf, i ? ", " : "");
+            ir_print_type(buf, type->func.params[i]);
+        }
+        buf_printf(*buf, "): ");
+        ir_print_type(buf, type->func.ret);
+        break;
+    default:
+        buf_printf(*buf, "%s", type->entity ? type->entity->name : "?");
+        break;
+    }
+}
+
+const char* ir_token_name(TokenType token) {
+    switch ((int)token) {
+    case '+':
+        return "add";
+    case '-':
+        return "sub";
+    case '*':
+        return "mul";
+    case '/':
+        return "div";
+    case '%':
+        return "mod";
+    case '&':
+        return "and";
+    case '|':
+        return "or";
+    case '^':
+        return "xor";
+    case '!':
+        return "not";
+    case '~':
+        return "bitnot";
+    case '<':
+        return "lt";
+    case '>':
+        return "gt";
+    case TOKEN_LSHIFT:
+        return "shl";
+    case TOKEN_RSHIFT:
+        return "shr";
+    case TOKEN_EQ:
+        return "eq";
+    case TOKEN_NEQ:
+        return "ne";
+    case TOKEN_LTEQ:
+        return "le";
+    case TOKEN_GTEQ:
+        return "ge";
+    default:
+        assert(0);
+        return "?";
+    }
+}
+
+void ir_print_slot(char** buf, IrFunc* func, size_t slot) {
+    buf_printf(*buf, "s%zu %s: ", slot, func->slots[slot].name ? func->slots[slot].name : "tmp");
+    ir_print_type(buf, func->slots[slot].type);
+}
+
+void ir_print_instr(char** buf, IrFunc* func, IrInstr* instr) {
+    buf_printf(*buf, "    ");
+    if (instr->dst) {
+        buf_printf(*buf, "r%u: ", instr->dst);
+        ir_print_type(buf, func->reg_types[instr->dst]);
+        buf_printf(*buf, " = ");
+    }
+    switch (instr->op) {
+    case IR_UNARY:
+    case IR_BINARY:
+        buf_printf(*buf, "%s", ir_token_name(instr->token));
+        break;
+    case IR_CAST:
+        buf_printf(*buf, "cast ");
+        ir_print_type(buf, func->reg_types[instr->a]);
+        buf_printf(*buf, " to");
+        break;
+    case IR_LOAD:
+    case IR_STORE:
+    case IR_COPY:
+    case IR_ZERO:
+        buf_printf(*buf, "%s ", ir_op_names[instr->op]);
+        ir_print_type(buf, instr->type);
+        break;
+    default:
+        buf_printf(*buf, "%s", ir_op_names[instr->op]);
+        break;
+    }
+    switch (instr->op) {
+    case IR_INT:
+        buf_printf(*buf, " %" PRId64, instr->imm);
+        break;
+    case IR_FLOAT:
+        buf_printf(*buf, " %.9g", instr->fimm);
+        break;
+    case IR_STR:
+        buf_printf(*buf, " \"");
+        for (const char* it = instr->name; *it; it++) {
+            const char* esc = esc_char_to_str[(unsigned char)*it];
+            if (esc) {
+                buf_printf(*buf, "%s", esc);
+            }
+            else {
+                buf_printf(*buf, "%c", *it);
+            }
+        }
+        buf_printf(*buf, "\"");
+        break;
+    case IR_LOCAL:
+        buf_printf(*buf, " s%" PRId64, instr->imm);
+        break;
+    case IR_GLOBAL:
+    case IR_FUNC:
+        buf_printf(*buf, " %s", instr->name);
+        break;
+    case IR_OFFSET:
+        buf_printf(*buf, " r%u, %" PRId64, instr->a, instr->imm);
+        break;
+    case IR_INDEX:
+        buf_printf(*buf, " r%u, r%u * %" PRId64, instr->a, instr->b, instr->imm);
+        break;
+    case IR_CALL:
+        buf_printf(*buf, " r%u(", instr->a);
+        for (size_t k = 0; k < ir_num_args(instr); k++) {
+            buf_printf(*buf, k ? ", r%u" : "r%u", instr->args[k]);
+        }
+        buf_printf(*buf, ")");
+        if (instr->b) {
+            buf_printf(*buf, " to r%u", instr->b);
+        }
+        break;
+    case IR_JUMP:
+        buf_printf(*buf, " b%u", instr->target[0]);
+        break;
+    case IR_BRANCH:
+        buf_printf(*buf, " r%u, b%u, b%u", instr->a, instr->target[0], instr->target[1]);
+        break;
+    default:
+        if (instr->a) {
+            buf_printf(*buf, " r%u", instr->a);
+        }
+        if (instr->b) {
+            buf_printf(*buf, ", r%u", instr->b);
+        }
+        break;
+    }
+    buf_printf(*buf, "\n");
+}
+
+void ir_print_func(char** buf, IrFunc* func) {
+    buf_printf(*buf, "func %s(", func->entity->name);
+    for (size_t i = 0; i < func->num_params; i++) {
+        buf_printf(*buf, i ? ", " : "");
+        ir_print_slot(buf, func, i);
+    }
+    buf_printf(*buf, "): ");
+    ir_print_type(buf, func->entity->type->func.ret);
+    buf_printf(*buf, "\n");
+    for (size_t i = func->num_params; i < func->num_slots; i++) {
+        buf_printf(*buf, "    slot ");
+        ir_print_slot(buf, func, i);
+        buf_printf(*buf, "\n");
+    }
+    for (size_t b = 0; b < func->num_blocks; b++) {
+        buf_printf(*buf, "b%zu:\n", b);
+        for (uint32_t i = func->blocks[b].start; i < func->blocks[b].end; i++) {
+            ir_print_instr(buf, func, &func->instrs[i]);
+        }
+    }
+    buf_printf(*buf, "\n");
+}
+
+bool is_ir_lowered(Entity* entity) {
+    return entity->e_type == ENTITY_FUNC && !entity->info->cached && !entity->decl->func_decl.lazy_body;
+}
+
+// written by --dump-ir. the functions are lowered again on the main thread
+bool write_ir_dump(const char* path) {
+    char* buf = NULL;
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        if (is_ir_lowered(ordered_entities[i])) {
+            ir_print_func(&buf, lower_func(ordered_entities[i]));
+            ir_free_func();
+        }
+    }
+    bool status = write_file(path, buf, buf_len(buf));
+    buf_free(buf);
+    return status;
+}
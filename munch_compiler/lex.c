@@ -124,31 +124,20 @@ const char* stream;
 const char* src_path;
 size_t line_num = 1;
 
-void show_error_token(void) {
-    printf("(%s:%zu)", src_path ? src_path : "", line_num);
-    //size_t curr = token.start - src_start;
-    //size_t left = max(curr - ERROR_DISPLAY_WIDTH / 2, 0);
-    //size_t len = (left + ERROR_DISPLAY_WIDTH) % (strlen(src_start)) - left;
-    //printf("%.*s\n", (int)len, src_start + left);
-    //size_t err_pos = curr - left;
-    //if (err_pos) {
-    //    char* ss = malloc(sizeof(char) * (err_pos + 1));
-    //    memset(ss, ' ', sizeof(char) * err_pos);
-    //    ss[err_pos] = 0;
-    //    printf("%s^\n", ss);
-    //    free(ss);
-    //}
-    //else {
-    //    printf("^\n");
-    //}
+// set by the parser around each decl and stmnt so that it can resume after a syntax error
+jmp_buf* syntax_recover = NULL;
+
+void syntax_error(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    verror_at("SYNTAX ERROR", src_path, line_num, fmt, args);
+    va_end(args);
+    if (syntax_recover) {
+        longjmp(*syntax_recover, 1);
+    }
+    exit_with_diags();
 }
 
-#define syntax_error(fmt, ...) \
-    do { \
-        show_error_token(); \
-        basic_syntax_error(fmt, __VA_ARGS__); \
-    } while(0)
-
 const char char_to_digit[256] = {
     ['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4, ['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
     ['a'] = 10, ['A'] = 10, ['b'] = 11, ['B'] = 11, ['c'] = 12, ['C'] = 12,
@@ -186,11 +175,11 @@ void scan_int(void) {
             break;
         }
         if (digit >= base) {
-            basic_syntax_error("Invalid integer literal %d for base %d", digit, base);
+            syntax_error("Invalid integer literal %d for base %d", digit, base);
             digit = 0;
         }
         if (val > (UINT64_MAX - digit) / base) {
-            basic_syntax_error("Integer literal overflow");
+            syntax_error("Integer literal overflow");
             while (isdigit(*stream)) stream++;
             val = 0;
         }
@@ -209,7 +198,7 @@ void scan_float(void) {
     if (tolower(*stream) == 'e') {
         stream++;
         if (*stream != '+' && *stream != '-' && !isdigit(*stream)) {
-            basic_syntax_error("Expected digit or sign after exponent in the float literal. Found '%c'", *stream);
+            syntax_error("Expected digit or sign after exponent in the float literal. Found '%c'", *stream);
         }
         if (!isdigit(*stream)) stream++;
         while (isdigit(*stream)) stream++;
@@ -221,7 +210,7 @@ void scan_float(void) {
     }
     double val = strtod(start, NULL);
     if (val == HUGE_VAL || val == -HUGE_VAL) {
-        basic_syntax_error("Float literal overflow");
+        syntax_error("Float literal overflow");
     }
     token.type = TOKEN_FLOAT;
     token.floatval = val;
@@ -258,17 +247,17 @@ void scan_char(void) {
     stream++;
     char val;
     if (*stream == '\'') {
-        basic_syntax_error("Char literal should be of length 1");
+        syntax_error("Char literal should be of length 1");
     }
     if (*stream == '\n' || *stream == '\r' || *stream == '\a' || 
         *stream == '\b' || *stream == '\f' || *stream == '\v') {
-        basic_syntax_error("Char literals cannot have escape characters inside quotes. Found <ASCII %d>.", (int)(*stream));
+        syntax_error("Char literals cannot have escape characters inside quotes. Found <ASCII %d>.", (int)(*stream));
     }
     if (*stream == '\\') {
         stream++;
         val = *stream == '"' ? 0 : esc_to_char[(size_t)*stream];
         if (val == 0 && *stream != '0') {
-            basic_syntax_error("Undefined escape char literal");
+            syntax_error("Undefined escape char literal");
         }
         stream++;
     }
@@ -277,7 +266,7 @@ void scan_char(void) {
         stream++;
     }
     if(*stream != '\'') {
-        basic_syntax_error("Char literal should be ended with \'. Found '%c'.", *stream);
+        syntax_error("Char literal should be ended with \'. Found '%c'.", *stream);
     }
     stream++;
     token.type = TOKEN_INT;
@@ -291,7 +280,7 @@ void scan_str(void) {
     while (*stream && *stream != '"') {
         char val;
         if (*stream == '\a' || *stream == '\b' || *stream == '\f' || *stream == '\v') {
-            basic_syntax_error("String literals cannot have escape characters inside quotes. Found <ASCII %d>.", (int)(*stream));
+            syntax_error("String literals cannot have escape characters inside quotes. Found <ASCII %d>.", (int)(*stream));
         }
         if (*stream == '\n' || *stream == '\r') {
             buf_push(str_buf, *stream);
@@ -301,7 +290,7 @@ void scan_str(void) {
             stream++;
             val = *stream == '\'' ? 0 : esc_to_char[(size_t)*stream];
             if (val == 0 && *stream != '0') {
-                basic_syntax_error("Undefined escape char literal");
+                syntax_error("Undefined escape char literal");
             }
             buf_push(str_buf, val);
             stream++;
@@ -313,7 +302,7 @@ void scan_str(void) {
         }
     }
     if (*stream != '"') {
-        basic_syntax_error("String literal should be ended with '\"'. Found %c", *stream);
+        syntax_error("String literal should be ended with '\"'. Found %c", *stream);
     }
     buf_push(str_buf, 0);
     stream++;
@@ -654,7 +643,6 @@ bool expect_token(TokenType type) {
         return true;
     }
     else {
-        show_error_token();
         syntax_error("Expected token %s. Found %s.", tokentype_to_str(type), token_to_str(token));
         return false;
     }
@@ -666,7 +654,6 @@ bool expect_keyword(const char* name) {
         return true;
     }
     else {
-        show_error_token();
         syntax_error("Expected keyword \"%s\". Found \"%s\".", name, token_to_str(token));
         return false;
     }
@@ -714,7 +701,6 @@ bool expect_assign_op(void) {
         return true;
     }
     else {
-        show_error_token();
         syntax_error("Expected an assign operator. Found %s", tokentype_to_str(token.type));
         return false;
     }
@@ -11,6 +11,14 @@
 #include <inttypes.h>
 #include <math.h>
 #include <string.h>
+#include <setjmp.h>
+#include <time.h>
+#include <signal.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 #include "rand.c"
 #include "common.c"
@@ -19,7 +27,12 @@
 #include "print.c"
 #include "parse.c"
 #include "resolve.c"
+#include "ir.c"
 #include "gen.c"
+#include "asm.c"
+#include "elf.c"
+#include "cache.c"
+#include "split.c"
 #include "munch.c"
 #include "test.c"
 
@@ -5,50 +5,351 @@ void munch_init(const char* src) {
     install_built_in_consts();
 }
 
+typedef enum CompileMode {
+    COMPILE_FULL,
+    COMPILE_SYNTAX_ONLY, // stop after parse_stream
+    COMPILE_CHECK        // stop after complete_entities
+} CompileMode;
+
+CompileMode compile_mode = COMPILE_FULL;
+bool layout_report = false;
+
+// munch build -o prog src.mch [--cc cc] [-- cc flags] pipes the C to cc instead of writing it
+const char* build_out_path = NULL;
+const char* build_cc = "cc";
+const char** build_cc_flags = NULL;
+int build_status = 0; // of cc
+
+void shell_quote(char** buf, const char* arg) {
+#if defined(_WIN32)
+    buf_printf(*buf, " \"%s\"", arg);
+#else
+    buf_printf(*buf, " '");
+    for (const char* it = arg; *it; it++) {
+        if (*it == '\'') {
+            buf_printf(*buf, "'\\''");
+        }
+        else {
+            buf_printf(*buf, "%c", *it);
+        }
+    }
+    buf_printf(*buf, "'");
+#endif
+}
+
+FILE* open_cc(void) {
+    char* cmd = NULL;
+    buf_printf(cmd, "%s -x %s - -x none -o", build_cc, gen_backend == BACKEND_ASM ? "assembler" : "c");
+    shell_quote(&cmd, build_out_path);
+    for (size_t i = 0; i < buf_len(build_cc_flags); i++) {
+        shell_quote(&cmd, build_cc_flags[i]);
+    }
+    FILE* fp = open_command(cmd);
+    if (!fp) {
+        fatal("Error running %s", cmd);
+    }
+    buf_free(cmd);
+    return fp;
+}
+
+// with --backend=obj there is nothing to compile, the C compiler driver only links the object
+int link_obj(const char* obj_path) {
+    char* cmd = NULL;
+    buf_printf(cmd, "%s -o", build_cc);
+    shell_quote(&cmd, build_out_path);
+    shell_quote(&cmd, obj_path);
+    for (size_t i = 0; i < buf_len(build_cc_flags); i++) {
+        shell_quote(&cmd, build_cc_flags[i]);
+    }
+    FILE* fp = open_command(cmd);
+    if (!fp) {
+        fatal("Error running %s", cmd);
+    }
+    buf_free(cmd);
+    return close_command(fp);
+}
+
+// fields sorted by decreasing alignment leave no padding between them
+size_t reordered_struct_size(Type* type, TypeField* reordered) {
+    size_t num_fields = type->aggregate.num_fields;
+    memcpy(reordered, type->aggregate.fields, num_fields * sizeof(TypeField));
+    for (size_t i = 1; i < num_fields; i++) {
+        TypeField field = reordered[i];
+        size_t j = i;
+        for (; j > 0 && reordered[j - 1].type->align < field.type->align; j--) {
+            reordered[j] = reordered[j - 1];
+        }
+        reordered[j] = field;
+    }
+    size_t size, align;
+    layout_struct_fields(num_fields, reordered, &size, &align);
+    return size;
+}
+
+void print_layout_report(void) {
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        Entity* entity = ordered_entities[i];
+        if (entity->e_type != ENTITY_TYPE || entity->decl->type != DECL_STRUCT || entity->type->type != TYPE_STRUCT) {
+            continue;
+        }
+        Type* type = entity->type;
+        size_t used = 0;
+        for (size_t k = 0; k < type->aggregate.num_fields; k++) {
+            used += type->aggregate.fields[k].type->size;
+        }
+        printf("struct %s: size %zu, align %zu, %zu byte(s) of padding\n", entity->name, type->size, type->align, type->size - used);
+        for (size_t k = 0; k < type->aggregate.num_fields; k++) {
+            TypeField field = type->aggregate.fields[k];
+            printf("  %6zu  %s\n", field.offset, type_to_cdecl(field.type, field.name));
+        }
+        TypeField* reordered = xmalloc(max(type->aggregate.num_fields, 1) * sizeof(TypeField));
+        size_t reordered_size = reordered_struct_size(type, reordered);
+        if (reordered_size < type->size) {
+            printf("  reordering to {");
+            for (size_t k = 0; k < type->aggregate.num_fields; k++) {
+                printf(k == 0 ? "%s" : ", %s", reordered[k].name);
+            }
+            printf("} gives size %zu, saving %zu byte(s)\n", reordered_size, type->size - reordered_size);
+        }
+        free(reordered);
+    }
+}
+
 const char* munch_compile_str(const char* src) {
     munch_init(src);
     DeclSet* declset = parse_stream();
+    if (num_errors) {
+        return NULL;
+    }
+    if (compile_mode == COMPILE_SYNTAX_ONLY) {
+        return "";
+    }
     install_decls(declset);
+    if (incremental) {
+        load_cache();
+    }
     complete_entities();
+    if (num_errors) {
+        return NULL;
+    }
+    if (layout_report) {
+        print_layout_report();
+    }
+    if (tree_shake) {
+        shake_entities();
+        if (num_errors) {
+            return NULL;
+        }
+    }
+    if (compile_mode == COMPILE_CHECK) {
+        return "";
+    }
+    if (build_out_path && !write_obj) {
+        gen_stream = open_cc();
+    }
     gen_all();
     return gen_buf;
 }
 
 bool munch_compile_file(const char* path) {
+    double start = time_now();
     char* src = read_file(path);
     if (!src) {
         src = " ";
     }
     src_path = path;
+    cache_path = change_ext(path, "mcache");
     const char* buf = munch_compile_str(src);
     if (!buf) {
         return false;
     }
-    char* out_path = change_ext(path, "c");
-    return write_file(out_path, buf, buf_len(buf));
+    if (dump_ir && compile_mode != COMPILE_SYNTAX_ONLY && !write_ir_dump(change_ext(path, "ir"))) {
+        return false;
+    }
+    if (compile_mode != COMPILE_FULL) {
+        return true;
+    }
+    if (gen_stream) {
+        double gen_end = time_now();
+        build_status = close_command(gen_stream);
+        gen_stream = NULL;
+        printf("Build: munch %.3fs, %s %.3fs after the C was generated\n", gen_end - start, build_cc, time_now() - gen_end);
+        if (build_status) {
+            printf("%s exited with status %d\n", build_cc, build_status);
+            return false;
+        }
+    }
+    else if (split_files) {
+        if (!write_split_files(path, split_files)) {
+            return false;
+        }
+    }
+    else if (write_obj) {
+        if (!write_elf_obj(change_ext(path, "o"), buf, buf_len(buf))) {
+            return false;
+        }
+        if (build_out_path) {
+            double obj_end = time_now();
+            build_status = link_obj(change_ext(path, "o"));
+            printf("Build: munch %.3fs, %s %.3fs to link\n", obj_end - start, build_cc, time_now() - obj_end);
+            if (build_status) {
+                printf("%s exited with status %d\n", build_cc, build_status);
+                return false;
+            }
+        }
+    }
+    else {
+        char* out_path = change_ext(path, gen_backend == BACKEND_ASM ? "s" : "c");
+        if (!write_file(out_path, buf, buf_len(buf))) {
+            return false;
+        }
+    }
+    if (incremental) {
+        printf("Incremental: reused %zu of %zu declarations\n", num_reused_entities, buf_len(ordered_entities));
+        return write_cache(cache_path);
+    }
+    return true;
 }
 
 const char* arg_src_path;
 
+void print_usage(void) {
+    printf("Usage: build -o <executable> <source file> [--cc <C compiler>] [options] [-- <C compiler flags>]\n");
+    printf("       <source file> [-W-no] [--syntax-only | --check] [--lazy-bodies] [--incremental] [--layout-report] [--tree-shake] [--roots=a,b,...] [--split=N] [--backend=c|ir|asm|obj] [--dump-ir] [--max-depth=N] [--max-errors=N] [--jobs=N]\n");
+    printf("  -W-no          disable warnings\n");
+    printf("  --syntax-only  only parse the source\n");
+    printf("  --check        only parse and resolve the source without generating C\n");
+    printf("  --lazy-bodies  parse function bodies only when they are referenced\n");
+    printf("  --incremental  reuse unchanged declarations from the .mcache of the last build\n");
+    printf("  --layout-report print the layout of every struct and a field order that removes padding\n");
+    printf("  --tree-shake   generate only the declarations reachable from main\n");
+    printf("  --roots=a,b,.. generate only the declarations reachable from the given ones\n");
+    printf("  --split=N      write a header and N .c files listed in a .manifest instead of one .c file\n");
+    printf("  --backend=ir   generate the C of function definitions from the linear IR\n");
+    printf("  --backend=asm  write x86-64 assembly generated from the linear IR to a .s file instead of C\n");
+    printf("  --backend=obj  assemble the x86-64 assembly into an ELF object file\n");
+    printf("  --dump-ir      write the linear IR of every function to a .ir file\n");
+    printf("  --max-depth=N  maximum nesting depth of exprs and stmnts (default %zu)\n", max_nesting_depth);
+    printf("  --max-errors=N stop after N errors, 0 for no limit (default %zu)\n", max_errors);
+    printf("  --jobs=N       threads for resolving and generating function bodies (default: number of cores)\n");
+}
+
 void parse_args(int argc, char** argv) {
-    if (argc != 2 && argc != 3) {
-        printf("Usage: <source file> [-W-no]");
+    num_jobs = default_num_jobs();
+    bool build = argc > 1 && strcmp(argv[1], "build") == 0;
+    for (int i = build ? 2 : 1; i < argc; i++) {
+        if (build && strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            build_out_path = argv[++i];
+        }
+        else if (build && strcmp(argv[i], "--cc") == 0 && i + 1 < argc) {
+            build_cc = argv[++i];
+        }
+        else if (build && strcmp(argv[i], "--") == 0) {
+            for (i++; i < argc; i++) {
+                buf_push(build_cc_flags, argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "-W-no") == 0) {
+            enable_warnings = false;
+        }
+        else if (strcmp(argv[i], "--lazy-bodies") == 0) {
+            lazy_func_bodies = true;
+        }
+        else if (strcmp(argv[i], "--incremental") == 0) {
+            // clean function bodies are skipped without being parsed
+            incremental = true;
+            lazy_func_bodies = true;
+        }
+        else if (strcmp(argv[i], "--layout-report") == 0) {
+            layout_report = true;
+        }
+        else if (strcmp(argv[i], "--syntax-only") == 0) {
+            compile_mode = COMPILE_SYNTAX_ONLY;
+        }
+        else if (strcmp(argv[i], "--check") == 0) {
+            compile_mode = COMPILE_CHECK;
+        }
+        else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+            max_nesting_depth = strtoull(argv[i] + 12, NULL, 10);
+        }
+        else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+            max_errors = strtoull(argv[i] + 13, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--tree-shake") == 0) {
+            tree_shake = true;
+        }
+        else if (strncmp(argv[i], "--roots=", 8) == 0) {
+            tree_shake = true;
+            for (const char* it = argv[i] + 8; *it;) {
+                const char* end = it;
+                while (*end && *end != ',') {
+                    end++;
+                }
+                if (end != it) {
+                    buf_push(tree_shake_roots, str_intern_range(it, end));
+                }
+                it = *end ? end + 1 : end;
+            }
+        }
+        else if (strncmp(argv[i], "--split=", 8) == 0) {
+            split_files = strtoull(argv[i] + 8, NULL, 10);
+            if (!split_files) {
+                print_usage();
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--backend=c") == 0) {
+            gen_backend = BACKEND_C;
+            write_obj = false;
+        }
+        else if (strcmp(argv[i], "--backend=ir") == 0) {
+            gen_backend = BACKEND_IR;
+            write_obj = false;
+        }
+        else if (strcmp(argv[i], "--backend=asm") == 0) {
+            gen_backend = BACKEND_ASM;
+            write_obj = false;
+        }
+        else if (strcmp(argv[i], "--backend=obj") == 0) {
+            // the object is assembled from the assembly of --backend=asm
+            gen_backend = BACKEND_ASM;
+            write_obj = true;
+        }
+        else if (strcmp(argv[i], "--dump-ir") == 0) {
+            dump_ir = true;
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            num_jobs = strtoull(argv[i] + 7, NULL, 10);
+        }
+        else if (argv[i][0] != '-' && !arg_src_path) {
+            arg_src_path = argv[i];
+        }
+        else {
+            print_usage();
+            exit(1);
+        }
+    }
+    // the split files are C
+    if (!arg_src_path || (build && (!build_out_path || compile_mode != COMPILE_FULL || split_files)) || (split_files && gen_backend == BACKEND_ASM)) {
+        print_usage();
         exit(1);
     }
-    if (argc == 3 && strcmp(argv[2], "-W-no") == 0) {
-        enable_warnings = false;
+    if (compile_mode == COMPILE_SYNTAX_ONLY) {
+        // skipping bodies would leave them unchecked
+        lazy_func_bodies = false;
+        incremental = false;
     }
-    arg_src_path = argv[1];
 }
 
 int munch_main(int argc, char** argv) {
     parse_args(argc, argv);
     bool status = munch_compile_file(arg_src_path);
+    report_diags();
     if (status) {
         puts("Compilation successful\n");
     }
-    else {
-        puts("Compilation failed\n");
+    else if (!build_status) {
+        printf("Compilation failed with %zu error(s)\n\n", num_errors);
     }
     printf("Collisions: %zu\n", collisions);
     printf("Map collisions: %zu\n", map_collisions);
@@ -57,7 +358,15 @@ int munch_main(int argc, char** argv) {
     printf("Intern map len: %zu\n", intern_map.len);
     printf("Intern map cap: %zu\n", intern_map.cap);
     printf("Intern arena size: %zu\n", ARENA_BLOCK_SIZE * buf_len(str_arena.blocks));
-    return status;
+    printf("Typespec interns : %zu\n", buf_len(ordered_typespecs));
+    printf("Typespec intern hits: %zu\n", typespec_intern_hits);
+    printf("Typespec resolves: %zu\n", typespec_resolves);
+    printf("Type interns     : %zu\n", interned_types.len);
+    printf("Type intern hits : %zu\n", type_intern_hits);
+    if (build_status) {
+        return build_status;
+    }
+    return status ? 0 : 1;
 }
 
 void munch_test(void) {
@@ -0,0 +1,75 @@
+# Builds the same programs with every backend and compares the exit codes of the executables,
+# so the C, IR, assembly and object backends cannot drift apart.
+#
+# usage: python backends.py [munch executable] [gen_source size]
+#
+# Run from munch_compiler/munch_test after building ../munch. Each program's main folds its
+# result into the exit code. The exit status is 1 when a build fails or the exit codes differ.
+
+import os
+import shutil
+import subprocess
+import sys
+
+from gen_source import gen_source
+
+OUT_DIR = 'backends_out'
+
+BACKENDS = ['c', 'ir', 'asm', 'obj']
+
+# calls every function gen_source generates for one (?)
+CORPUS_MAIN_ITEM = '''    h = h * 31 + fib(?)(10);
+    v(?) := vec_add(?)(one(?), {3, 4});
+    h = h * 31 + norm(?)(v(?)) + norm(?)(mul(?)(v(?), -2));
+    h = h * 31 + adj_sum(?)({5, 7}, norm(?));
+    h = h * 31 + grade(?)(10) + grade(?)(80);
+    do_nothing(?)('B');
+    h = h * 31 + facto_while(?)(5) + facto_do_while(?)(4) + facto_rec(?)(6);
+    h = h * 31 + is_prime(?)(97) + is_prime(?)(91) * 2;
+    h = h * 31 + xx(?) + yy(?) + zz(?) + basis(?)[1].x + zero_(?).y + vv(?).x + up(?) + down(?) + left(?) + right(?) + blah(?);
+'''
+
+
+def corpus(n):
+    items = ''.join(CORPUS_MAIN_ITEM.replace('(?)', str(i)) for i in range(n))
+    return (gen_source(n) + '\nfunc main(): int {\n    h := 0;\n' + items
+            + '    return (h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24)) & 255;\n}\n')
+
+
+def build_and_run(munch, name, source, backend):
+    # a copy per backend, --backend=obj writes its object next to the source
+    path = os.path.join(OUT_DIR, '{}_{}.mch'.format(name, backend))
+    with open(path, 'w') as out_f:
+        out_f.write(source)
+    exe = os.path.abspath(os.path.join(OUT_DIR, '{}_{}'.format(name, backend)))
+    proc = subprocess.run([munch, 'build', '-o', exe, path, '-W-no', '--backend=' + backend],
+                          stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                          universal_newlines=True)
+    if proc.returncode != 0 or not os.path.exists(exe):
+        sys.stdout.write(proc.stdout)
+        return None
+    return subprocess.run([exe], stdin=subprocess.DEVNULL).returncode
+
+
+def main():
+    argv = sys.argv[1:]
+    munch = os.path.abspath(argv[0] if argv else os.path.join('..', 'munch'))
+    n = int(argv[1]) if len(argv) > 1 else 1 << 6
+    if os.path.exists(OUT_DIR):
+        shutil.rmtree(OUT_DIR)
+    os.makedirs(OUT_DIR)
+    with open('backends.mch') as in_f:
+        programs = [('backends', in_f.read()), ('corpus_{}'.format(n), corpus(n))]
+    ok = True
+    for name, source in programs:
+        codes = [build_and_run(munch, name, source, backend) for backend in BACKENDS]
+        same = None not in codes and len(set(codes)) == 1
+        ok = ok and same
+        print('{:<16} {}  {}'.format(name, '  '.join('{}={}'.format(backend, 'failed' if code is None else code)
+                                                    for backend, code in zip(BACKENDS, codes)),
+                                     'ok' if same else 'MISMATCH'))
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
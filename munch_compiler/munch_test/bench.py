@@ -0,0 +1,147 @@
+# Generates benchmark sources and times the compiler on them.
+#
+# usage: python bench.py [--perf] [munch executable] [benchmark names...]
+#
+# Run from munch_compiler/munch_test after building ../munch. With --perf each run is wrapped
+# in `perf stat` and its cache references and misses are printed too.
+
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+from gen_source import gen_source
+
+OUT_DIR = 'bench_out'
+
+
+def op_chain(n):
+    # a single left associative operator chain of n operands
+    return 'func chain(x: int): int {\n    return x' + ' + x' * (n - 1) + ';\n}\n'
+
+
+def nested_parens(n):
+    # n levels of right nested parentheses, rejected by the default depth limit
+    return 'func nested(x: int): int {\n    return ' + '(x + ' * n + 'x' + ')' * n + ';\n}\n'
+
+
+def many_locals(n):
+    # n locals in one function, each referenced once after all are declared
+    decls = ''.join('    var v{} = {};\n'.format(i, i) for i in range(n))
+    uses = ''.join('    s = s + v{};\n'.format(i) for i in range(n))
+    return 'func locals(): int {\n' + decls + '    var s = 0;\n' + uses + '    return s;\n}\n'
+
+
+def var_chain(n):
+    # n global aggregates, each initialized from the previous two
+    decls = 'struct N {\n    a: int;\n    b: int;\n}\n\nvar n0: N = {1, 2}\nvar n1: N = {3, 4}\n'
+    decls += ''.join('var n{0}: N = n{1}.a < n{2}.b ? n{1} : n{2}\n'.format(i, i - 1, i - 2) for i in range(2, n))
+    return decls + '\nfunc main(): int {{\n    return n{}.a;\n}}\n'.format(n - 1)
+
+
+def wide_struct(n):
+    # a struct of n fields initialized by name and read field by field
+    fields = ''.join('    f{}: int;\n'.format(i) for i in range(n))
+    inits = ', '.join('f{} = {}'.format(i, i) for i in range(n))
+    reads = ''.join('    s = s + r.f{};\n'.format(i) for i in range(n))
+    return ('struct R {\n' + fields + '}\n\nfunc wide(): int {\n    var r: R = {' + inits + '};\n'
+            + '    var s = 0;\n' + reads + '    return s;\n}\n')
+
+
+def big_enum(n):
+    # one enum of n implicitly numbered items. its last item is resolved first, through a
+    # const declared before the enum
+    items = ''.join('    e{},\n'.format(i) for i in range(n))
+    return 'const last = e{}\n\nenum E {{\n'.format(n - 1) + items + '}\n\nfunc main(): int {\n    return last;\n}\n'
+
+
+def many_globals(n):
+    # n global consts and vars, each referencing the previous ones, read by n functions
+    decls = 'const c0 = 1\nvar g0 = c0\n'
+    decls += ''.join('const c{0} = c{1} + 1\nvar g{0} = c{0} + c{1}\n'.format(i, i - 1) for i in range(1, n))
+    funcs = ''.join('func f{0}(): int {{\n    return g{0} + c{0};\n}}\n'.format(i) for i in range(n))
+    return decls + '\n' + funcs
+
+
+def func_ptr_sigs(n):
+    # n functions whose params and locals are pointers to functions and arrays of them
+    head = 'struct V {\n    x: int;\n    y: int;\n}\n\ntypedef F = func(V*, int[4]):int\n\n'
+    funcs = ''.join(
+        'func h{0}(f: F, g: func(F*, char*):float*, a: F*[3], b: V[2]*): int {{\n'
+        '    var p = a[0];\n'
+        '    var q = h{1};\n'
+        '    var s = sizeof(:func(F[2], V*[3]):F*);\n'
+        '    return q(f, g, a, b) + s;\n'
+        '}}\n'.format(i, max(i - 1, 0)) for i in range(n))
+    return head + funcs
+
+
+BENCHMARKS = {
+    # cost of each phase on the gen_source.py corpus
+    'corpus_4k_syntax': (gen_source, 1 << 12, ['--syntax-only']),
+    'corpus_4k_check': (gen_source, 1 << 12, ['--check']),
+    'corpus_4k_check_1job': (gen_source, 1 << 12, ['--check', '--jobs=1']),
+    'corpus_4k_full': (gen_source, 1 << 12, []),
+    'corpus_4k_full_1job': (gen_source, 1 << 12, ['--jobs=1']),
+    'corpus_4k_tree_shake': (gen_source, 1 << 12, ['--roots=adj_sum0,grade0']),
+    # reuses the .mcache written by the previous run of this benchmark
+    'corpus_4k_incremental': (gen_source, 1 << 12, ['--incremental']),
+    'chain_1e5': (op_chain, 10 ** 5, []),
+    'chain_3e5': (op_chain, 3 * 10 ** 5, []),
+    'chain_1e6': (op_chain, 10 ** 6, []),
+    'nested_1e5': (nested_parens, 10 ** 5, []),
+    'locals_3e4_check': (many_locals, 3 * 10 ** 4, ['--check']),
+    'var_chain_1e4': (var_chain, 10 ** 4, []),
+    'wide_struct_3e4_check': (wide_struct, 3 * 10 ** 4, ['--check']),
+    'enum_1e5': (big_enum, 10 ** 5, []),
+    # entity heavy resolving and checking. run with --perf to see cache misses
+    'globals_1e5_check': (many_globals, 10 ** 5, ['--check']),
+    # codegen dominated by rendering C declarators
+    'func_ptr_3e4': (func_ptr_sigs, 3 * 10 ** 4, []),
+}
+
+
+PERF_EVENTS = 'cache-references,cache-misses'
+
+
+def run(munch, name, perf):
+    gen, n, args = BENCHMARKS[name]
+    path = os.path.join(OUT_DIR, '{}_{}.mch'.format(gen.__name__, n))
+    if not os.path.exists(path):
+        with open(path, 'w') as out_f:
+            out_f.write(gen(n))
+    cmd = [munch, path, '-W-no'] + args
+    perf_path = os.path.join(OUT_DIR, 'perf.txt')
+    if perf:
+        cmd = ['perf', 'stat', '-x', ',', '-e', PERF_EVENTS, '-o', perf_path] + cmd
+    start = time.perf_counter()
+    proc = subprocess.run(cmd, stdin=subprocess.DEVNULL,
+                          stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    elapsed = time.perf_counter() - start
+    status = 'ok' if proc.returncode == 0 else 'failed({})'.format(proc.returncode)
+    counters = ''
+    if perf:
+        with open(perf_path) as perf_f:
+            # csv lines of value,unit,event,...
+            fields = [line.split(',') for line in perf_f if line[:1].isdigit() or line.startswith('<')]
+        counters = '  ' + '  '.join('{}={}'.format(f[2], f[0]) for f in fields if len(f) > 2)
+    print('{:<24} n={:<10} {:>8.3f}s  {}{}'.format(name, n, elapsed, status, counters))
+
+
+def main():
+    argv = sys.argv[1:]
+    perf = '--perf' in argv
+    if perf:
+        argv.remove('--perf')
+        if not shutil.which('perf'):
+            sys.exit('perf is not installed')
+    munch = argv[0] if argv else os.path.join('..', 'munch')
+    names = argv[1:] or list(BENCHMARKS)
+    os.makedirs(OUT_DIR, exist_ok=True)
+    for name in names:
+        run(munch, name, perf)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,53 @@
+# Checks that the programs in errors/ are rejected with the expected errors. A line of a
+# program ending with "// error: <message>" expects that message to be reported at that line.
+#
+# usage: python errors.py [munch executable]
+#
+# Run from munch_compiler/munch_test after building ../munch. The exit status is 1 when an
+# expected error is missing or an unexpected one is reported.
+
+import os
+import re
+import subprocess
+import sys
+
+ERRORS_DIR = 'errors'
+
+EXPECTED_RE = re.compile(r'//\s*error:\s*(.*?)\s*$')
+REPORTED_RE = re.compile(r'ERROR\(.*:(\d+)\) (.*?)\s*$')
+
+
+def expected_errors(path):
+    with open(path) as in_f:
+        return {(i + 1, m.group(1)) for i, line in enumerate(in_f) for m in [EXPECTED_RE.search(line)] if m}
+
+
+def reported_errors(munch, path):
+    proc = subprocess.run([munch, '--check', '-W-no', '--max-errors=0', path],
+                          stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                          universal_newlines=True)
+    return proc.returncode, {(int(m.group(1)), m.group(2)) for m in map(REPORTED_RE.search, proc.stdout.splitlines()) if m}
+
+
+def main():
+    argv = sys.argv[1:]
+    munch = os.path.abspath(argv[0] if argv else os.path.join('..', 'munch'))
+    ok = True
+    for name in sorted(os.listdir(ERRORS_DIR)):
+        if not name.endswith('.mch'):
+            continue
+        path = os.path.join(ERRORS_DIR, name)
+        expected = expected_errors(path)
+        returncode, reported = reported_errors(munch, path)
+        same = expected == reported and (returncode != 0) == bool(expected)
+        ok = ok and same
+        print('{:<24} {}'.format(name, 'ok' if same else 'MISMATCH'))
+        for line, message in sorted(expected - reported):
+            print('    missing    {}: {}'.format(line, message))
+        for line, message in sorted(reported - expected):
+            print('    unexpected {}: {}'.format(line, message))
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
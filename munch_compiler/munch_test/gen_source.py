@@ -159,7 +159,11 @@ func is_prime(?)(n: int): int {
 
 '''
 
-N = 1 << 14
-with open('test{}.mch'.format(N), 'w') as out_f:
-    for i in range(N):
-        out_f.write(source.replace('(?)', str(i)))
\ No newline at end of file
+def gen_source(n):
+    return ''.join(source.replace('(?)', str(i)) for i in range(n))
+
+
+if __name__ == '__main__':
+    N = 1 << 14
+    with open('test{}.mch'.format(N), 'w') as out_f:
+        out_f.write(gen_source(N))
@@ -6,6 +6,19 @@ Expr* parse_expr_cmp(void);
 Stmnt* parse_stmnt_simple(void);
 
 BlockStmnt parse_blockstmnt(void);
+Stmnt* parse_stmnt_recover(void);
+
+size_t parse_depth = 0;
+
+void enter_parse_nesting(void) {
+    if (++parse_depth > max_nesting_depth) {
+        syntax_error("Nesting depth exceeds the limit of %zu. Use --max-depth to raise it", max_nesting_depth);
+    }
+}
+
+void leave_parse_nesting(void) {
+    parse_depth--;
+}
 
 const char* parse_name(void) {
     const char* name = token.name;
@@ -49,6 +62,7 @@ TypeSpec* parse_type_base(void) {
 }
 
 TypeSpec* parse_typespec(void) {
+    enter_parse_nesting();
     TypeSpec* type = parse_type_base();
     while (true) {
         if (match_token('[')) {
@@ -63,6 +77,7 @@ TypeSpec* parse_typespec(void) {
             break;
         }
     }
+    leave_parse_nesting();
     return type;
 }
 
@@ -178,7 +193,10 @@ Expr* parse_expr_operand(void) {
 
 Expr* parse_expr_base(void) {
     Expr* operand_expr = parse_expr_operand();
+    size_t saved_parse_depth = parse_depth;
     while (true) {
+        // each postfix op nests the operand one level deeper
+        enter_parse_nesting();
         if (match_token('(')) {
             Expr** args = NULL;
             if (!is_token(')')) {
@@ -207,6 +225,7 @@ Expr* parse_expr_base(void) {
             break;
         }
     }
+    parse_depth = saved_parse_depth;
     return operand_expr;
 }
 
@@ -214,7 +233,10 @@ Expr* parse_expr_unary(void) {
     if (is_unary_op()) {
         TokenType unary_op = token.type;
         next_token();
-        return expr_unary(EXPR_PRE_UNARY, unary_op, parse_expr_unary());
+        enter_parse_nesting();
+        Expr* expr = expr_unary(EXPR_PRE_UNARY, unary_op, parse_expr_unary());
+        leave_parse_nesting();
+        return expr;
     }
     return parse_expr_base();
 }
@@ -300,14 +322,16 @@ Expr* parse_expr_or(void) {
 }
 
 Expr* parse_expr_ternary(void) {
-    Expr* or_expr = parse_expr_or();
+    enter_parse_nesting();
+    Expr* expr = parse_expr_or();
     if (match_token('?')) {
         Expr* left = parse_expr_ternary();
         expect_token(':');
         Expr* right = parse_expr_ternary();
-        return expr_ternary(or_expr, left, right);
+        expr = expr_ternary(expr, left, right);
     }
-    return or_expr;
+    leave_parse_nesting();
+    return expr;
 }
 
 Expr* parse_expr(void) {
@@ -391,7 +415,7 @@ Stmnt* parse_stmnt_do(void) {
 Stmnt* parse_for_update(void) {
     Stmnt* stmnt = parse_stmnt_simple();
     if (stmnt->type != STMNT_ASSIGN && stmnt->type != STMNT_EXPR) {
-        basic_syntax_error("Expected an assign statement or expression. Found <STMNT %d>", stmnt->type);
+        syntax_error("Expected an assign statement or expression. Found <STMNT %d>", stmnt->type);
     }
     return stmnt;
 }
@@ -445,7 +469,7 @@ BlockStmnt parse_blockstmnt(void) {
     expect_token('{');
     Stmnt** stmnts = NULL;
     while (!is_token('}')) {
-        buf_push(stmnts, parse_stmnt());
+        buf_push(stmnts, parse_stmnt_recover());
     }
     expect_token('}');
     return (BlockStmnt) { buf_len(stmnts), stmnts };
@@ -455,7 +479,7 @@ Stmnt* parse_stmnt_block(void) {
     expect_token('{');
     Stmnt** stmnts = NULL;
     while (!is_token('}')) {
-        Stmnt* stmnt = parse_stmnt();
+        Stmnt* stmnt = parse_stmnt_recover();
         if(stmnt) buf_push(stmnts, stmnt);
     }
     expect_token('}');
@@ -490,7 +514,7 @@ Stmnt* parse_stmnt_decl(void) {
     return stmnt_decl(decl);
 }
 
-Stmnt* parse_stmnt(void) {
+Stmnt* parse_stmnt_base(void) {
     if (match_keyword(kwrd_if)) {
         return parse_stmnt_ifelseif();
     }
@@ -530,6 +554,66 @@ Stmnt* parse_stmnt(void) {
     }
 }
 
+Stmnt* parse_stmnt(void) {
+    enter_parse_nesting();
+    Stmnt* stmnt = parse_stmnt_base();
+    leave_parse_nesting();
+    return stmnt;
+}
+
+// skips the rest of a broken stmnt up to its ';' or the end of its block. returns false when
+// it runs into a func or the end of file, which is left to the decl level recovery
+bool sync_stmnt(const char* start) {
+    if (token.start == start && !is_token('}')) {
+        next_token();
+    }
+    size_t depth = 0;
+    while (!is_token(TOKEN_EOF) && !is_keyword(kwrd_func)) {
+        if (is_token('{')) {
+            depth++;
+        }
+        else if (is_token('}')) {
+            if (depth == 0) {
+                return true;
+            }
+            if (--depth == 0) {
+                next_token();
+                return true;
+            }
+        }
+        else if (is_token(';') && depth == 0) {
+            next_token();
+            return true;
+        }
+        next_token();
+    }
+    return false;
+}
+
+Stmnt* parse_stmnt_recover(void) {
+    jmp_buf env;
+    jmp_buf* outer = syntax_recover;
+    const char* start = token.start;
+    size_t depth = parse_depth;
+    syntax_recover = &env;
+    if (setjmp(env)) {
+        // a syntax error while syncing lands here again with the stream already advanced
+        parse_depth = depth;
+        bool synced = sync_stmnt(start);
+        syntax_recover = outer;
+        if (!synced) {
+            if (outer) {
+                longjmp(*outer, 1);
+            }
+            exit_with_diags();
+        }
+        return NULL;
+    }
+    Stmnt* stmnt = parse_stmnt();
+    syntax_recover = outer;
+    return stmnt;
+}
+
 EnumItem parse_enum_item(void) {
     const char* name = parse_name();
     if (match_token('=')) {
@@ -551,17 +635,19 @@ Decl* parse_decl_enum(void) {
     return decl_enum(name, buf_len(enum_items), enum_items);
 }
 
+// typespecs are shared between their spellings, so a use keeps its own location
 AggregateItem parse_aggregate_item(void) {
+    SrcLoc loc = { src_path, line_num };
     const char* name = parse_name();
     if (match_token(':')) {
         TypeSpec* type = parse_typespec();
         if (match_token('=')) {
-            return (AggregateItem) { name, type, parse_expr() };
+            return (AggregateItem) { name, type, parse_expr(), loc };
         }
-        return (AggregateItem) { name, type, NULL };
+        return (AggregateItem) { name, type, NULL, loc };
     }
     expect_token('=');
-    return (AggregateItem) { name, NULL, parse_expr() };
+    return (AggregateItem) { name, NULL, parse_expr(), loc };
 }
 
 Decl* parse_aggregate(DeclType type) {
@@ -618,10 +704,95 @@ Decl* parse_decl_typedef(void) {
 }
 
 FuncParam parse_func_param(void) {
+    SrcLoc loc = { src_path, line_num };
     const char* name = parse_name();
     expect_token(':');
     TypeSpec* type = parse_typespec();
-    return (FuncParam) { name, type };
+    return (FuncParam) { name, type, loc };
+}
+
+bool lazy_func_bodies = false;
+
+// skips a block by matching braces on the raw source without building any ast
+void skip_blockstmnt(void) {
+    if (!is_token('{')) {
+        syntax_error("Expected token {. Found %s.", token_to_str(token));
+    }
+    size_t depth = 1;
+    while (depth) {
+        switch (*stream) {
+        case 0:
+            syntax_error("Unexpected end of file in the block starting at line %zu", line_num);
+            break;
+        case '\n':
+            line_num++;
+            stream++;
+            break;
+        case '{':
+            depth++;
+            stream++;
+            break;
+        case '}':
+            depth--;
+            stream++;
+            break;
+        case '"': case '\'': {
+            char quote = *stream++;
+            while (*stream && *stream != quote) {
+                if (*stream == '\\' && stream[1]) {
+                    stream++;
+                }
+                if (*stream == '\n') {
+                    line_num++;
+                }
+                stream++;
+            }
+            if (*stream) {
+                stream++;
+            }
+            break;
+        }
+        case '/':
+            stream++;
+            if (*stream == '/') {
+                while (*stream && *stream != '\n') stream++;
+            }
+            else if (*stream == '*') {
+                stream++;
+                while (*stream && !(stream[0] == '*' && stream[1] == '/')) {
+                    if (*stream == '\n') {
+                        line_num++;
+                    }
+                    stream++;
+                }
+                if (*stream) {
+                    stream += 2;
+                }
+            }
+            break;
+        default:
+            stream++;
+        }
+    }
+    next_token();
+}
+
+void parse_func_body(Decl* decl) {
+    assert(decl->type == DECL_FUNC);
+    if (!decl->func_decl.lazy_body) {
+        return;
+    }
+    Token saved_token = token;
+    const char* saved_stream = stream;
+    size_t saved_line_num = line_num;
+    stream = decl->func_decl.lazy_body;
+    line_num = decl->func_decl.lazy_line_num;
+    next_token();
+    decl->func_decl.block = parse_blockstmnt();
+    decl->func_decl.lazy_body = NULL;
+    token = saved_token;
+    stream = saved_stream;
+    line_num = saved_line_num;
 }
 
 Decl* parse_decl_func(void) {
@@ -636,13 +807,26 @@ Decl* parse_decl_func(void) {
     }
     expect_token(')');
     TypeSpec* ret_type = NULL;
+    SrcLoc ret_loc = { src_path, line_num };
     if (match_token(':')) {
         ret_type = parse_typespec();
     }
     else {
         ret_type = typespec_name(str_intern("void"));
     }
-    return decl_func(name, buf_len(func_params), func_params, ret_type, parse_blockstmnt());
+    if (lazy_func_bodies) {
+        const char* body = token.start;
+        size_t body_line_num = line_num;
+        skip_blockstmnt();
+        Decl* decl = decl_func(name, buf_len(func_params), func_params, ret_type, (BlockStmnt) { 0, NULL });
+        decl->func_decl.ret_loc = ret_loc;
+        decl->func_decl.lazy_body = body;
+        decl->func_decl.lazy_line_num = body_line_num;
+        return decl;
+    }
+    Decl* decl = decl_func(name, buf_len(func_params), func_params, ret_type, parse_blockstmnt());
+    decl->func_decl.ret_loc = ret_loc;
+    return decl;
 }
 
 Decl* parse_decl(void) {
@@ -671,10 +855,58 @@ Decl* parse_decl(void) {
     return NULL;
 }
 
+bool is_top_decl_keyword(void) {
+    return is_keyword(kwrd_func) || is_keyword(kwrd_struct) || is_keyword(kwrd_union) || is_keyword(kwrd_enum)
+        || is_keyword(kwrd_const) || is_keyword(kwrd_var) || is_keyword(kwrd_typedef);
+}
+
+// skips to the next top level decl keyword. braces are tracked so that locals of a broken
+// func are not taken as globals
+void sync_decl(const char* start) {
+    if (token.start == start) {
+        next_token();
+    }
+    size_t depth = 0;
+    while (!is_token(TOKEN_EOF) && !is_keyword(kwrd_func) && !(depth == 0 && is_top_decl_keyword())) {
+        if (is_token('{')) {
+            depth++;
+        }
+        else if (is_token('}') && depth) {
+            depth--;
+        }
+        next_token();
+    }
+}
+
+Decl* parse_decl_recover(void) {
+    jmp_buf env;
+    jmp_buf* outer = syntax_recover;
+    const char* start = token.start;
+    size_t depth = parse_depth;
+    syntax_recover = &env;
+    if (setjmp(env)) {
+        parse_depth = depth;
+        sync_decl(start);
+        syntax_recover = outer;
+        return NULL;
+    }
+    Decl* decl = parse_decl();
+    syntax_recover = outer;
+    const char* end = token.start;
+    while (end > start && isspace(end[-1])) {
+        end--;
+    }
+    decl->src_hash = str_hash(start, end - start);
+    return decl;
+}
+
 DeclSet* parse_stream(void) {
     Decl** decls = NULL;
     while (token.type != TOKEN_EOF) {
-        buf_push(decls, parse_decl());
+        Decl* decl = parse_decl_recover();
+        if (decl) {
+            buf_push(decls, decl);
+        }
     }
     return declset(decls, buf_len(decls));
 }
@@ -184,7 +184,9 @@ void print_typespec(TypeSpec* typespec) {
     }
 }
 
-void print_expr(Expr* expr) {
+size_t print_depth = 0;
+
+void print_expr_nested(Expr* expr) {
     switch (expr->type) {
     case EXPR_TERNARY:
         printf("(");
@@ -195,15 +197,26 @@ void print_expr(Expr* expr) {
         print_expr(expr->ternary_expr.right);
         printf(")");
         break;
-    case EXPR_BINARY:
-        printf("(");
-        print_op(expr->binary_expr.op);
-        printf(" ");
-        print_expr(expr->binary_expr.left);
-        printf(" ");
-        print_expr(expr->binary_expr.right);
-        printf(")");
+    case EXPR_BINARY: {
+        // the left spine is printed with an explicit stack
+        size_t base = buf_len(expr_stack);
+        Expr* left_expr = expr;
+        while (left_expr->type == EXPR_BINARY) {
+            buf_push(expr_stack, left_expr);
+            printf("(");
+            print_op(left_expr->binary_expr.op);
+            printf(" ");
+            left_expr = left_expr->binary_expr.left;
+        }
+        print_expr(left_expr);
+        for (size_t i = buf_len(expr_stack); i-- > base;) {
+            printf(" ");
+            print_expr(expr_stack[i]->binary_expr.right);
+            printf(")");
+        }
+        _buf_hdr(expr_stack)->len = base;
         break;
+    }
     case EXPR_PRE_UNARY:
         print_op(expr->pre_unary_expr.op);
         print_expr(expr->pre_unary_expr.expr);
@@ -299,6 +312,16 @@ void print_expr(Expr* expr) {
     }
 }
 
+void print_expr(Expr* expr) {
+    if (print_depth >= max_nesting_depth) {
+        printf("...");
+        return;
+    }
+    print_depth++;
+    print_expr_nested(expr);
+    print_depth--;
+}
+
 void print_decl(Decl* decl) {
     switch (decl->type) {
     case DECL_ENUM:
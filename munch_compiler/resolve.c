@@ -1,18 +1,34 @@
 typedef struct Type Type;
 typedef struct Entity Entity;
+typedef struct TypeCDecl TypeCDecl;
 
 bool enable_warnings = true;
 
+// innermost entity, stmnt or typespec being resolved. an error unwinds to it. a failed entity
+// or stmnt is poisoned so that its users fail silently instead of reporting again
+THREAD_LOCAL jmp_buf* resolve_recover = NULL;
+
+void resolve_abort(void) {
+    if (resolve_recover) {
+        longjmp(*resolve_recover, 1);
+    }
+    exit_with_diags();
+}
+
+#define report_resolve_error(loc, fmt, ...) \
+    error_at("RESOLVE ERROR", (loc).src_name, (loc).line_num, fmt, ##__VA_ARGS__)
+
 #define resolve_error(loc, fmt, ...) \
     do { \
-        printf("RESOLVE_ERROR(%s:%zu) ", (loc).src_name ? (loc).src_name : "", (loc).line_num); \
-        fatal(fmt, ##__VA_ARGS__); \
+        report_resolve_error(loc, fmt, ##__VA_ARGS__); \
+        resolve_abort(); \
     } while(0)
 
 #define resolve_warning(loc, fmt, ...) \
     do { \
-        printf("RESOLVE_WARNING(%s:%zu) ", (loc).src_name ? (loc).src_name : "", (loc).line_num); \
-        warning(fmt, ##__VA_ARGS__); \
+        if (enable_warnings) { \
+            warning_at((loc).src_name, (loc).line_num, fmt, ##__VA_ARGS__); \
+        } \
     } while(0)
 
 typedef enum TypeType {
@@ -28,12 +44,14 @@ typedef enum TypeType {
     TYPE_STRUCT,
     TYPE_UNION,
     TYPE_ARRAY,
-    TYPE_ENUM
+    TYPE_ENUM,
+    TYPE_POISON
 } TypeType;
 
 typedef struct TypeField {
     Type* type;
     const char* name;
+    size_t offset;
 } TypeField;
 
 typedef struct PtrType {
@@ -49,6 +67,7 @@ typedef struct FuncType {
 typedef struct AggregateType {
     size_t num_fields;
     TypeField* fields;
+    Map field_indices; // name -> index + 1, only for aggregates of FIELD_INDEX_MIN_FIELDS or more
 } AggregateType;
 
 typedef struct ArrayType {
@@ -59,7 +78,9 @@ typedef struct ArrayType {
 struct Type {
     TypeType type;
     size_t size;
+    size_t align;
     Entity* entity;
+    TypeCDecl* cdecl; // rendered by gen on first use. see type_cdecl
     union {
         PtrType ptr;
         FuncType func;
@@ -68,8 +89,13 @@ struct Type {
     };
 };
 
+// types and their params and fields live as long as the compilation. outside of phase one
+// of the resolver it is only touched with type_mutex held
+Arena type_arena;
+
 Type* type_alloc(TypeType type_type) {
-    Type* type = xcalloc(1, sizeof(Type));
+    Type* type = arena_alloc(&type_arena, sizeof(Type));
+    memset(type, 0, sizeof(Type));
     type->type = type_type;
     return type;
 }
@@ -80,95 +106,176 @@ Type* type_alloc(TypeType type_type) {
 #define FLOAT_SIZE 4
 #define PTR_SIZE 8
 
-Type* type_void = &(Type) { .type = TYPE_VOID, .size = VOID_SIZE };
-Type* type_char = &(Type) { .type = TYPE_CHAR, .size = CHAR_SIZE };
-Type* type_int = &(Type){ .type = TYPE_INT, .size = INT_SIZE };
-Type* type_float = &(Type) { .type = TYPE_FLOAT, .size = FLOAT_SIZE };
+Type* type_void = &(Type) { .type = TYPE_VOID, .size = VOID_SIZE, .align = 1 };
+Type* type_char = &(Type) { .type = TYPE_CHAR, .size = CHAR_SIZE, .align = CHAR_SIZE };
+Type* type_int = &(Type){ .type = TYPE_INT, .size = INT_SIZE, .align = INT_SIZE };
+Type* type_float = &(Type) { .type = TYPE_FLOAT, .size = FLOAT_SIZE, .align = FLOAT_SIZE };
 
-typedef struct CachedPtrType {
-    Type* base;
-    Type* ptr;
-} CachedPtrType;
+// Type interning ===
 
-typedef struct CachedArrayType {
-    Type* base;
-    size_t size;
-    Type* array;
-} CachedArrayType;
+// Pointer, array and func types are interned structurally so that the resolver can compare
+// types with ==. The full key is compared on a hash hit, so colliding signatures stay distinct.
 
-typedef struct CachedFuncType {
-    size_t num_params;
-    Type** params;
-    Type* ret;
-    Type* func;
-} CachedFuncType;
+typedef struct InternType {
+    Type* type;
+    struct InternType* next;
+} InternType;
+
+// function bodies are resolved in parallel, and any of them can derive a new type
+Mutex type_mutex = MUTEX_INIT;
+Map interned_types;
+size_t type_intern_hits = 0;
+
+uint64_t type_hash(const Type* type) {
+    uint64_t hash = 14695981039346656037ull;
+    hash ^= type->type;
+    hash *= 1099511628211;
+    switch (type->type) {
+    case TYPE_PTR:
+        hash ^= ptr_hash(type->ptr.base);
+        hash *= 1099511628211;
+        break;
+    case TYPE_ARRAY:
+        hash ^= ptr_hash(type->array.base);
+        hash *= 1099511628211;
+        hash ^= ptr_hash((void*)type->array.size);
+        hash *= 1099511628211;
+        break;
+    case TYPE_FUNC:
+        for (size_t i = 0; i < type->func.num_params; i++) {
+            hash ^= ptr_hash(type->func.params[i]);
+            hash *= 1099511628211;
+        }
+        hash ^= ptr_hash(type->func.ret);
+        hash *= 1099511628211;
+        break;
+    default:
+        assert(0);
+    }
+    return hash | 1;
+}
 
-Map cached_ptr_types;
+bool type_equals(const Type* a, const Type* b) {
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+    case TYPE_PTR:
+        return a->ptr.base == b->ptr.base;
+    case TYPE_ARRAY:
+        return a->array.base == b->array.base && a->array.size == b->array.size;
+    case TYPE_FUNC:
+        return a->func.ret == b->func.ret && a->func.num_params == b->func.num_params
+            && memcmp(a->func.params, b->func.params, a->func.num_params * sizeof(Type*)) == 0;
+    default:
+        assert(0);
+        return false;
+    }
+}
 
-Type* type_ptr(Type* base) {
-    Type* ptr_type = map_get(&cached_ptr_types, base);
-    if (ptr_type) {
-        return ptr_type;
-    }
-    Type* type = type_alloc(TYPE_PTR);
-    type->ptr.base = base;
-    type->size = PTR_SIZE;
-    map_put(&cached_ptr_types, base, type);
+Type* type_intern(const Type* key) {
+    uint64_t hash = type_hash(key);
+    mutex_lock(&type_mutex);
+    InternType* intern = map_get_hashed(&interned_types, (void*)hash, hash);
+    for (InternType* it = intern; it; it = it->next) {
+        if (type_equals(it->type, key)) {
+            type_intern_hits++;
+            mutex_unlock(&type_mutex);
+            return it->type;
+        }
+    }
+    Type* type = type_alloc(key->type);
+    *type = *key;
+    if (type->type == TYPE_FUNC) {
+        type->func.params = arena_alloc(&type_arena, key->func.num_params * sizeof(Type*));
+        memcpy(type->func.params, key->func.params, key->func.num_params * sizeof(Type*));
+    }
+    InternType* new_intern = arena_alloc(&type_arena, sizeof(InternType));
+    new_intern->type = type;
+    new_intern->next = intern;
+    map_put_hashed(&interned_types, (void*)hash, new_intern, hash);
+    mutex_unlock(&type_mutex);
     return type;
 }
 
-Map cached_array_types;
+Type* type_ptr(Type* base) {
+    return type_intern(&(Type) { .type = TYPE_PTR, .size = PTR_SIZE, .align = PTR_SIZE, .ptr = { base } });
+}
 
 Type* type_array(Type* base, size_t size) {
-    Type* array_type = map_get_ptr_uint(&cached_array_types, (void*)base, size);
-    if (array_type) {
-        return array_type;
-    }
-    Type* type = type_alloc(TYPE_ARRAY);
-    type->array.base = base;
-    type->array.size = size;
-    type->size = size * base->size;
-    map_put_ptr_uint(&cached_array_types, (void*)base, size, type);
-    return type;
+    return type_intern(&(Type) { .type = TYPE_ARRAY, .size = size * base->size, .align = base->align, .array = { base, size } });
 }
 
-Map cached_func_types;
-
 Type* type_func(size_t num_params, Type** params, Type* ret) {
-    Type* func_type = map_get_key_list(&cached_func_types, (void**)params, num_params, ret);
-    if (func_type) {
-        return func_type;
-    }
-    Type* type = type_alloc(TYPE_FUNC);
-    type->func.num_params = num_params;
-    type->func.params = xcalloc(num_params, sizeof(Type*));
-    memcpy(type->func.params, params, num_params * sizeof(Type*));
-    type->func.ret = ret;
-    type->size = PTR_SIZE;
-    map_put_key_list(&cached_func_types, (void**)params, num_params, ret, type);
-    return type;
+    return type_intern(&(Type) { .type = TYPE_FUNC, .size = PTR_SIZE, .align = PTR_SIZE, .func = { num_params, params, ret } });
 }
 
-void type_struct(Type* type, size_t num_fields, TypeField* fields) {
-    type->type = TYPE_STRUCT;
-    type->size = 0;
+size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// lays the fields out in order the way the C compiler does: each field at the next offset
+// that is a multiple of its alignment, and the struct padded to a multiple of its own
+// alignment, which is the largest alignment of its fields
+void layout_struct_fields(size_t num_fields, TypeField* fields, size_t* size, size_t* align) {
+    *size = 0;
+    *align = 1;
     for (TypeField* it = fields; it != fields + num_fields; it++) {
-        type->size += it->type->size;
+        it->offset = align_up(*size, it->type->align);
+        *size = it->offset + it->type->size;
+        *align = max(*align, it->type->align);
+    }
+    *size = align_up(*size, *align);
+}
+
+// narrower aggregates are scanned, which is faster than hashing for a few fields
+#define FIELD_INDEX_MIN_FIELDS 16
+
+void index_aggregate_fields(Type* type) {
+    if (type->aggregate.num_fields < FIELD_INDEX_MIN_FIELDS) {
+        return;
+    }
+    for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+        map_put(&type->aggregate.field_indices, (void*)type->aggregate.fields[i].name, (void*)(i + 1));
+    }
+}
+
+// SIZE_MAX when the aggregate has no such field
+size_t aggregate_field_index(Type* type, const char* name) {
+    if (type->aggregate.num_fields >= FIELD_INDEX_MIN_FIELDS) {
+        return (size_t)map_get(&type->aggregate.field_indices, (void*)name) - 1;
+    }
+    for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+        if (type->aggregate.fields[i].name == name) {
+            return i;
+        }
     }
+    return SIZE_MAX;
+}
+
+void type_struct(Type* type, size_t num_fields, TypeField* fields) {
+    type->type = TYPE_STRUCT;
+    layout_struct_fields(num_fields, fields, &type->size, &type->align);
     type->aggregate.num_fields = num_fields;
-    type->aggregate.fields = xcalloc(num_fields, sizeof(TypeField));
+    type->aggregate.fields = arena_alloc(&type_arena, num_fields * sizeof(TypeField));
     memcpy(type->aggregate.fields, fields, num_fields * sizeof(TypeField));
+    index_aggregate_fields(type);
 }
 
 void type_union(Type* type, size_t num_fields, TypeField* fields) {
     type->type = TYPE_UNION;
     type->size = 0;
+    type->align = 1;
     for (TypeField* it = fields; it != fields + num_fields; it++) {
+        it->offset = 0;
         type->size = max(type->size, it->type->size);
+        type->align = max(type->align, it->type->align);
     }
+    type->size = align_up(type->size, type->align);
     type->aggregate.num_fields = num_fields;
-    type->aggregate.fields = xcalloc(num_fields, sizeof(TypeField));
+    type->aggregate.fields = arena_alloc(&type_arena, num_fields * sizeof(TypeField));
     memcpy(type->aggregate.fields, fields, num_fields * sizeof(TypeField));
+    index_aggregate_fields(type);
 }
 
 Type* type_incomplete(Entity* entity) {
@@ -193,72 +300,382 @@ typedef enum EntityState {
     ENTITY_STATE_RESOLVED
 } EntityState;
 
+typedef enum DepKind {
+    DEP_REF = 0,
+    DEP_USE = 1 << 0,
+    DEP_SET = 1 << 1
+} DepKind;
+
+typedef struct EntityDep {
+    Entity* entity;
+    int kinds;
+} EntityDep;
+
+typedef struct CachedEntity CachedEntity;
+
+// the fields of a global entity that are only read for diagnostics and by incremental builds.
+// kept apart from Entity so that the resolver and gen passes over the entities touch less memory
+typedef struct EntityInfo {
+    SrcLoc loc;
+    size_t enum_index; // of an enum const in the enum decl
+    // incremental builds. see cache.c
+    uint64_t src_hash;
+    EntityDep* deps;
+    CachedEntity* cached; // set when neither the entity nor anything it depends on changed
+    size_t forward_start, forward_end;
+    size_t def_start, def_end;
+} EntityInfo;
+
+// one cache line on 64 bit targets
 struct Entity {
     EntityType e_type;
     EntityState state;
     const char* name;
     Decl* decl;
     Type* type;
-    int64_t value;
-    bool is_folded;
+    Val val;
     bool is_set;
     bool is_used;
-    SrcLoc loc;
+    bool is_poisoned;
+    bool is_reachable; // from the tree shaking roots
+    EntityInfo* info; // NULL for locals
+};
+
+typedef struct CachedDep {
+    const char* name;
+    int kinds;
+} CachedDep;
+
+// what an incremental build kept of an entity from the last build. see cache.c
+struct CachedEntity {
+    const char* name;
+    uint64_t src_hash;
+    CachedDep* deps;
+    const char* forward;
+    size_t forward_len;
+    const char* def;
+    size_t def_len;
 };
 
 typedef struct ResolvedExpr {
-    int64_t value;
+    Val val; // VAL_NONE unless the expr is evaluable at compile time
     Type* type;
     bool is_lvalue;
     bool is_const;
-    bool is_folded;
 } ResolvedExpr;
 
+// Const evaluation ===
+
+// values follow the C types they are generated as. int wraps at 32 bits, char at 8 bits and a
+// float is rounded to single precision after every operation
+
+Val val_int(int64_t i) {
+    return (Val) { .kind = VAL_INT, .i = (int32_t)i };
+}
+
+Val val_char(int64_t c) {
+    return (Val) { .kind = VAL_CHAR, .i = (char)c };
+}
+
+Val val_float(double f) {
+    return (Val) { .kind = VAL_FLOAT, .f = (float)f };
+}
+
+Val val_null(void) {
+    return (Val) { .kind = VAL_NULL };
+}
+
+Val val_aggregate(size_t num_items) {
+    return (Val) { .kind = VAL_AGGREGATE, .items = xcalloc(num_items ? num_items : 1, sizeof(Val)) };
+}
+
+bool is_folded(ResolvedExpr r_expr) {
+    return r_expr.val.kind != VAL_NONE;
+}
+
+Val val_zero(Type* type) {
+    switch (type->type) {
+    case TYPE_INT:
+        return val_int(0);
+    case TYPE_CHAR:
+        return val_char(0);
+    case TYPE_FLOAT:
+        return val_float(0);
+    case TYPE_PTR:
+        return val_null();
+    case TYPE_STRUCT:
+    case TYPE_UNION:
+        return val_aggregate(type->aggregate.num_fields);
+    case TYPE_ARRAY:
+        return val_aggregate(type->array.size);
+    default:
+        return (Val) { VAL_NONE };
+    }
+}
+
+Val eval_const_item(Val aggregate, size_t i, Type* item_type) {
+    assert(aggregate.kind == VAL_AGGREGATE);
+    Val item = aggregate.items[i];
+    return item.kind == VAL_NONE ? val_zero(item_type) : item;
+}
+
+// an aggregate is folded only when all of its items are
+void fold_compound_item(Val* aggregate, size_t i, Val item) {
+    if (aggregate->kind != VAL_AGGREGATE) {
+        return;
+    }
+    if (item.kind == VAL_NONE) {
+        free(aggregate->items);
+        *aggregate = (Val) { VAL_NONE };
+        return;
+    }
+    aggregate->items[i] = item;
+}
+
+// only the casts that C accepts in constant expressions are folded
+Val eval_const_cast(Type* type, Val val) {
+    bool is_float = val.kind == VAL_FLOAT;
+    if (val.kind != VAL_INT && val.kind != VAL_CHAR && !is_float && val.kind != VAL_NULL) {
+        return (Val) { VAL_NONE };
+    }
+    switch (type->type) {
+    case TYPE_INT:
+        if (is_float) {
+            return val.f > -2147483649.0 && val.f < 2147483648.0 ? val_int((int64_t)val.f) : (Val) { VAL_NONE };
+        }
+        return val.kind == VAL_NULL ? (Val) { VAL_NONE } : val_int(val.i);
+    case TYPE_CHAR:
+        if (is_float) {
+            return val.f > -129.0 && val.f < 128.0 ? val_char((int64_t)val.f) : (Val) { VAL_NONE };
+        }
+        return val.kind == VAL_NULL ? (Val) { VAL_NONE } : val_char(val.i);
+    case TYPE_FLOAT:
+        if (val.kind == VAL_NULL) {
+            return (Val) { VAL_NONE };
+        }
+        return val_float(is_float ? val.f : (double)val.i);
+    case TYPE_PTR:
+        return val.kind == VAL_NULL || (!is_float && val.i == 0) ? val_null() : (Val) { VAL_NONE };
+    default:
+        return (Val) { VAL_NONE };
+    }
+}
+
+Val eval_const_unary_expr(TokenType op, Val val) {
+    if (val.kind == VAL_FLOAT) {
+        assert(op == '+' || op == '-');
+        return val_float(op == '-' ? -val.f : val.f);
+    }
+    if (val.kind != VAL_INT) {
+        return (Val) { VAL_NONE };
+    }
+    switch ((int)op) {
+    case '+':
+        return val;
+    case '-':
+        return val_int(-val.i);
+    case '!':
+        return val_int(!val.i);
+    case '~':
+        return val_int(~val.i);
+    default:
+        assert(0);
+        return (Val) { VAL_NONE };
+    }
+}
+
+Val eval_const_float_binary_expr(TokenType op, double left, double right, SrcLoc loc) {
+    switch ((int)op) {
+    case '+':
+        return val_float(left + right);
+    case '-':
+        return val_float(left - right);
+    case '*':
+        return val_float(left * right);
+    case '/':
+        if (right == 0) {
+            resolve_error(loc, "Zero division error in the const div expr");
+        }
+        return val_float(left / right);
+    case '<':
+        return val_int(left < right);
+    case '>':
+        return val_int(left > right);
+    case TOKEN_EQ:
+        return val_int(left == right);
+    case TOKEN_NEQ:
+        return val_int(left != right);
+    case TOKEN_LTEQ:
+        return val_int(left <= right);
+    case TOKEN_GTEQ:
+        return val_int(left >= right);
+    default:
+        assert(0);
+        return (Val) { VAL_NONE };
+    }
+}
+
+Val eval_const_binary_expr(TokenType op, Val left_val, Val right_val, SrcLoc loc) {
+    if (left_val.kind == VAL_FLOAT) {
+        Val val = eval_const_float_binary_expr(op, left_val.f, right_val.f, loc);
+        // inf and nan have no C literal, so they are left to run time
+        return val.kind == VAL_FLOAT && !isfinite(val.f) ? (Val) { VAL_NONE } : val;
+    }
+    if (left_val.kind != VAL_INT || right_val.kind != VAL_INT) {
+        return (Val) { VAL_NONE };
+    }
+    int64_t left = left_val.i;
+    int64_t right = right_val.i;
+    switch ((int)op)
+    {
+    case '+':
+        return val_int(left + right);
+    case '-':
+        return val_int(left - right);
+    case '*':
+        return val_int(left * right);
+    case '/':
+        if (right == 0) {
+            resolve_error(loc, "Zero division error in the const div expr");
+        }
+        return val_int(left / right);
+    case '%':
+        if (right == 0) {
+            resolve_error(loc, "Zero division error in the const mod expr");
+        }
+        return val_int(left % right);
+    case '<':
+        return val_int(left < right);
+    case '>':
+        return val_int(left > right);
+    case '&':
+        return val_int(left & right);
+    case '|':
+        return val_int(left | right);
+    case '^':
+        return val_int(left ^ right);
+    case TOKEN_LOG_AND:
+        return val_int(left && right);
+    case TOKEN_LOG_OR:
+        return val_int(left || right);
+    case TOKEN_LSHIFT:
+        if (right < 0 || right >= INT_SIZE * 8) {
+            resolve_error(loc, "Undefined behavior in the const lshift expr");
+        }
+        return val_int((int64_t)((uint64_t)left << right));
+    case TOKEN_RSHIFT:
+        if (right < 0 || right >= INT_SIZE * 8) {
+            resolve_error(loc, "Undefined behavior in the const rshift expr");
+        }
+        return val_int(left >> right);
+    case TOKEN_EQ:
+        return val_int(left == right);
+    case TOKEN_NEQ:
+        return val_int(left != right);
+    case TOKEN_LTEQ:
+        return val_int(left <= right);
+    case TOKEN_GTEQ:
+        return val_int(left >= right);
+    default:
+        assert(0);
+        return (Val) { VAL_NONE };
+    }
+}
+
 Map global_entities = { 0 };
+Entity** global_entity_list = NULL; // in the order they were installed, built-ins first
 Entity** ordered_entities = NULL;
 
-#define MAX_LOCAL_ENTITIES (1 << 20)
+// every name is bound to its innermost entity through its intern header. a local saves the
+// binding it shadows so that leaving its scope restores it
+typedef struct LocalBinding {
+    Entity* entity;
+    Entity* shadowed;
+} LocalBinding;
+
+THREAD_LOCAL LocalBinding* local_entities = NULL;
 
-Entity* local_entities[MAX_LOCAL_ENTITIES];
-Entity** local_entities_end = local_entities;
+// worker threads bind their locals in a table of their own, indexed by intern index, and only
+// read the global bindings in the intern headers
+THREAD_LOCAL Entity** worker_bindings = NULL;
+
+Entity** binding_slot(InternStr* intern) {
+    return worker_bindings ? worker_bindings + intern->index : (Entity**)&intern->binding;
+}
 
 Entity* get_entity(const char* name) {
-    size_t iter = 0;
-    for (Entity** it = local_entities_end; it != local_entities; it--, iter++) {
-        Entity* local_entity = it[-1];
-        if (local_entity->name == name) {
-            return local_entity;
-        }
+    InternStr* intern = intern_hdr(name);
+    Entity* entity = *binding_slot(intern);
+    return entity ? entity : intern->binding;
+}
+
+void install_global_entity(Entity* entity) {
+    map_put(&global_entities, (char*)entity->name, entity);
+    buf_push(global_entity_list, entity);
+    intern_hdr(entity->name)->binding = entity;
+}
+
+// set by --incremental. globals referenced by the entity being resolved are then recorded
+bool incremental = false;
+// set by --tree-shake and --roots. the recorded deps are the edges of the reachability pass
+bool tree_shake = false;
+THREAD_LOCAL Entity* current_entity = NULL;
+
+void record_dep(Entity* entity, int kinds) {
+    if (!(incremental || tree_shake) || !current_entity || entity->e_type == ENTITY_LOCAL || !entity->decl) {
+        return;
     }
-    return map_get(&global_entities, (char*)name);
-    return NULL;
+    EntityDep* deps = current_entity->info->deps;
+    size_t len = buf_len(deps);
+    if (len && deps[len - 1].entity == entity) {
+        deps[len - 1].kinds |= kinds;
+        return;
+    }
+    buf_push(current_entity->info->deps, ((EntityDep) { entity, kinds }));
 }
 
+// globals are allocated on the main thread in declaration order, so the passes over
+// global_entity_list walk both arenas front to back. locals come from the arena of the
+// worker that resolves their function
+THREAD_LOCAL Arena entity_arena;
+Arena entity_info_arena;
+
 Entity* entity_alloc(EntityType e_type) {
-    Entity* entity = xcalloc(1, sizeof(Entity));
+    Entity* entity = arena_alloc(&entity_arena, sizeof(Entity));
+    memset(entity, 0, sizeof(Entity));
+    if (e_type != ENTITY_LOCAL) {
+        entity->info = arena_alloc(&entity_info_arena, sizeof(EntityInfo));
+        memset(entity->info, 0, sizeof(EntityInfo));
+    }
     entity->e_type = e_type;
     entity->state = ENTITY_STATE_UNRESOVLED;
     return entity;
 }
 
 void push_local_entity(Entity* entity) {
-    if (local_entities_end == local_entities + MAX_LOCAL_ENTITIES) {
-        resolve_error(entity->loc, "Maximum local entities reached");
-    }
-    *local_entities_end++ = entity;
+    Entity** slot = binding_slot(intern_hdr(entity->name));
+    buf_push(local_entities, ((LocalBinding) { entity, *slot }));
+    *slot = entity;
 }
 
-Entity** enter_scope(void) {
-    return local_entities_end;
+size_t enter_scope(void) {
+    return buf_len(local_entities);
 }
 
-void leave_scope(Entity** local_entity) {
-    local_entities_end = local_entity; 
+void leave_scope(size_t scope) {
+    for (size_t i = buf_len(local_entities); i > scope; i--) {
+        LocalBinding* local = local_entities + i - 1;
+        *binding_slot(intern_hdr(local->entity->name)) = local->shadowed;
+    }
+    if (local_entities) {
+        _buf_hdr(local_entities)->len = scope;
+    }
 }
 
 Entity* install_decl(Decl* decl) {
     if (get_entity(decl->name)) {
-        resolve_error(decl->loc, "%s is already defined", decl->name);
+        report_resolve_error(decl->loc, "%s is already defined", decl->name);
+        return NULL;
     }
     EntityType e_type;
     switch (decl->type) {
@@ -283,33 +700,31 @@ Entity* install_decl(Decl* decl) {
     Entity* entity = entity_alloc(e_type);
     entity->decl = decl;
     entity->name = decl->name;
-    entity->loc = decl->loc;
+    entity->info->loc = decl->loc;
+    entity->info->src_hash = decl->src_hash;
     if (decl->type == DECL_STRUCT || decl->type == DECL_UNION) {
         entity->state = ENTITY_STATE_RESOLVED;
         entity->type = type_incomplete(entity);
     }
-    else if (decl->type == DECL_ENUM) {
+    install_global_entity(entity);
+    if (decl->type == DECL_ENUM) {
         entity->decl = decl_typedef(decl->name, typespec_name(str_intern("int")));
         for (size_t i = 0; i < decl->enum_decl.num_enum_items; i++) {
-            Entity* enum_entity = entity_alloc(ENTITY_ENUM_CONST);
-            enum_entity->loc = decl->loc;
             EnumItem enum_item = decl->enum_decl.enum_items[i];
-            enum_entity->name = enum_item.name;
-            if (enum_item.expr) {
-                enum_entity->decl = decl_const(enum_item.name, enum_item.expr);
-            }
-            else if (i == 0) {
-                enum_entity->decl = decl_const(enum_item.name, expr_int(0));
-            }
-            else {
-                Expr* prev_enum_name = expr_name(decl->enum_decl.enum_items[i - 1].name);
-                enum_entity->decl = decl_const(enum_item.name, expr_binary('+', expr_int(1), prev_enum_name));
+            if (get_entity(enum_item.name)) {
+                report_resolve_error(decl->loc, "%s is already defined", enum_item.name);
+                continue;
             }
+            Entity* enum_entity = entity_alloc(ENTITY_ENUM_CONST);
+            enum_entity->info->loc = decl->loc;
+            enum_entity->info->src_hash = decl->src_hash;
+            enum_entity->name = enum_item.name;
+            enum_entity->decl = decl;
+            enum_entity->info->enum_index = i;
             enum_entity->type = type_int;
-            map_put(&global_entities, (char*)enum_entity->name, enum_entity);
+            install_global_entity(enum_entity);
         }
     }
-    map_put(&global_entities, (char*)entity->name, entity);
     return entity;
 }
 
@@ -325,7 +740,7 @@ Entity* built_in_type(Type* type, const char* name) {
     entity->decl = NULL;
     entity->state = ENTITY_STATE_RESOLVED;
     entity->type = type;
-    entity->loc = (SrcLoc) { "{built-in}", 0 };
+    entity->info->loc = (SrcLoc) { "{built-in}", 0 };
     entity->is_set = true;
     entity->is_used = true;
     return entity;
@@ -333,7 +748,7 @@ Entity* built_in_type(Type* type, const char* name) {
 
 #define _BUILT_IN_TYPE(t) \
     do { \
-        map_put(&global_entities, (char*)str_intern(#t), built_in_type(type_ ## t, #t)); \
+        install_global_entity(built_in_type(type_ ## t, #t)); \
     } while (0)
 
 void install_built_in_types(void) {
@@ -351,7 +766,8 @@ Entity* built_in_const(Type* type, const char* name, Expr* const_expr) {
     entity->decl = decl_const(name, const_expr);
     entity->state = ENTITY_STATE_RESOLVED;
     entity->type = type;
-    entity->loc = (SrcLoc) { "{built-in}", 0 };
+    entity->val = type == type_int ? val_int((int64_t)const_expr->int_expr.int_val) : val_float(const_expr->float_expr.float_val);
+    entity->info->loc = (SrcLoc) { "{built-in}", 0 };
     entity->is_set = true;
     entity->is_used = true;
     return entity;
@@ -359,7 +775,7 @@ Entity* built_in_const(Type* type, const char* name, Expr* const_expr) {
 
 #define _BUILT_IN_CONST(t, n, v) \
     do { \
-        map_put(&global_entities, (char*)n, (Entity*)built_in_const(type_ ## t, n, expr_## t(v))); \
+        install_global_entity(built_in_const(type_ ## t, n, expr_## t(v))); \
     } while(0)
 
 void install_built_in_consts(void) {
@@ -373,30 +789,47 @@ void install_built_in_consts(void) {
 ResolvedExpr resolve_expr(Expr* expr, Type* expected_type, bool is_global);
 void resolve_entity(Entity* entity);
 
-ResolvedExpr resolve_name(const char* name, bool is_global) {
+// the left operand of the assignment being resolved. assigning to a name does not use it
+THREAD_LOCAL Entity* assign_target = NULL;
+
+// functions used for the first time while resolve_demanded_funcs runs, so that their bodies are
+// resolved next
+Entity** demanded_funcs = NULL;
+bool is_demanding_funcs = false;
+
+ResolvedExpr resolve_name(const char* name, SrcLoc loc, bool is_global) {
     Entity* entity = get_entity(name);
     if (!entity) {
-        fatal("Name %s is not found in declarations", name);
+        resolve_error(loc, "Name %s is not found in declarations", name);
     }
     resolve_entity(entity);
-    entity->is_used = true;
+    if (entity != assign_target) {
+        if (is_demanding_funcs && entity->e_type == ENTITY_FUNC && !entity->is_used) {
+            buf_push(demanded_funcs, entity);
+        }
+        atomic_set(&entity->is_used, true);
+        record_dep(entity, DEP_USE);
+    }
+    else {
+        record_dep(entity, DEP_REF);
+    }
     if (entity->e_type == ENTITY_VAR) {
         if (is_global) {
-            return (ResolvedExpr) { .value = entity->value, .type = entity->type, .is_lvalue = true, .is_const = false, .is_folded = entity->is_folded };
+            return (ResolvedExpr) { .val = entity->val, .type = entity->type, .is_lvalue = true, .is_const = false };
         }
-        return (ResolvedExpr) { .type = entity->type, .is_lvalue = true, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = entity->type, .is_lvalue = true, .is_const = false };
     }
     else if (entity->e_type == ENTITY_CONST || entity->e_type == ENTITY_ENUM_CONST) {
-        return (ResolvedExpr) { .value = entity->value, .type = entity->type, .is_lvalue = false, .is_const = true, .is_folded = true };
+        return (ResolvedExpr) { .val = entity->val, .type = entity->type, .is_lvalue = false, .is_const = true };
     }
     else if (entity->e_type == ENTITY_FUNC) {
-        return (ResolvedExpr) { .type = entity->type, .is_lvalue = false, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = entity->type, .is_lvalue = false, .is_const = false };
     }
     else if (entity->e_type == ENTITY_LOCAL) {
-        return (ResolvedExpr) { .type = entity->type, .is_lvalue = true, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = entity->type, .is_lvalue = true, .is_const = false };
     }
     else {
-        resolve_error(entity->loc, "A value expression is expected by %s", name);
+        resolve_error(entity->info->loc, "A value expression is expected by %s", name);
         return (ResolvedExpr) { 0 };
     }
 }
@@ -418,12 +851,30 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
 ResolvedExpr resolve_cast_expr(Expr* expr, bool is_global);
 
 void complete_type(Type* type);
-Type* resolve_typespec(TypeSpec* typespec);
+Type* resolve_typespec(TypeSpec* typespec, SrcLoc loc);
+
+THREAD_LOCAL size_t resolve_depth = 0;
+
+void enter_resolve_nesting(SrcLoc loc) {
+    if (++resolve_depth > max_nesting_depth) {
+        resolve_error(loc, "Nesting depth exceeds the limit of %zu. Use --max-depth to raise it", max_nesting_depth);
+    }
+}
+
+void leave_resolve_nesting(void) {
+    resolve_depth--;
+}
+
+void set_resolved_expr(Expr* expr, ResolvedExpr r_expr) {
+    expr->resolved_type = r_expr.type;
+    expr->folded_val = r_expr.val;
+}
 
 ResolvedExpr resolve_expr(Expr* expr, Type* expected_type, bool is_global) {
     if (expr == NULL && expected_type == type_void) {
-        return (ResolvedExpr) { .type = type_void, .is_lvalue = false, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = type_void, .is_lvalue = false, .is_const = false };
     }
+    enter_resolve_nesting(expr->loc);
     ResolvedExpr r_expr;
     switch (expr->type) {
     case EXPR_BINARY:
@@ -474,11 +925,8 @@ ResolvedExpr resolve_expr(Expr* expr, Type* expected_type, bool is_global) {
     default:
         assert(0);
     }
-    expr->resolved_type = r_expr.type;
-    if (r_expr.type == type_int && r_expr.is_folded) {
-        expr->folded_value = r_expr.value;
-        expr->is_folded = r_expr.is_folded;
-    }
+    set_resolved_expr(expr, r_expr);
+    leave_resolve_nesting();
     return r_expr;
 }
 
@@ -489,85 +937,71 @@ Entity* get_expr_entity(Expr* expr) {
     return NULL;
 }
 
-int64_t eval_const_binary_expr(TokenType op, int64_t left, int64_t right, SrcLoc loc) {
-    switch (op)
-    {
+bool is_float_binary_op(TokenType op) {
+    switch ((int)op) {
     case '+':
-        return left + right;
     case '-':
-        return left - right;
     case '*':
-        return left * right;
     case '/':
-        if (right == 0) {
-            resolve_error(loc, "Zero division error in the const div expr");
-        }
-        return left / right;
-    case '%':
-        if (right == 0) {
-            resolve_error(loc, "Zero division error in the const mod expr");
-        }
-        return left % right;
     case '<':
-        return left < right;
     case '>':
-        return left > right;
-    case '&':
-        return left & right;
-    case '|':
-        return left | right;
-    case '^':
-        return left ^ right;
-    case TOKEN_LOG_AND:
-        return left && right;
-    case TOKEN_LOG_OR:
-        return left || right;
-    case TOKEN_LSHIFT:
-        if (right < 0) {
-            resolve_error(loc, "Undefined behavior in the const rshift expr");
-        }
-        return left << right;
-    case TOKEN_RSHIFT:
-        if (right < 0) {
-            resolve_error(loc, "Undefined behavior in the const rshift expr");
-        }
-        return left >> right;
     case TOKEN_EQ:
-        return left == right;
     case TOKEN_NEQ:
-        return left != right;
     case TOKEN_LTEQ:
-        return left <= right;
     case TOKEN_GTEQ:
-        return left >= right;
+        return true;
     default:
-        assert(0);
-        return 0;
+        return false;
     }
 }
 
-ResolvedExpr resolve_binary_expr(Expr* expr, bool is_global) {
-    assert(expr->type == EXPR_BINARY);
-    ResolvedExpr left = resolve_expr(expr->binary_expr.left, NULL, is_global);
-    ResolvedExpr right = resolve_expr(expr->binary_expr.right, NULL, is_global);
+bool is_cmp_binary_op(TokenType op) {
+    return op == '<' || op == '>' || op == TOKEN_EQ || op == TOKEN_NEQ || op == TOKEN_LTEQ || op == TOKEN_GTEQ;
+}
+
+ResolvedExpr resolve_binary_op(Expr* expr, ResolvedExpr left, ResolvedExpr right) {
+    TokenType op = expr->binary_expr.op;
     if (left.type != right.type) {
         resolve_error(expr->loc, "type mismatch in the binary expression");
     }
-    if (left.type != type_int) {
+    if (left.type != type_int && (left.type != type_float || !is_float_binary_op(op))) {
         resolve_error(expr->loc, "expression is not arithmetic type");
     }
-    if (left.is_folded && right.is_folded) {        
+    Type* type = is_cmp_binary_op(op) ? type_int : left.type;
+    if (is_folded(left) && is_folded(right)) {
         return (ResolvedExpr) {
-            .value = eval_const_binary_expr(expr->binary_expr.op, left.value, right.value, expr->loc),
-            .type = type_int,
+            .val = eval_const_binary_expr(op, left.val, right.val, expr->loc),
+            .type = type,
             .is_lvalue = false,
-            .is_const = left.is_const && right.is_const,
-            .is_folded = true
+            .is_const = left.is_const && right.is_const
         };
     }
     else {
-        return (ResolvedExpr) { .type = left.type, .is_lvalue = false, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = type, .is_lvalue = false, .is_const = false };
+    }
+}
+
+ResolvedExpr resolve_binary_expr(Expr* expr, bool is_global) {
+    assert(expr->type == EXPR_BINARY);
+    // the left spine is walked with an explicit stack so that long operator chains
+    // like a + b + ... + z do not recurse once per operator
+    size_t base = buf_len(expr_stack);
+    Expr* left_expr = expr;
+    while (left_expr->type == EXPR_BINARY) {
+        buf_push(expr_stack, left_expr);
+        left_expr = left_expr->binary_expr.left;
+    }
+    ResolvedExpr left = resolve_expr(left_expr, NULL, is_global);
+    for (size_t i = buf_len(expr_stack); i-- > base;) {
+        Expr* binary_expr = expr_stack[i];
+        ResolvedExpr right = resolve_expr(binary_expr->binary_expr.right, NULL, is_global);
+        left = resolve_binary_op(binary_expr, left, right);
+        if (binary_expr != expr) {
+            set_resolved_expr(binary_expr, left);
+        }
     }
+    _buf_hdr(expr_stack)->len = base;
+    return left;
 }
 
 ResolvedExpr resolve_pre_unary_expr(Expr* expr, bool is_global) {
@@ -585,7 +1019,7 @@ ResolvedExpr resolve_pre_unary_expr(Expr* expr, bool is_global) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
         // unary increments are not folded and are not allowed in var expressions
-        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = true, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = true, .is_const = false };
     case TOKEN_DEC:
         if (base_expr.is_const) {
             resolve_error(expr->loc, "const values cannot be incremented");
@@ -597,37 +1031,37 @@ ResolvedExpr resolve_pre_unary_expr(Expr* expr, bool is_global) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
         // unary decrements are not folded and are not allowed in var expressions
-        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = true, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = true, .is_const = false };
     case '+':
-        if (base_expr.type != type_int) {
+        if (base_expr.type != type_int && base_expr.type != type_float) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
-        return (ResolvedExpr) { .value = +base_expr.value, .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const, .is_folded = base_expr.is_folded };
+        return (ResolvedExpr) { .val = eval_const_unary_expr('+', base_expr.val), .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const };
     case '-':
-        if (base_expr.type != type_int) {
+        if (base_expr.type != type_int && base_expr.type != type_float) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
-        return (ResolvedExpr) { .value = -base_expr.value, .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const, .is_folded = base_expr.is_folded };
+        return (ResolvedExpr) { .val = eval_const_unary_expr('-', base_expr.val), .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const };
     case '*':
         if (base_expr.type->type != TYPE_PTR) {
             resolve_error(expr->loc, "pointer type is expected in a dereference");
         }
-        return (ResolvedExpr) { .type = base_expr.type->ptr.base, .is_lvalue = true, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = base_expr.type->ptr.base, .is_lvalue = true, .is_const = false };
     case '&':
         if (!base_expr.is_lvalue) {
             resolve_error(expr->loc, "an lvalue is expected as the operand");
         }
-        return (ResolvedExpr) { .type = type_ptr(base_expr.type), .is_lvalue = false, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = type_ptr(base_expr.type), .is_lvalue = false, .is_const = false };
     case '!':
         if (base_expr.type != type_int) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
-        return (ResolvedExpr) { .value = !base_expr.value, .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const, .is_folded = base_expr.is_folded };
+        return (ResolvedExpr) { .val = eval_const_unary_expr('!', base_expr.val), .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const };
     case '~':
         if (base_expr.type != type_int) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
-        return (ResolvedExpr) { .value = ~base_expr.value, .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const, .is_folded = base_expr.is_folded };
+        return (ResolvedExpr) { .val = eval_const_unary_expr('~', base_expr.val), .type = base_expr.type, .is_lvalue = false, .is_const = base_expr.is_const };
     default:
         assert(0);
     }
@@ -649,7 +1083,7 @@ ResolvedExpr resolve_post_unary_expr(Expr* expr, bool is_global) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
         // unary increments are not folded and are not allowed in var expressions
-        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = false, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = false, .is_const = false };
     case TOKEN_DEC:
         if (base_expr.is_const) {
             resolve_error(expr->loc, "const values cannot be incremented");
@@ -661,7 +1095,7 @@ ResolvedExpr resolve_post_unary_expr(Expr* expr, bool is_global) {
             resolve_error(expr->loc, "expression is not arithmetic type");
         }
         // unary decrements are not folded and are not allowed in var expressions
-        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = false, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = base_expr.type, .is_lvalue = false, .is_const = false };
     default:
         assert(0);
     }
@@ -670,17 +1104,17 @@ ResolvedExpr resolve_post_unary_expr(Expr* expr, bool is_global) {
 
 ResolvedExpr resolve_int_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_INT);
-    return (ResolvedExpr) { .value = (int64_t)expr->int_expr.int_val, .type = type_int, .is_lvalue = false, .is_const = true, .is_folded = true };
+    return (ResolvedExpr) { .val = val_int((int64_t)expr->int_expr.int_val), .type = type_int, .is_lvalue = false, .is_const = true };
 }
 
 ResolvedExpr resolve_float_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_FLOAT);
-    return (ResolvedExpr) { .value = *(int64_t*)&(expr->float_expr.float_val), .type = type_float, .is_lvalue = false, .is_const = true, .is_folded = true };
+    return (ResolvedExpr) { .val = val_float(expr->float_expr.float_val), .type = type_float, .is_lvalue = false, .is_const = true };
 }
 
 ResolvedExpr resolve_name_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_NAME);
-    return resolve_name(expr->name_expr.name, is_global);
+    return resolve_name(expr->name_expr.name, expr->loc, is_global);
 }
 
 ResolvedExpr resolve_index_expr(Expr* expr, bool is_global) {
@@ -694,34 +1128,44 @@ ResolvedExpr resolve_index_expr(Expr* expr, bool is_global) {
         resolve_error(expr->loc, "An integer is expected as array index");
     }
     Type* type = base_expr.type->type == TYPE_ARRAY ? base_expr.type->array.base : base_expr.type->ptr.base;
-    return (ResolvedExpr) { .type = type, .is_lvalue = base_expr.is_lvalue, .is_const = base_expr.is_const, .is_folded = false };
+    Val val = { VAL_NONE };
+    if (base_expr.val.kind == VAL_AGGREGATE && is_folded(index_expr)
+        && index_expr.val.i >= 0 && (uint64_t)index_expr.val.i < base_expr.type->array.size) {
+        val = eval_const_item(base_expr.val, (size_t)index_expr.val.i, type);
+    }
+    return (ResolvedExpr) { .val = val, .type = type, .is_lvalue = base_expr.is_lvalue, .is_const = base_expr.is_const };
 }
 
 ResolvedExpr resolve_field_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_FIELD);
     ResolvedExpr base_expr = resolve_expr(expr->field_expr.expr, NULL, is_global);
-    for (size_t i = 0; i < base_expr.type->aggregate.num_fields; i++) {
-        if (expr->field_expr.field == base_expr.type->aggregate.fields[i].name) {
-            Type* type = base_expr.type->aggregate.fields[i].type;
-            complete_type(type);
-            return (ResolvedExpr) { .type = type, .is_lvalue = base_expr.is_lvalue, .is_const = base_expr.is_const, .is_folded = false };
-        }
+    if (base_expr.type->type != TYPE_STRUCT && base_expr.type->type != TYPE_UNION) {
+        resolve_error(expr->loc, "A struct or union is expected as the operand of a field access");
     }
-    resolve_error(expr->loc, "%s is not a field of %s", expr->field_expr.field, base_expr.type->entity->name);
-    return (ResolvedExpr) { 0 };
+    size_t i = aggregate_field_index(base_expr.type, expr->field_expr.field);
+    if (i == SIZE_MAX) {
+        resolve_error(expr->loc, "%s is not a field of %s", expr->field_expr.field, base_expr.type->entity->name);
+    }
+    Type* type = base_expr.type->aggregate.fields[i].type;
+    complete_type(type);
+    Val val = { VAL_NONE };
+    if (base_expr.val.kind == VAL_AGGREGATE) {
+        val = eval_const_item(base_expr.val, i, type);
+    }
+    return (ResolvedExpr) { .val = val, .type = type, .is_lvalue = base_expr.is_lvalue, .is_const = base_expr.is_const };
 }
 
 ResolvedExpr resolve_sizeof_expr_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_SIZEOF_EXPR);
     ResolvedExpr base_expr = resolve_expr(expr->sizeof_expr.expr, NULL, is_global);
-    return (ResolvedExpr) { .value = base_expr.type->size, .type = type_int, .is_lvalue = false, .is_const = true, .is_folded = true };
+    return (ResolvedExpr) { .val = val_int(base_expr.type->size), .type = type_int, .is_lvalue = false, .is_const = true };
 }
 
 ResolvedExpr resolve_sizeof_type_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_SIZEOF_TYPE);
-    Type* type = resolve_typespec(expr->sizeof_expr.type);
+    Type* type = resolve_typespec(expr->sizeof_expr.type, expr->loc);
     complete_type(type);
-    return (ResolvedExpr) { .value = type->size, .type = type_int, .is_lvalue = false, .is_const = true, .is_folded = true };
+    return (ResolvedExpr) { .val = val_int(type->size), .type = type_int, .is_lvalue = false, .is_const = true };
 }
 
 ResolvedExpr resolve_ternary_expr(Expr* expr, Type* expected_type, bool is_global) {
@@ -738,17 +1182,17 @@ ResolvedExpr resolve_ternary_expr(Expr* expr, Type* expected_type, bool is_globa
     if (expected_type && right_expr.type != expected_type) {
         resolve_error(expr->loc, "The right expr type mismatch with the expected type");
     }
-    if (cond_expr.is_folded) {
-        return cond_expr.value ? left_expr : right_expr;
+    if (is_folded(cond_expr)) {
+        return cond_expr.val.i ? left_expr : right_expr;
     }
     else {
-        return (ResolvedExpr) { .type = left_expr.type, .is_lvalue = left_expr.is_lvalue && right_expr.is_lvalue, .is_const = false, .is_folded = false };
+        return (ResolvedExpr) { .type = left_expr.type, .is_lvalue = left_expr.is_lvalue && right_expr.is_lvalue, .is_const = false };
     }
 }
 
 ResolvedExpr resolve_str_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_STR);
-    return (ResolvedExpr) { .type = type_ptr(type_char), .is_lvalue = false, .is_const = true, .is_folded = false };
+    return (ResolvedExpr) { .type = type_ptr(type_char), .is_lvalue = false, .is_const = true };
 }
 
 ResolvedExpr resolve_call_expr(Expr* expr, Type* expected_type, bool is_global) {
@@ -766,7 +1210,7 @@ ResolvedExpr resolve_call_expr(Expr* expr, Type* expected_type, bool is_global)
     if (expected_type && func_expr.type->func.ret != expected_type) {
         resolve_error(expr->loc, "Function return type mismatch with the expected type");
     }
-    return (ResolvedExpr) { .type = func_expr.type->func.ret, .is_lvalue = false, .is_const = false, .is_folded = false };
+    return (ResolvedExpr) { .type = func_expr.type->func.ret, .is_lvalue = false, .is_const = false };
 }
 
 ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_global) {
@@ -777,12 +1221,12 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
     }
     Type* compound_type = expected_type;
     if (expected_type && compound_typespec) {
-        if (resolve_typespec(compound_typespec) != expected_type) {
+        if (resolve_typespec(compound_typespec, expr->loc) != expected_type) {
             resolve_error(expr->loc, "Explicit type of the compound expression mismatch with the expected type");
         }
     }
     else if (compound_typespec) {
-        compound_type = resolve_typespec(compound_typespec);
+        compound_type = resolve_typespec(compound_typespec, expr->loc);
     }
     complete_type(compound_type);
     if (compound_type->type == TYPE_STRUCT || compound_type->type == TYPE_UNION) {
@@ -790,18 +1234,16 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
             resolve_error(expr->loc, "Number of fields in the compound expression exceeds the aggregate definition field count");
         }
         bool is_const = true;
-        bool is_folded = true;
+        Val val = val_aggregate(compound_type->aggregate.num_fields);
         for (size_t i = 0, k = 0; i < expr->compound_expr.num_compound_items; i++, k++) {
             CompoundItem compound_item = expr->compound_expr.compound_items[i];
             if (compound_item.type == COMPOUND_INDEX) {
                 resolve_error(expr->loc, "Index items are not allowed in aggregate compound expressions");
             }
             if (compound_item.type == COMPOUND_NAME) {
-                for (size_t j = 0; j < compound_type->aggregate.num_fields; j++) {
-                    if (compound_item.name == compound_type->aggregate.fields[j].name) {
-                        k = j;
-                        break;
-                    }
+                k = aggregate_field_index(compound_type, compound_item.name);
+                if (k == SIZE_MAX) {
+                    resolve_error(expr->loc, "%s is not a field of %s", compound_item.name, compound_type->entity->name);
                 }
             }
             if (k >= compound_type->aggregate.num_fields) {
@@ -809,19 +1251,19 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
             }
             ResolvedExpr r_expr = resolve_expr(compound_item.value, compound_type->aggregate.fields[k].type, is_global);
             is_const &= r_expr.is_const;
-            is_folded &= r_expr.is_folded;
-            if (compound_type->aggregate.fields[i].type != r_expr.type) {
+            fold_compound_item(&val, k, r_expr.val);
+            if (compound_type->aggregate.fields[k].type != r_expr.type) {
                 resolve_error(expr->loc, "Field type mismatch with the aggregate definition");
             }
         }
-        return (ResolvedExpr) { .type = compound_type, .is_lvalue = false, .is_const = is_const, .is_folded = is_folded };
+        return (ResolvedExpr) { .val = val, .type = compound_type, .is_lvalue = false, .is_const = is_const };
     }
     else if (compound_type->type == TYPE_ARRAY) {
         if (compound_type->array.size < expr->compound_expr.num_compound_items) {
             resolve_error(expr->loc, "Number of fields in the compound expression exceeds the array size");
         }
         bool is_const = true;
-        bool is_folded = true;
+        Val val = val_aggregate(compound_type->array.size);
         for (size_t i = 0, k = 0; i < expr->compound_expr.num_compound_items; i++, k++) {
             CompoundItem compound_item = expr->compound_expr.compound_items[i];
             if (compound_item.type == COMPOUND_NAME) {
@@ -832,25 +1274,25 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
                 if (index_expr.type != type_int && index_expr.type != type_char) {
                     resolve_error(expr->loc, "An int or char expr is expected in indices of array compound expressions");
                 }
-                if (!index_expr.is_const) {
+                if (!index_expr.is_const || !is_folded(index_expr)) {
                     resolve_error(expr->loc, "Const indices are expected in array compound expressions");
                 }
-                if (index_expr.value < 0) {
+                if (index_expr.val.i < 0) {
                     resolve_error(expr->loc, "Index expr should be non-negative");
                 }
-                k = (size_t) index_expr.value;
+                k = (size_t) index_expr.val.i;
             }
             if (k >= compound_type->array.size) {
                 resolve_error(expr->loc, "Index exceeds the array length in the array compound expression");
             }
             ResolvedExpr r_expr = resolve_expr(expr->compound_expr.compound_items[i].value, compound_type->array.base, is_global);
             is_const &= r_expr.is_const;
-            is_folded &= r_expr.is_folded;
+            fold_compound_item(&val, k, r_expr.val);
             if (compound_type->array.base != r_expr.type) {
                 resolve_error(expr->loc, "Field type mismatch with the array type");
             }
         }
-        return (ResolvedExpr) { .type = compound_type, .is_lvalue = false, .is_const = is_const, .is_folded = is_folded };
+        return (ResolvedExpr) { .val = val, .type = compound_type, .is_lvalue = false, .is_const = is_const };
     }
     else if(compound_type) {
         if (expr->compound_expr.num_compound_items != 1) {
@@ -860,7 +1302,7 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
         if (v_expr.type != type_int) {
             resolve_error(expr->loc, "Only integer type is expected in non array or non aggregate type compound expressions");
         }
-        return (ResolvedExpr) { .type = compound_type, .is_lvalue = false, .is_const = v_expr.is_const, .is_folded = v_expr.is_folded };
+        return (ResolvedExpr) { .val = eval_const_cast(compound_type, v_expr.val), .type = compound_type, .is_lvalue = false, .is_const = v_expr.is_const };
         //resolve_error(expr->loc, "An array or struct or union type is expected in a compound expression");
     }
     return (ResolvedExpr) { 0 };
@@ -868,121 +1310,195 @@ ResolvedExpr resolve_compound_expr(Expr* expr, Type* expected_type, bool is_glob
 
 ResolvedExpr resolve_cast_expr(Expr* expr, bool is_global) {
     assert(expr->type == EXPR_CAST);
-    Type* cast_type = resolve_typespec(expr->cast_expr.cast_type);
+    Type* cast_type = resolve_typespec(expr->cast_expr.cast_type, expr->loc);
     ResolvedExpr cast_expr = resolve_expr(expr->cast_expr.cast_expr, NULL, is_global);
+    TypeType from = cast_expr.type->type;
+    bool is_arithmetic = from == TYPE_INT || from == TYPE_CHAR || from == TYPE_FLOAT;
     if (cast_type->type == TYPE_PTR) {
-        if (cast_expr.type->type != TYPE_PTR && cast_expr.type->type != TYPE_INT) {
+        if (from != TYPE_PTR && from != TYPE_INT) {
             resolve_error(expr->loc, "Unsupported cast to a pointer");
         }
     }
-    else if (cast_type->type == TYPE_INT) {
-        if (cast_expr.type->type == TYPE_PTR 
-            && cast_expr.type->type != TYPE_INT 
-            && cast_expr.type->type != TYPE_FLOAT 
-            && cast_expr.type->type == TYPE_CHAR) {
-            resolve_error(expr->loc, "Unsupported cast to an int");
+    else if (cast_type->type == TYPE_INT || cast_type->type == TYPE_CHAR) {
+        if (!is_arithmetic && from != TYPE_PTR) {
+            resolve_error(expr->loc, "Unsupported cast to an integer");
+        }
+    }
+    else if (cast_type->type == TYPE_FLOAT) {
+        if (!is_arithmetic) {
+            resolve_error(expr->loc, "Unsupported cast to a float");
         }
     }
     else {
         resolve_error(expr->loc, "Unsupported cast");
     }
-    return (ResolvedExpr) { .type = cast_type, .is_lvalue = false, .is_const = false, .is_folded = true };
+    return (ResolvedExpr) { .val = eval_const_cast(cast_type, cast_expr.val), .type = cast_type, .is_lvalue = false, .is_const = cast_expr.is_const };
 }
 
-Type* resolve_typespec_name(TypeSpec* typespec);
-Type* resolve_typespec_func(TypeSpec* typespec);
-Type* resolve_typespec_array(TypeSpec* typespec);
-Type* resolve_typespec_ptr(TypeSpec* typespec);
+Type* resolve_typespec_name(TypeSpec* typespec, SrcLoc loc);
+Type* resolve_typespec_func(TypeSpec* typespec, SrcLoc loc);
+Type* resolve_typespec_array(TypeSpec* typespec, SrcLoc loc);
+Type* resolve_typespec_ptr(TypeSpec* typespec, SrcLoc loc);
+bool is_context_free_typespec(TypeSpec* typespec);
+
+size_t typespec_resolves = 0;
+// the param types of the func typespecs being resolved. an error unwinds it in resolve_typespec
+THREAD_LOCAL Type** typespec_params = NULL;
+
+void record_typespec_deps(TypeSpec* typespec) {
+    switch (typespec->type) {
+    case TYPESPEC_NAME: {
+        Entity* entity = get_entity(typespec->name.name);
+        if (entity) {
+            record_dep(entity, DEP_REF);
+        }
+        break;
+    }
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < typespec->func.num_params; i++) {
+            record_typespec_deps(typespec->func.params[i]);
+        }
+        record_typespec_deps(typespec->func.ret_type);
+        break;
+    case TYPESPEC_ARRAY:
+        record_typespec_deps(typespec->array.base);
+        break;
+    case TYPESPEC_PTR:
+        record_typespec_deps(typespec->ptr.base);
+        break;
+    default:
+        assert(0);
+    }
+}
 
-Type* resolve_typespec(TypeSpec* typespec) {
+// typespecs are hash consed, so loc is the location of the use being resolved. a failed typespec
+// is left unresolved and every use of it reports its own error. a local that shadows a name of
+// the typespec makes it resolve again, so the cached type is not used then
+Type* resolve_typespec(TypeSpec* typespec, SrcLoc loc) {
+    if (incremental || tree_shake) {
+        // a cached typespec skips resolve_typespec_name, so its names are recorded here
+        record_typespec_deps(typespec);
+    }
+    if (typespec->resolved_type && is_context_free_typespec(typespec)) {
+        // resolved types are always complete
+        return typespec->resolved_type;
+    }
+    atomic_add(&typespec_resolves, 1);
+    jmp_buf env;
+    jmp_buf* outer = resolve_recover;
+    size_t typespec_params_len = buf_len(typespec_params);
+    resolve_recover = &env;
+    if (setjmp(env)) {
+        resolve_recover = outer;
+        if (typespec_params) {
+            _buf_hdr(typespec_params)->len = typespec_params_len;
+        }
+        resolve_abort();
+    }
     Type* type = NULL;
     switch (typespec->type) {
     case TYPESPEC_NAME:
-        type = resolve_typespec_name(typespec);
+        type = resolve_typespec_name(typespec, loc);
         break;
     case TYPESPEC_FUNC:
-        type = resolve_typespec_func(typespec);
+        type = resolve_typespec_func(typespec, loc);
         break;
     case TYPESPEC_ARRAY:
-        type = resolve_typespec_array(typespec);
+        type = resolve_typespec_array(typespec, loc);
         break;
     case TYPESPEC_PTR:
-        type = resolve_typespec_ptr(typespec);
+        type = resolve_typespec_ptr(typespec, loc);
         break;
     default:
         assert(0);
     }
     if (type) {
         complete_type(type);
+        typespec->resolved_type = type;
     }
+    resolve_recover = outer;
     return type;
 }
 
-Type* resolve_typespec_name(TypeSpec* typespec) {
+Type* resolve_typespec_name(TypeSpec* typespec, SrcLoc loc) {
     assert(typespec->type == TYPESPEC_NAME);
     const char* name = typespec->name.name;
     Entity* entity = get_entity(name);
     if (!entity) {
-        resolve_error(typespec->loc, "Typespec name %s is not found", name);
+        resolve_error(loc, "Typespec name %s is not found", name);
     }
     resolve_entity(entity);
     if (entity->e_type != ENTITY_TYPE) {
-        resolve_error(typespec->loc, "A type name is expected. Got %s", name);
+        resolve_error(loc, "A type name is expected. Got %s", name);
     }
-    typespec->resolved_type = entity->type;
     return entity->type;
 }
 
-Type* resolve_typespec_func(TypeSpec* typespec) {
+Type* resolve_typespec_func(TypeSpec* typespec, SrcLoc loc) {
     assert(typespec->type == TYPESPEC_FUNC);
-    Type** params = xcalloc(typespec->func.num_params, sizeof(Type*));
+    size_t base = buf_len(typespec_params);
     for (size_t i = 0; i < typespec->func.num_params; i++) {
-        params[i] = resolve_typespec(typespec->func.params[i]);
+        Type* param_type = resolve_typespec(typespec->func.params[i], loc);
+        buf_push(typespec_params, param_type);
+    }
+    Type* ret_type = resolve_typespec(typespec->func.ret_type, loc);
+    // type_func copies the params, so they are popped right after
+    Type* result = type_func(typespec->func.num_params, typespec_params + base, ret_type);
+    if (typespec_params) {
+        _buf_hdr(typespec_params)->len = base;
     }
-    Type* ret_type = resolve_typespec(typespec->func.ret_type);
-    Type* result = type_func(typespec->func.num_params, params, ret_type);
-    typespec->resolved_type = result;
     return result;
 }
 
-Type* resolve_typespec_array(TypeSpec* typespec) {
+Type* resolve_typespec_array(TypeSpec* typespec, SrcLoc loc) {
     assert(typespec->type == TYPESPEC_ARRAY);
     ResolvedExpr size_expr = resolve_expr(typespec->array.size, NULL, false);
-    if (!size_expr.is_const) {
-        resolve_error(typespec->loc, "const is expected in an array size expression");
+    if (!size_expr.is_const || (size_expr.val.kind != VAL_INT && size_expr.val.kind != VAL_CHAR)) {
+        resolve_error(loc, "const is expected in an array size expression");
     }
-    if (size_expr.value < 0 || (uint64_t)size_expr.value > SIZE_MAX) {
-        resolve_error(typespec->loc, "invalid expr value for array size");
+    if (size_expr.val.i < 0) {
+        resolve_error(loc, "invalid expr value for array size");
     }
-    Type* result = type_array(resolve_typespec(typespec->array.base), (size_t)size_expr.value);
-    typespec->resolved_type = result;
-    return result;
+    return type_array(resolve_typespec(typespec->array.base, loc), (size_t)size_expr.val.i);
 }
 
-Type* resolve_typespec_ptr(TypeSpec* typespec) {
+Type* resolve_typespec_ptr(TypeSpec* typespec, SrcLoc loc) {
     assert(typespec->type == TYPESPEC_PTR);
-    Type* result = type_ptr(resolve_typespec(typespec->ptr.base));
-    typespec->resolved_type = result;
-    return result;
+    return type_ptr(resolve_typespec(typespec->ptr.base, loc));
 }
 
 void complete_type(Type* type) {
-    if (type->type == TYPE_COMPLETING) {
-        resolve_error(type->entity->loc, "Cyclic dependancy in %s", type->entity->name);
+    if (type->type == TYPE_POISON) {
+        resolve_abort();
+    }
+    else if (type->type == TYPE_COMPLETING) {
+        resolve_error(type->entity->info->loc, "Cyclic dependancy in %s", type->entity->name);
     }
     else if (type->type == TYPE_INCOMPLETE) {
         type->type = TYPE_COMPLETING;
+        jmp_buf env;
+        jmp_buf* outer = resolve_recover;
+        Entity* outer_entity = current_entity;
+        resolve_recover = &env;
+        current_entity = type->entity;
+        if (setjmp(env)) {
+            resolve_recover = outer;
+            current_entity = outer_entity;
+            type->type = TYPE_POISON;
+            type->entity->is_poisoned = true;
+            resolve_abort();
+        }
         Decl* decl = type->entity->decl;
         assert(decl->type == DECL_STRUCT || decl->type == DECL_UNION);
         TypeField* aggregate_fields = NULL;
         AggregateDecl aggregate_decl = decl->aggregate_decl;
         for (size_t i = 0; i < aggregate_decl.num_aggregate_items; i++) {
-            Type* aggregate_type = resolve_typespec(aggregate_decl.aggregate_items[i].type);
+            Type* aggregate_type = resolve_typespec(aggregate_decl.aggregate_items[i].type, aggregate_decl.aggregate_items[i].loc);
             complete_type(aggregate_type);
             if (aggregate_decl.aggregate_items[i].expr) {
                 ResolvedExpr aggregate_expr = resolve_expr(aggregate_decl.aggregate_items[i].expr, NULL, false);
                 if (aggregate_type != aggregate_expr.type) {
-                    resolve_error(type->entity->loc, "aggregate type and expression inferred type mismatch");
+                    resolve_error(type->entity->info->loc, "aggregate type and expression inferred type mismatch");
                 }
             }
             buf_push(aggregate_fields, ((TypeField) {.type = aggregate_type, .name = aggregate_decl.aggregate_items[i].name }));
@@ -996,6 +1512,8 @@ void complete_type(Type* type) {
         else {
             assert(0);
         }
+        resolve_recover = outer;
+        current_entity = outer_entity;
         buf_push(ordered_entities, type->entity);
     }
 }
@@ -1007,11 +1525,28 @@ void resolve_entity_enum_const(Entity* entity);
 void resolve_entity_func(Entity* entity);
 
 void resolve_entity(Entity* entity) {
-    if (entity->state == ENTITY_STATE_RESOLVING) {
-        resolve_error(entity->loc, "Cyclic dependancy for %s", entity->name);
+    if (entity->is_poisoned) {
+        resolve_abort();
+    }
+    else if (entity->state == ENTITY_STATE_RESOLVING) {
+        resolve_error(entity->info->loc, "Cyclic dependancy for %s", entity->name);
     }
     else if (entity->state == ENTITY_STATE_UNRESOVLED) {
         entity->state = ENTITY_STATE_RESOLVING;
+        jmp_buf env;
+        jmp_buf* outer = resolve_recover;
+        Entity* outer_entity = current_entity;
+        size_t depth = resolve_depth;
+        resolve_recover = &env;
+        current_entity = entity;
+        if (setjmp(env)) {
+            resolve_recover = outer;
+            current_entity = outer_entity;
+            resolve_depth = depth;
+            entity->state = ENTITY_STATE_RESOLVED;
+            entity->is_poisoned = true;
+            resolve_abort();
+        }
         switch (entity->e_type) {
         case ENTITY_TYPE: // typedef only
             resolve_entity_type(entity);
@@ -1031,12 +1566,14 @@ void resolve_entity(Entity* entity) {
         default:
             assert(0);
         }
+        resolve_recover = outer;
+        current_entity = outer_entity;
         entity->state = ENTITY_STATE_RESOLVED;
     }
 }
 
 void resolve_entity_type(Entity* entity) {
-    Type* type = resolve_typespec(entity->decl->typedef_decl.type);
+    Type* type = resolve_typespec(entity->decl->typedef_decl.type, entity->decl->loc);
     entity->type = type;
     complete_type(type);
     buf_push(ordered_entities, entity);
@@ -1045,20 +1582,19 @@ void resolve_entity_type(Entity* entity) {
 void resolve_entity_var(Entity* entity) {
     Type* type = NULL;
     if (entity->decl->var_decl.type) {
-        type = resolve_typespec(entity->decl->var_decl.type);
+        type = resolve_typespec(entity->decl->var_decl.type, entity->decl->loc);
         entity->type = type;
     }
     if (entity->decl->var_decl.expr) {
         ResolvedExpr r_expr = resolve_expr(entity->decl->var_decl.expr, type, true);
         if (type && type != r_expr.type) {
-            resolve_error(entity->loc, "declared type and the expression types mismatch in %s", entity->name);
+            resolve_error(entity->info->loc, "declared type and the expression types mismatch in %s", entity->name);
         }
-        if (!r_expr.is_folded) {
-            resolve_error(entity->loc, "declared expr of %s is not evaluable at compile time", entity->name);
+        if (!is_folded(r_expr)) {
+            resolve_error(entity->info->loc, "declared expr of %s is not evaluable at compile time", entity->name);
         }
-        entity->value = r_expr.value;
+        entity->val = r_expr.val;
         entity->is_set = true;
-        entity->is_folded = r_expr.is_folded;//r_expr.type == type_int;
         type = r_expr.type;
         entity->type = type;
     }
@@ -1081,16 +1617,57 @@ any expr involving compiler time in-evaluable
 void resolve_entity_const(Entity* entity) {
     ResolvedExpr r_expr = resolve_expr(entity->decl->const_decl.expr, NULL, true);
     if (!r_expr.is_const) {
-        resolve_error(entity->loc, "A const expr is expected in the const declaration %s", entity->name);
+        resolve_error(entity->info->loc, "A const expr is expected in the const declaration %s", entity->name);
     }
     entity->type = r_expr.type;
-    entity->value = r_expr.value;
+    entity->val = r_expr.val;
     entity->is_set = true;
     buf_push(ordered_entities, entity);
 }
 
+Entity* get_enum_item_entity(Decl* decl, size_t i) {
+    Entity* entity = get_entity(decl->enum_decl.enum_items[i].name);
+    if (!entity || entity->e_type != ENTITY_ENUM_CONST || entity->decl != decl) {
+        // the item was a duplicate, which is already reported
+        resolve_abort();
+    }
+    return entity;
+}
+
+// an item without an expr is one more than the item before it. the unresolved items before it
+// are resolved first from the lowest one up, so numbering a long enum never recurses per item
 void resolve_entity_enum_const(Entity* entity) {
-    resolve_entity_const(entity);
+    Decl* decl = entity->decl;
+    size_t index = entity->info->enum_index;
+    EnumItem item = decl->enum_decl.enum_items[index];
+    if (item.expr) {
+        ResolvedExpr r_expr = resolve_expr(item.expr, NULL, true);
+        if (!r_expr.is_const || r_expr.type != type_int || !is_folded(r_expr)) {
+            resolve_error(entity->info->loc, "An int const expr is expected in the enum item %s", entity->name);
+        }
+        entity->val = r_expr.val;
+    }
+    else if (index == 0) {
+        entity->val = val_int(0);
+    }
+    else {
+        size_t first = index - 1;
+        while (first > 0 && get_enum_item_entity(decl, first - 1)->state == ENTITY_STATE_UNRESOVLED) {
+            first--;
+        }
+        for (size_t i = first; i < index; i++) {
+            resolve_entity(get_enum_item_entity(decl, i));
+        }
+        Entity* prev = get_enum_item_entity(decl, index - 1);
+        if (prev->is_poisoned) {
+            resolve_abort();
+        }
+        atomic_set(&prev->is_used, true);
+        record_dep(prev, DEP_USE);
+        entity->val = val_int(prev->val.i + 1);
+    }
+    entity->is_set = true;
+    buf_push(ordered_entities, entity);
 }
 
 void resolve_stmnt_block(BlockStmnt block, Type* ret_type);
@@ -1098,16 +1675,17 @@ void resolve_stmnt_block(BlockStmnt block, Type* ret_type);
 void resolve_entity_func(Entity* entity) {
     Type ** param_types = NULL;
     for (size_t i = 0; i < entity->decl->func_decl.num_params; i++) {
-        Type* param_type = resolve_typespec(entity->decl->func_decl.params[i].type);
+        Type* param_type = resolve_typespec(entity->decl->func_decl.params[i].type, entity->decl->func_decl.params[i].loc);
         complete_type(param_type);
         buf_push(param_types, param_type);
     }
     Type* ret_type = NULL;
     if (entity->decl->func_decl.ret_type) {
-        ret_type = resolve_typespec(entity->decl->func_decl.ret_type);
+        ret_type = resolve_typespec(entity->decl->func_decl.ret_type, entity->decl->func_decl.ret_loc);
         complete_type(ret_type);
     }
     entity->type = type_func(buf_len(param_types), param_types, ret_type);
+    buf_free(param_types);
     entity->is_set = true;
     buf_push(ordered_entities, entity);
 }
@@ -1131,13 +1709,17 @@ void resolve_stmnt(Stmnt* stmnt, Type* ret_type) {
     if (!stmnt) {
         return;
     }
+    enter_resolve_nesting(stmnt->loc);
     switch (stmnt->type) {
     case STMNT_DECL: {
         assert(stmnt->decl_stmnt.decl->type == DECL_VAR);
         Decl* decl = stmnt->decl_stmnt.decl;
         Entity* entity = entity_local_var(decl->name);
         if (decl->var_decl.type) {
-            entity->type = resolve_typespec(decl->var_decl.type);
+            entity->type = resolve_typespec(decl->var_decl.type, decl->loc);
+            if (decl->var_decl.expr && resolve_expr(decl->var_decl.expr, entity->type, false).type != entity->type) {
+                resolve_error(decl->loc, "declared type and the expression types mismatch in %s", decl->name);
+            }
         }
         else if (decl->var_decl.expr) {
             entity->type = resolve_expr(decl->var_decl.expr, NULL, false).type;
@@ -1181,7 +1763,7 @@ void resolve_stmnt(Stmnt* stmnt, Type* ret_type) {
         break;
     }
     case STMNT_FOR: {
-        Entity** local_entity = enter_scope();
+        size_t local_entity = enter_scope();
         for (size_t i = 0; i < stmnt->for_stmnt.num_init; i++) {
             resolve_stmnt(stmnt->for_stmnt.init[i], NULL);
         }
@@ -1199,11 +1781,12 @@ void resolve_stmnt(Stmnt* stmnt, Type* ret_type) {
     case STMNT_ASSIGN: {
         Entity* left_entity = get_expr_entity(stmnt->assign_stmnt.left);
         if (left_entity) {
-            left_entity->is_set = true;
+            atomic_set(&left_entity->is_set, true);
+            record_dep(left_entity, DEP_SET);
         }
-        bool left_used = left_entity->is_used;
+        assign_target = left_entity;
         ResolvedExpr left = resolve_expr(stmnt->assign_stmnt.left, NULL, false);
-        left_entity->is_used = left_used;
+        assign_target = NULL;
         ResolvedExpr right = resolve_expr(stmnt->assign_stmnt.right, left.type, false);
         if (stmnt->assign_stmnt.op != '=') {
             if (left.type != type_int) {
@@ -1248,12 +1831,50 @@ void resolve_stmnt(Stmnt* stmnt, Type* ret_type) {
     default:
         assert(0);
     }
+    leave_resolve_nesting();
+}
+
+// resolves a stmnt of a block. on an error the rest of the block is still checked
+void resolve_stmnt_recover(Stmnt* stmnt, Type* ret_type) {
+    jmp_buf env;
+    jmp_buf* outer = resolve_recover;
+    size_t depth = resolve_depth;
+    size_t expr_stack_len = buf_len(expr_stack);
+    size_t local_entity = enter_scope();
+    resolve_recover = &env;
+    if (setjmp(env)) {
+        resolve_recover = outer;
+        resolve_depth = depth;
+        assign_target = NULL;
+        if (expr_stack) {
+            _buf_hdr(expr_stack)->len = expr_stack_len;
+        }
+        leave_scope(local_entity);
+        const char* name = NULL;
+        if (stmnt->type == STMNT_DECL) {
+            name = stmnt->decl_stmnt.decl->name;
+        }
+        else if (stmnt->type == STMNT_INIT && stmnt->init_stmnt.left->type == EXPR_NAME) {
+            name = stmnt->init_stmnt.left->name_expr.name;
+        }
+        if (name) {
+            // later uses of the broken local fail silently
+            Entity* entity = entity_local_var(name);
+            entity->is_poisoned = true;
+            push_local_entity(entity);
+        }
+        return;
+    }
+    resolve_stmnt(stmnt, ret_type);
+    resolve_recover = outer;
 }
 
 void resolve_stmnt_block(BlockStmnt block, Type* ret_type) {
-    Entity** local_entity = enter_scope();
+    size_t local_entity = enter_scope();
     for (size_t i = 0; i < block.num_stmnts; i++) {
-        resolve_stmnt(block.stmnts[i], ret_type);
+        if (block.stmnts[i]) {
+            resolve_stmnt_recover(block.stmnts[i], ret_type);
+        }
     }
     leave_scope(local_entity);
 }
@@ -1261,28 +1882,43 @@ void resolve_stmnt_block(BlockStmnt block, Type* ret_type) {
 void resolve_func(Entity* entity) {
     assert(entity->e_type == ENTITY_FUNC);
     Decl* decl = entity->decl;
-    Entity** local_entity = enter_scope();
+    parse_func_body(decl);
+    size_t local_entity = enter_scope();
+    jmp_buf env;
+    jmp_buf* outer = resolve_recover;
+    size_t depth = resolve_depth;
+    resolve_recover = &env;
+    current_entity = entity;
+    if (setjmp(env)) {
+        resolve_recover = outer;
+        current_entity = NULL;
+        resolve_depth = depth;
+        leave_scope(local_entity);
+        return;
+    }
     for (size_t i = 0; i < decl->func_decl.num_params; i++) {
         Entity* param = entity_local_var(decl->func_decl.params[i].name);
-        param->type = resolve_typespec(decl->func_decl.params[i].type);
+        param->type = resolve_typespec(decl->func_decl.params[i].type, decl->func_decl.params[i].loc);
         push_local_entity(param);
     }
-    resolve_stmnt_block(decl->func_decl.block, resolve_typespec(decl->func_decl.ret_type));
+    resolve_stmnt_block(decl->func_decl.block, resolve_typespec(decl->func_decl.ret_type, decl->func_decl.ret_loc));
+    resolve_recover = outer;
+    current_entity = NULL;
     leave_scope(local_entity);
 }
 
 void check_entity_usage(void) {
-    for (KeyValPair* it = global_entities.pairs; it != global_entities.pairs + global_entities.cap; it++) {
-        Entity* entity = it->val;
-        if (entity) {
+    for (size_t i = 0; i < buf_len(global_entity_list); i++) {
+        Entity* entity = global_entity_list[i];
+        if (!entity->is_poisoned) {
             if (entity->is_set && !entity->is_used) {
-                resolve_warning(entity->loc, "warning: %s is set but never used", entity->name);
+                resolve_warning(entity->info->loc, "%s is set but never used", entity->name);
             }
             else if (!entity->is_set && entity->is_used) {
-                resolve_warning(entity->loc, "warning: %s is used without setting", entity->name);
+                resolve_warning(entity->info->loc, "%s is used without setting", entity->name);
             }
             else if (!entity->is_set && !entity->is_used) {
-                resolve_warning(entity->loc, "warning: %s is not set nor used", entity->name);
+                resolve_warning(entity->info->loc, "%s is not set nor used", entity->name);
             }
         }
     }
@@ -1293,21 +1929,218 @@ void complete_entity(Entity* entity) {
     if (entity->e_type == ENTITY_TYPE) {
         complete_type(entity->type);
     }
-    else if (entity->e_type == ENTITY_FUNC) {
-        resolve_func(entity);
+}
+
+// resolves only the function bodies reachable from main or from global declarations.
+// resolving a body can demand further bodies, which are queued when they are first used.
+void resolve_demanded_funcs(void) {
+    const char* main_name = str_intern("main");
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        Entity* entity = ordered_entities[i];
+        if (entity->e_type == ENTITY_FUNC && entity->decl->func_decl.lazy_body 
+            && (entity->is_used || entity->name == main_name)) {
+            buf_push(demanded_funcs, entity);
+        }
+    }
+    is_demanding_funcs = true;
+    for (size_t i = 0; i < buf_len(demanded_funcs); i++) {
+        if (demanded_funcs[i]->decl->func_decl.lazy_body) {
+            resolve_func(demanded_funcs[i]);
+        }
     }
+    is_demanding_funcs = false;
+    buf_free(demanded_funcs);
 }
 
-void complete_entities(void) {
-    for (KeyValPair* it = global_entities.pairs; it != global_entities.pairs + global_entities.cap; it++) {
-        if (it->val) {
-            complete_entity(it->val);
+// a failed entity is already reported and poisoned. the rest are still completed
+void complete_entity_recover(Entity* entity) {
+    jmp_buf env;
+    jmp_buf* outer = resolve_recover;
+    resolve_recover = &env;
+    if (setjmp(env)) {
+        resolve_recover = outer;
+        resolve_depth = 0;
+        leave_scope(0);
+        return;
+    }
+    complete_entity(entity);
+    resolve_recover = outer;
+}
+
+// typespecs without a non literal array size resolve the same anywhere. one naming anything
+// but a type is left to its uses, so that each of them is reported where it is
+bool is_context_free_typespec(TypeSpec* typespec) {
+    switch (typespec->type) {
+    case TYPESPEC_NAME: {
+        Entity* entity = get_entity(typespec->name.name);
+        return entity && entity->e_type == ENTITY_TYPE;
+    }
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < typespec->func.num_params; i++) {
+            if (!is_context_free_typespec(typespec->func.params[i])) {
+                return false;
+            }
         }
+        return is_context_free_typespec(typespec->func.ret_type);
+    case TYPESPEC_ARRAY:
+        return typespec->array.size->type == EXPR_INT && is_context_free_typespec(typespec->array.base);
+    case TYPESPEC_PTR:
+        return is_context_free_typespec(typespec->ptr.base);
+    default:
+        assert(0);
+        return false;
+    }
+}
+
+// hash consed typespecs are shared between function bodies. resolving them up front leaves
+// the bodies only reading their cached types
+void resolve_shared_typespecs(void) {
+    for (size_t i = 0; i < buf_len(ordered_typespecs); i++) {
+        TypeSpec* typespec = ordered_typespecs[i];
+        if (typespec->resolved_type || !is_context_free_typespec(typespec)) {
+            continue;
+        }
+        jmp_buf env;
+        jmp_buf* outer = resolve_recover;
+        resolve_recover = &env;
+        if (!setjmp(env)) {
+            // only the named types can fail here, and they report at their declarations
+            resolve_typespec(typespec, (SrcLoc) { src_path, 0 });
+        }
+        resolve_recover = outer;
+    }
+}
+
+Entity** resolve_func_queue = NULL;
+DiagSet* resolve_func_diags = NULL;
+Entity*** resolve_worker_bindings = NULL;
+
+void resolve_func_job(size_t worker, size_t item) {
+    worker_bindings = resolve_worker_bindings ? resolve_worker_bindings[worker] : NULL;
+    resolve_func(resolve_func_queue[item]);
+    resolve_func_diags[item] = take_diags();
+}
+
+// every global is resolved by now, so function bodies only read shared state besides
+// deriving types, and they are resolved on num_jobs threads
+void resolve_funcs(void) {
+    resolve_shared_typespecs();
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        Entity* entity = ordered_entities[i];
+        if (entity->e_type == ENTITY_FUNC && !entity->info->cached) {
+            // parsing touches the lexer, so bodies skipped by the parser are parsed on this thread
+            parse_func_body(entity->decl);
+            buf_push(resolve_func_queue, entity);
+        }
+    }
+    size_t num_funcs = buf_len(resolve_func_queue);
+    size_t num_threads = parallel_threads(num_funcs);
+    if (num_threads > 1) {
+        resolve_worker_bindings = xcalloc(num_threads, sizeof(Entity**));
+        for (size_t i = 0; i < num_threads; i++) {
+            resolve_worker_bindings[i] = xcalloc(num_interns, sizeof(Entity*));
+        }
+    }
+    resolve_func_diags = xcalloc(num_funcs, sizeof(DiagSet));
+    DiagSet global_diags = take_diags();
+    defer_error_limit = true;
+    parallel_for(num_funcs, resolve_func_job);
+    defer_error_limit = false;
+    // diagnostics are merged in function order, however the bodies were scheduled
+    merge_diags(global_diags);
+    for (size_t i = 0; i < num_funcs; i++) {
+        merge_diags(resolve_func_diags[i]);
+    }
+    if (resolve_worker_bindings) {
+        for (size_t i = 0; i < num_threads; i++) {
+            free(resolve_worker_bindings[i]);
+        }
+        free(resolve_worker_bindings);
+        resolve_worker_bindings = NULL;
+    }
+    free(resolve_func_diags);
+    resolve_func_diags = NULL;
+    buf_free(resolve_func_queue);
+}
+
+void complete_entities(void) {
+    for (size_t i = 0; i < buf_len(global_entity_list); i++) {
+        complete_entity_recover(global_entity_list[i]);
+    }
+    if (lazy_func_bodies && !incremental) {
+        // parsing a body on demand touches the lexer, so these stay on this thread
+        resolve_demanded_funcs();
+    }
+    else {
+        resolve_funcs();
     }
     check_entity_usage();
 }
 
-#pragma TODO("Align fields in aggregate types")
+// Tree shaking ===
+
+const char** tree_shake_roots = NULL; // main when none are given
+
+void mark_reachable(Entity* entity, Entity*** stack) {
+    if (entity && entity->decl && !entity->is_reachable) {
+        entity->is_reachable = true;
+        buf_push(*stack, entity);
+    }
+}
+
+// drops the globals that are not reachable from the roots from ordered_entities, so that they
+// are neither generated nor cached. a clean entity of an incremental build was not resolved
+// again and its edges are the ones cached for it
+void shake_entities(void) {
+    if (!tree_shake_roots) {
+        buf_push(tree_shake_roots, str_intern("main"));
+    }
+    Entity** stack = NULL;
+    for (size_t i = 0; i < buf_len(tree_shake_roots); i++) {
+        Entity* root = get_entity(tree_shake_roots[i]);
+        if (!root || !root->decl) {
+            report_resolve_error(((SrcLoc) { "{roots}", 0 }), "Root %s is not declared", tree_shake_roots[i]);
+            continue;
+        }
+        mark_reachable(root, &stack);
+    }
+    while (buf_len(stack)) {
+        Entity* entity = stack[--_buf_hdr(stack)->len];
+        for (size_t i = 0; i < buf_len(entity->info->deps); i++) {
+            mark_reachable(entity->info->deps[i].entity, &stack);
+        }
+        if (entity->info->cached) {
+            for (size_t i = 0; i < buf_len(entity->info->cached->deps); i++) {
+                mark_reachable(get_entity(entity->info->cached->deps[i].name), &stack);
+            }
+        }
+    }
+    buf_free(stack);
+    size_t num_entities = buf_len(ordered_entities);
+    size_t num_funcs = 0, num_vars = 0, num_types = 0;
+    size_t len = 0;
+    for (size_t i = 0; i < num_entities; i++) {
+        Entity* entity = ordered_entities[i];
+        if (entity->is_reachable) {
+            ordered_entities[len++] = entity;
+        }
+        else if (entity->e_type == ENTITY_FUNC) {
+            num_funcs++;
+        }
+        else if (entity->e_type == ENTITY_TYPE) {
+            num_types++;
+        }
+        else {
+            num_vars++;
+        }
+    }
+    if (ordered_entities) {
+        _buf_hdr(ordered_entities)->len = len;
+    }
+    printf("Tree shaking: kept %zu of %zu declarations, pruned %zu funcs, %zu vars and consts and %zu types\n",
+           len, num_entities, num_funcs, num_vars, num_types);
+}
+
 #pragma TODO("Do pointer decaying for arrays")
 
 void resolve_decl_test(void) {
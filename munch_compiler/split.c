@@ -0,0 +1,96 @@
+// Split output ===
+
+// --split=N writes the generated C as one header and N source files so that the C compiler can
+// build them in parallel. The header has the forward declarations, the aggregates, the enum
+// consts and extern declarations of the global vars and consts. The first source file defines
+// the vars and consts, and the function definitions are spread over the source files in order,
+// about the same number of bytes each. A manifest lists the files.
+//
+// The files are cut from gen_buf with the byte ranges gen records for each entity, the same
+// ranges the incremental cache uses, so nothing is generated twice.
+
+size_t split_files = 0; // 0 writes a single .c file
+
+const char* path_base_name(const char* path) {
+    const char* name = path;
+    for (const char* it = path; *it; it++) {
+        if (*it == '/' || *it == '\\') {
+            name = it + 1;
+        }
+    }
+    return name;
+}
+
+void split_append_forward(char** buf, Entity* entity) {
+    buf_printf(*buf, "%.*s", (int)(entity->info->forward_end - entity->info->forward_start), gen_buf + entity->info->forward_start);
+}
+
+void split_append_def(char** buf, Entity* entity) {
+    buf_printf(*buf, "%.*s", (int)(entity->info->def_end - entity->info->def_start), gen_buf + entity->info->def_start);
+}
+
+bool write_split_files(const char* path, size_t num_files) {
+    assert(num_files > 0);
+    char* stem = strf("%.*s", (int)path_stem_len(path), path);
+    char* header_path = strf("%s.h", stem);
+    char** sources = xcalloc(num_files, sizeof(char*));
+    for (size_t i = 0; i < num_files; i++) {
+        buf_printf(sources[i], "#include \"%s\"\n\n// Defintions\n", path_base_name(header_path));
+    }
+    char* header = NULL;
+    buf_printf(header, "#pragma once\n\n// Forward declarations\n");
+    size_t funcs_len = 0;
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        Entity* entity = ordered_entities[i];
+        split_append_forward(&header, entity);
+        if (entity->e_type == ENTITY_FUNC) {
+            funcs_len += entity->info->def_end - entity->info->def_start;
+        }
+    }
+    buf_printf(header, "\n// Defintions\n");
+    size_t file = 0;
+    size_t file_end = funcs_len / num_files; // where the functions of the current file end
+    size_t funcs_pos = 0;
+    for (size_t i = 0; i < buf_len(ordered_entities); i++) {
+        Entity* entity = ordered_entities[i];
+        switch (entity->e_type) {
+        case ENTITY_VAR:
+            buf_printf(header, "extern %s;\n", type_to_cdecl(entity->type, entity->name));
+            split_append_def(&sources[0], entity);
+            break;
+        case ENTITY_CONST:
+            buf_printf(header, "extern const %s;\n", type_to_cdecl(entity->type, entity->name));
+            split_append_def(&sources[0], entity);
+            break;
+        case ENTITY_FUNC:
+            // a function goes to the file its first byte falls in
+            while (file < num_files - 1 && funcs_pos >= file_end) {
+                file++;
+                file_end = funcs_len / num_files * (file + 1);
+            }
+            split_append_def(&sources[file], entity);
+            funcs_pos += entity->info->def_end - entity->info->def_start;
+            break;
+        default:
+            split_append_def(&header, entity);
+            break;
+        }
+    }
+    char* manifest = NULL;
+    buf_printf(manifest, "header %s\n", path_base_name(header_path));
+    bool status = write_file(header_path, header, buf_len(header));
+    for (size_t i = 0; i < num_files; i++) {
+        char* source_path = strf("%s_%zu.c", stem, i);
+        buf_printf(manifest, "source %s\n", path_base_name(source_path));
+        status = status && write_file(source_path, sources[i], buf_len(sources[i]));
+        buf_free(sources[i]);
+        free(source_path);
+    }
+    status = status && write_file(strf("%s.manifest", stem), manifest, buf_len(manifest));
+    buf_free(manifest);
+    buf_free(header);
+    free(sources);
+    free(header_path);
+    free(stem);
+    return status;
+}